@@ -0,0 +1,51 @@
+#ifndef BAKE_CACHE_H
+#define BAKE_CACHE_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Results baked at load time (the PVS, the specular IBL) are cached on disk in files that start with a 4 character
+// magic and the signature of what the bake was made from, followed by the baked data as is. A cache is only used
+// when both match, so a change of the scene or the parameters bakes again.
+
+// start of a signature, feed it everything the bake depends on with BakeSignature
+#define BAKE_SIGNATURE_SEED 14695981039346656037ULL
+
+// FNV-1a over size bytes of data, continuing from hash
+inline uint64_t BakeSignature(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// opens a cache and checks its header; false when there is none or it holds something else. On success in is at the
+// data, the caller still has to check in after reading it (a cut off file)
+inline bool OpenBakeCache(std::ifstream &in, const string &path, const char *magic, uint64_t signature)
+{
+    in.open(path.c_str(), std::ios::binary);
+    if(!in)
+        return false;
+    char storedMagic[4];
+    uint64_t storedSignature;
+    in.read(storedMagic, 4);
+    in.read((char*)&storedSignature, sizeof(storedSignature));
+    return in && std::memcmp(storedMagic, magic, 4) == 0 && storedSignature == signature;
+}
+
+// creates a cache and writes its header, the caller writes the data after it
+inline bool CreateBakeCache(std::ofstream &out, const string &path, const char *magic, uint64_t signature)
+{
+    out.open(path.c_str(), std::ios::binary);
+    out.write(magic, 4);
+    out.write((const char*)&signature, sizeof(signature));
+    return (bool)out;
+}
+#endif
@@ -0,0 +1,312 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// froxel grid: screen tiles times exponential depth slices
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+// texture units of the three light buffers, above anything a material binds
+#define CLUSTER_LIGHT_UNIT 8
+// size of the objectLights uniform array of the lit shaders
+#define MAX_OBJECT_LIGHTS 16
+
+// Clustered forward lighting: the view frustum is split into a CLUSTER_X x CLUSTER_Y x CLUSTER_Z grid (tiles of the
+// screen, slices exponential in depth), and every frame the CPU lists the point lights that reach each cluster.
+// A fragment finds its cluster from gl_FragCoord and only loops over those lights, so the cost per fragment
+// follows how many lights overlap it, not how many there are. Each light gets a finite range for that, where its
+// attenuated brightness has dropped below a threshold; the shaders fade it out to 0 there.
+// The lists go to the shaders in buffer textures (GL 3.1), which 3.3 contexts have too:
+// lightData holds 4 texels per light, clusterData (offset, count) per cluster, lightIndices the lists.
+// A draw can instead pass its own list, the lights whose range touches its bounds (ObjectLights), as uniforms:
+// cheaper than the grid for the many small objects only one or two lamps reach.
+class ClusteredLights
+{
+public:
+    struct Light {
+        glm::vec3 position;
+        glm::vec3 ambient;
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+        float constant = 1.0f;
+        float linear = 0.0f;
+        float quadratic = 0.0f;
+        float range = 0.0f; // 0 to get it from the attenuation
+    };
+
+    // lights reaching one object; count is -1 when there are more than MAX_OBJECT_LIGHTS (the grid is used then)
+    struct ObjectLightList {
+        int count = 0;
+        int indices[MAX_OBJECT_LIGHTS];
+    };
+
+    struct Stats {
+        unsigned int lights = 0;
+        unsigned int visibleLights = 0; // lights that reach into the frustum at all
+        unsigned int assignments = 0; // light indices over all clusters
+        unsigned int maxPerCluster = 0;
+        float milliseconds = 0.0f;
+    };
+
+    ClusteredLights(float screenWidth, float screenHeight, float nearPlane, float farPlane)
+        : screenSize(screenWidth, screenHeight), nearPlane(nearPlane), farPlane(farPlane)
+    {
+        unsigned int *buffers[3] = {&lightBuffer, &clusterBuffer, &indexBuffer};
+        unsigned int *textures[3] = {&lightTexture, &clusterTexture, &indexTexture};
+        GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            glGenBuffers(1, buffers[i]);
+            glBindBuffer(GL_TEXTURE_BUFFER, *buffers[i]);
+            // a buffer texture needs storage before it is attached
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_DYNAMIC_DRAW);
+            glGenTextures(1, textures[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, *textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], *buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        clusterCounts.resize(CLUSTER_X * CLUSTER_Y * CLUSTER_Z);
+        clusterData.resize(2 * CLUSTER_X * CLUSTER_Y * CLUSTER_Z);
+    }
+
+    // distance at which the brightest channel of the light, attenuated the way the shaders do it
+    // (1 / (constant + linear * d^2 + quadratic * d^4)), drops below threshold
+    static float Range(const Light &light, float threshold = 0.002f)
+    {
+        glm::vec3 total = light.ambient + light.diffuse + light.specular;
+        float brightest = std::max(total.x, std::max(total.y, total.z));
+        float low = 0.0f, high = 1.0f;
+        while(high < 1000.0f && brightest * attenuation(light, high) > threshold)
+            high *= 2.0f;
+        for(unsigned int i = 0; i < 24; i++)
+        {
+            float middle = 0.5f * (low + high);
+            if(brightest * attenuation(light, middle) > threshold)
+                low = middle;
+            else
+                high = middle;
+        }
+        return high;
+    }
+
+    // the lights never move, so they are uploaded once
+    void SetLights(const vector<Light> &newLights)
+    {
+        lights = newLights;
+        vector<glm::vec4> texels;
+        for(unsigned int i = 0; i < lights.size(); i++)
+        {
+            Light &light = lights[i];
+            if(light.range <= 0.0f)
+                light.range = Range(light);
+            texels.push_back(glm::vec4(light.position, light.range));
+            texels.push_back(glm::vec4(light.ambient, light.constant));
+            texels.push_back(glm::vec4(light.diffuse, light.linear));
+            texels.push_back(glm::vec4(light.specular, light.quadratic));
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max((size_t)16, texels.size() * sizeof(glm::vec4)), texels.empty() ? NULL : &texels[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // assigns the lights to this frame's clusters and uploads the lists; projection is a perspective with fovY
+    // (radians) and aspect, using the near/far planes given to the constructor
+    void Update(const glm::mat4 &view, float fovY, float aspect)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        stats = Stats();
+        stats.lights = lights.size();
+        std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+        pairs.clear();
+
+        float tanHalfY = std::tan(0.5f * fovY);
+        float tanHalfX = tanHalfY * aspect;
+        float logDepthRange = std::log(farPlane / nearPlane);
+        for(unsigned int l = 0; l < lights.size(); l++)
+        {
+            glm::vec3 p = glm::vec3(view * glm::vec4(lights[l].position, 1.0f));
+            float depth = -p.z;
+            float range = lights[l].range;
+            if(depth + range < nearPlane || depth - range > farPlane)
+                continue;
+            float nearest = std::max(depth - range, nearPlane);
+            float furthest = std::min(depth + range, farPlane);
+            int firstSlice = slice(nearest, logDepthRange);
+            int lastSlice = slice(furthest, logDepthRange);
+            bool counted = false;
+            for(int z = firstSlice; z <= lastSlice; z++)
+            {
+                // the part of the sphere's depth range inside this slice bounds its screen extent there
+                float sliceNear = std::max(nearest, nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTER_Z));
+                float sliceFar = std::min(furthest, nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTER_Z));
+                int x0, x1, y0, y1;
+                if(!tileRange(p.x, range, sliceNear, sliceFar, tanHalfX, CLUSTER_X, x0, x1) ||
+                   !tileRange(p.y, range, sliceNear, sliceFar, tanHalfY, CLUSTER_Y, y0, y1))
+                    continue;
+                counted = true;
+                for(int y = y0; y <= y1; y++)
+                {
+                    for(int x = x0; x <= x1; x++)
+                    {
+                        unsigned int cluster = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+                        clusterCounts[cluster]++;
+                        pairs.push_back(cluster);
+                        pairs.push_back(l);
+                    }
+                }
+            }
+            stats.visibleLights += counted;
+        }
+
+        // counting sort of the (cluster, light) pairs into one index list
+        unsigned int offset = 0;
+        for(unsigned int c = 0; c < clusterCounts.size(); c++)
+        {
+            clusterData[2 * c] = offset;
+            clusterData[2 * c + 1] = 0;
+            offset += clusterCounts[c];
+            stats.maxPerCluster = std::max(stats.maxPerCluster, clusterCounts[c]);
+        }
+        indices.resize(std::max(1u, offset));
+        for(unsigned int i = 0; i < pairs.size(); i += 2)
+        {
+            unsigned int cluster = pairs[i];
+            indices[clusterData[2 * cluster] + clusterData[2 * cluster + 1]++] = pairs[i + 1];
+        }
+        stats.assignments = offset;
+
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, clusterData.size() * sizeof(uint32_t), &clusterData[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(uint32_t), &indices[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // sampler units and grid constants, once per shader (they never change)
+    void SetUniforms(Shader &shader) const
+    {
+        shader.use();
+        shader.setInt("lightData", CLUSTER_LIGHT_UNIT);
+        shader.setInt("clusterData", CLUSTER_LIGHT_UNIT + 1);
+        shader.setInt("lightIndices", CLUSTER_LIGHT_UNIT + 2);
+        glUniform3i(glGetUniformLocation(shader.ID, "clusterGrid"), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+        shader.setVec2("clusterScreenSize", screenSize);
+        shader.setVec2("clusterNearFar", glm::vec2(nearPlane, farPlane));
+        // slice = log(depth) * scale - bias, see slice()
+        float scale = CLUSTER_Z / std::log(farPlane / nearPlane);
+        shader.setVec2("clusterSliceParams", glm::vec2(scale, std::log(nearPlane) * scale));
+        shader.setInt("objectLightCount", -1);
+    }
+
+    // the lights whose range reaches into a world-space box
+    ObjectLightList ObjectLights(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+    {
+        return ObjectLights(vector<glm::vec3>(1, boxMin), vector<glm::vec3>(1, boxMax));
+    }
+
+    // the lights reaching any of the boxes, for instanced draws
+    ObjectLightList ObjectLights(const vector<glm::vec3> &boxMin, const vector<glm::vec3> &boxMax) const
+    {
+        ObjectLightList list;
+        for(unsigned int l = 0; l < lights.size(); l++)
+        {
+            bool reaches = false;
+            for(unsigned int b = 0; b < boxMin.size() && !reaches; b++)
+            {
+                glm::vec3 offset = glm::clamp(lights[l].position, boxMin[b], boxMax[b]) - lights[l].position;
+                reaches = glm::dot(offset, offset) <= lights[l].range * lights[l].range;
+            }
+            if(!reaches)
+                continue;
+            if(list.count == MAX_OBJECT_LIGHTS)
+            {
+                list.count = -1;
+                break;
+            }
+            list.indices[list.count++] = l;
+        }
+        return list;
+    }
+
+    // the draws that follow with this shader use list (in use, and the lights of this set bound)
+    static void SetObjectLights(Shader &shader, const ObjectLightList &list)
+    {
+        shader.setInt("objectLightCount", list.count);
+        if(list.count > 0)
+            glUniform1iv(glGetUniformLocation(shader.ID, "objectLights"), list.count, list.indices);
+    }
+
+    // back to the cluster grid for the draws that follow with this shader
+    static void UseClusters(Shader &shader)
+    {
+        shader.setInt("objectLightCount", -1);
+    }
+
+    // binds this set's buffers, the lit shaders then all read them until another set is bound
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHT_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHT_UNIT + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+        glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHT_UNIT + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    const Stats &GetStats() const { return stats; }
+    const vector<Light> &Lights() const { return lights; }
+
+private:
+    glm::vec2 screenSize;
+    float nearPlane, farPlane;
+    vector<Light> lights;
+    unsigned int lightBuffer = 0, clusterBuffer = 0, indexBuffer = 0;
+    unsigned int lightTexture = 0, clusterTexture = 0, indexTexture = 0;
+    vector<unsigned int> clusterCounts;
+    vector<uint32_t> clusterData;
+    vector<uint32_t> indices;
+    vector<unsigned int> pairs;
+    Stats stats;
+
+    static float attenuation(const Light &light, float distance)
+    {
+        float d2 = distance * distance;
+        return 1.0f / (light.constant + light.linear * d2 + light.quadratic * d2 * d2);
+    }
+
+    int slice(float depth, float logDepthRange) const
+    {
+        int z = (int)std::floor(std::log(depth / nearPlane) / logDepthRange * CLUSTER_Z);
+        return std::min(std::max(z, 0), CLUSTER_Z - 1);
+    }
+
+    // tiles covered along one screen axis by [center - radius, center + radius] seen between depths near and far:
+    // coordinate / (depth * tanHalf) is monotonic in depth for a fixed coordinate, so the corners give the bounds
+    static bool tileRange(float center, float radius, float nearDepth, float farDepth, float tanHalf, int tiles, int &first, int &last)
+    {
+        float low = center - radius, high = center + radius;
+        float ndcMin = std::min(low / (nearDepth * tanHalf), low / (farDepth * tanHalf));
+        float ndcMax = std::max(high / (nearDepth * tanHalf), high / (farDepth * tanHalf));
+        if(ndcMax < -1.0f || ndcMin > 1.0f)
+            return false;
+        first = std::max(0, (int)std::floor((ndcMin * 0.5f + 0.5f) * tiles));
+        last = std::min(tiles - 1, (int)std::floor((ndcMax * 0.5f + 0.5f) * tiles));
+        return first <= last;
+    }
+};
+#endif
@@ -0,0 +1,283 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// Hierarchical-Z buffer: the scene depth reduced into a mip chain where every texel holds the min (r) and max (g)
+// depth of the screen area it covers. The pyramid of frame N is built on the GPU; one coarse level of it is read
+// back asynchronously (PBO + fence, so the CPU never waits on the GPU) and reduced further on the CPU, where frame
+// N+1 or N+2 tests its objects against it, projected with the view-projection the pyramid was rendered with.
+// The farthest depth a box would have to be in front of is the max of the few texels its screen rect covers.
+class DepthPyramid
+{
+public:
+    struct Stats {
+        unsigned int tested = 0;
+        unsigned int occluded = 0;
+        unsigned int age = 0; // frames between the readback that is used and the current frame
+    };
+
+    unsigned int texture = 0;
+
+    // the texel count a box may span per axis at the level it is tested on; coarser level = fewer texels to read
+    // but more pessimistic depth
+    int testTexels = 2;
+
+    DepthPyramid(unsigned int width, unsigned int height, unsigned int readbackWidth = 128)
+        : width(width), height(height)
+    {
+        levels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for(int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RG32F, levelWidth(level), levelHeight(level), 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &FBO);
+        // the reduction shader makes its full screen triangle from gl_VertexID, but core profile still wants a VAO
+        glGenVertexArrays(1, &emptyVAO);
+
+        readbackLevel = 0;
+        while(readbackLevel < levels - 1 && levelWidth(readbackLevel) > (int)readbackWidth)
+            readbackLevel++;
+        glGenBuffers(1, &PBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        glBufferData(GL_PIXEL_PACK_BUFFER, levelWidth(readbackLevel) * levelHeight(readbackLevel) * 2 * sizeof(float), NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // reduces depthTexture (same size as the pyramid) into the pyramid and starts a readback if none is in flight.
+    // Leaves the pyramid's framebuffer unbound (0), the caller rebinds its own.
+    void Build(unsigned int depthTexture, Shader &reduceShader, const glm::mat4 &viewProjection)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glDisable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        reduceShader.use();
+        reduceShader.setInt("source", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(emptyVAO);
+
+        for(int level = 0; level < levels; level++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+            glViewport(0, 0, levelWidth(level), levelHeight(level));
+            reduceShader.setBool("firstLevel", level == 0);
+            if(level == 0)
+            {
+                glBindTexture(GL_TEXTURE_2D, depthTexture);
+            }
+            else
+            {
+                // only the level read from is visible to the shader, so it can't overlap the level written to
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+                reduceShader.setInt("sourceWidth", levelWidth(level - 1));
+                reduceShader.setInt("sourceHeight", levelHeight(level - 1));
+            }
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        built = true;
+        builtViewProjection = viewProjection;
+
+        if(!fence)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, readbackLevel);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+            glReadPixels(0, 0, levelWidth(readbackLevel), levelHeight(readbackLevel), GL_RG, GL_FLOAT, (void*)0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            pendingViewProjection = viewProjection;
+            pendingAge = 0;
+        }
+
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_DEPTH_TEST);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // call once at the start of a frame: takes over a readback that has finished, never waits for one
+    void BeginFrame()
+    {
+        stats.tested = 0;
+        stats.occluded = 0;
+        if(ready)
+            stats.age++;
+        if(!fence)
+            return;
+        pendingAge++;
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return;
+        glDeleteSync(fence);
+        fence = 0;
+
+        int w = levelWidth(readbackLevel), h = levelHeight(readbackLevel);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        const float *data = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, w * h * 2 * sizeof(float), GL_MAP_READ_BIT);
+        if(data)
+        {
+            cpuLevels.resize(1);
+            cpuLevels[0].width = w;
+            cpuLevels[0].height = h;
+            cpuLevels[0].minMax.assign(data, data + w * h * 2);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            reduceOnCpu();
+            viewProjection = pendingViewProjection;
+            ready = true;
+            stats.age = pendingAge;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // false until the first readback arrives, nothing can be culled before that
+    bool Ready() const { return ready; }
+
+    // true when the box is certainly hidden behind the depth the pyramid was built from
+    bool Occluded(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        if(!ready)
+            return false;
+        stats.tested++;
+        glm::vec2 rectMin(1e30f), rectMax(-1e30f);
+        float nearest = 1.0f;
+        for(int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 p = viewProjection * glm::vec4(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z, 1.0f);
+            // a corner behind the camera (or on the near plane) makes the projected rect unbounded
+            if(p.w <= 1e-4f)
+                return false;
+            glm::vec3 ndc = glm::vec3(p) / p.w;
+            rectMin = glm::min(rectMin, glm::vec2(ndc));
+            rectMax = glm::max(rectMax, glm::vec2(ndc));
+            nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+        if(nearest <= 0.0f || rectMax.x < -1.0f || rectMax.y < -1.0f || rectMin.x > 1.0f || rectMin.y > 1.0f)
+            return false;
+        rectMin = glm::clamp(rectMin, glm::vec2(-1.0f), glm::vec2(1.0f));
+        rectMax = glm::clamp(rectMax, glm::vec2(-1.0f), glm::vec2(1.0f));
+
+        // rect in pixels of the full resolution depth buffer
+        float x0 = (rectMin.x * 0.5f + 0.5f) * width, x1 = (rectMax.x * 0.5f + 0.5f) * width;
+        float y0 = (rectMin.y * 0.5f + 0.5f) * height, y1 = (rectMax.y * 0.5f + 0.5f) * height;
+        unsigned int level = 0;
+        int tx0, tx1, ty0, ty1;
+        while(true)
+        {
+            float scale = (float)(1 << (readbackLevel + level));
+            const Level &l = cpuLevels[level];
+            tx0 = std::min((int)(x0 / scale), l.width - 1);
+            tx1 = std::min((int)(x1 / scale), l.width - 1);
+            ty0 = std::min((int)(y0 / scale), l.height - 1);
+            ty1 = std::min((int)(y1 / scale), l.height - 1);
+            if((tx1 - tx0 < testTexels && ty1 - ty0 < testTexels) || level + 1 == cpuLevels.size())
+                break;
+            level++;
+        }
+
+        const Level &l = cpuLevels[level];
+        float nearestInRect = 1.0f, farthestInRect = 0.0f;
+        for(int y = ty0; y <= ty1; y++)
+        {
+            for(int x = tx0; x <= tx1; x++)
+            {
+                nearestInRect = std::min(nearestInRect, l.minMax[(y * l.width + x) * 2]);
+                farthestInRect = std::max(farthestInRect, l.minMax[(y * l.width + x) * 2 + 1]);
+            }
+        }
+        // in front of everything there: visible without looking any further
+        if(nearest <= nearestInRect)
+            return false;
+        bool occluded = nearest > farthestInRect;
+        stats.occluded += occluded;
+        return occluded;
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+    // the GPU side pyramid, for tests done in shaders: valid once Build has run, rendered with builtViewProjection
+    bool Built() const { return built; }
+    const glm::mat4 &BuiltViewProjection() const { return builtViewProjection; }
+    int Levels() const { return levels; }
+    unsigned int Width() const { return width; }
+    unsigned int Height() const { return height; }
+
+private:
+    struct Level {
+        int width, height;
+        vector<float> minMax; // interleaved min, max
+    };
+
+    unsigned int width, height;
+    int levels;
+    int readbackLevel;
+    unsigned int FBO = 0, PBO = 0, emptyVAO = 0;
+    GLsync fence = 0;
+    bool built = false;
+    glm::mat4 builtViewProjection = glm::mat4(1.0f);
+    glm::mat4 pendingViewProjection = glm::mat4(1.0f);
+    unsigned int pendingAge = 0;
+
+    // CPU copy: the read back level and every coarser one
+    vector<Level> cpuLevels;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    bool ready = false;
+    Stats stats;
+
+    int levelWidth(int level) const { return std::max(1, (int)width >> level); }
+    int levelHeight(int level) const { return std::max(1, (int)height >> level); }
+
+    // same reduction as the shader: a 2x2 footprint, widened to 3 on the last row/column of an odd sized level
+    void reduceOnCpu()
+    {
+        while(cpuLevels.back().width > 1 || cpuLevels.back().height > 1)
+        {
+            const Level &source = cpuLevels.back();
+            Level level;
+            level.width = std::max(1, source.width / 2);
+            level.height = std::max(1, source.height / 2);
+            level.minMax.resize(level.width * level.height * 2);
+            for(int y = 0; y < level.height; y++)
+            {
+                int yEnd = (y == level.height - 1) ? source.height : std::min(source.height, 2 * y + 2);
+                for(int x = 0; x < level.width; x++)
+                {
+                    int xEnd = (x == level.width - 1) ? source.width : std::min(source.width, 2 * x + 2);
+                    float nearest = 1.0f, farthest = 0.0f;
+                    for(int sy = 2 * y; sy < yEnd; sy++)
+                    {
+                        for(int sx = 2 * x; sx < xEnd; sx++)
+                        {
+                            nearest = std::min(nearest, source.minMax[(sy * source.width + sx) * 2]);
+                            farthest = std::max(farthest, source.minMax[(sy * source.width + sx) * 2 + 1]);
+                        }
+                    }
+                    level.minMax[(y * level.width + x) * 2] = nearest;
+                    level.minMax[(y * level.width + x) * 2 + 1] = farthest;
+                }
+            }
+            cpuLevels.push_back(level);
+        }
+    }
+};
+#endif
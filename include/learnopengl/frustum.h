@@ -0,0 +1,225 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/mesh.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+using namespace std;
+
+// the 6 planes of a view frustum, (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside and the normal normalized
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction from the rows of projection * view, planes come out in world space
+    static Frustum FromMatrix(const glm::mat4 &m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+        for(unsigned int i = 0; i < 6; i++)
+            frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+        return frustum;
+    }
+};
+
+enum FrustumTest {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECT,
+    FRUSTUM_INSIDE
+};
+
+// classifies one box, for hierarchical queries where a box fully inside needs no tests of its contents
+inline FrustumTest TestBox(const Frustum &frustum, const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 center = 0.5f * (min + max);
+    glm::vec3 extents = 0.5f * (max - min);
+    FrustumTest result = FRUSTUM_INSIDE;
+    for(unsigned int p = 0; p < 6; p++)
+    {
+        const glm::vec4 &plane = frustum.planes[p];
+        float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        float reach = std::fabs(plane.x) * extents.x + std::fabs(plane.y) * extents.y + std::fabs(plane.z) * extents.z;
+        if(distance + reach < 0.0f)
+            return FRUSTUM_OUTSIDE;
+        if(distance - reach < 0.0f)
+            result = FRUSTUM_INTERSECT;
+    }
+    return result;
+}
+
+// the local bounding sphere moved into world space by an instance transform (scale taken as the largest axis scale)
+inline void TransformSphere(const Bounds &bounds, const glm::mat4 &transform, glm::vec3 &center, float &radius)
+{
+    float scale = std::max(glm::length(glm::vec3(transform[0])),
+                           std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    center = glm::vec3(transform * glm::vec4(bounds.Center, 1.0f));
+    radius = bounds.Radius * scale;
+}
+
+// bounding spheres in structure-of-arrays layout, so four of them fit one SSE register per component
+struct SphereBatch {
+    vector<float> x, y, z, radius;
+
+    void Clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void Add(const glm::vec3 &center, float r)
+    {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(r);
+    }
+
+    void Add(const Bounds &bounds, const glm::mat4 &transform)
+    {
+        glm::vec3 center;
+        float r;
+        TransformSphere(bounds, transform, center, r);
+        Add(center, r);
+    }
+
+    unsigned int Size() const { return x.size(); }
+};
+
+// world-space axis aligned boxes as center and half extents, also structure-of-arrays
+struct BoxBatch {
+    vector<float> cx, cy, cz, ex, ey, ez;
+
+    void Clear()
+    {
+        cx.clear(); cy.clear(); cz.clear();
+        ex.clear(); ey.clear(); ez.clear();
+    }
+
+    void Add(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        glm::vec3 center = 0.5f * (min + max);
+        glm::vec3 extents = 0.5f * (max - min);
+        cx.push_back(center.x); cy.push_back(center.y); cz.push_back(center.z);
+        ex.push_back(extents.x); ey.push_back(extents.y); ez.push_back(extents.z);
+    }
+
+    unsigned int Size() const { return cx.size(); }
+};
+
+// Writes 1 into visible[i] for every sphere that intersects the frustum, 0 otherwise, and returns how many are visible.
+// Four spheres are tested against a plane at once; a sphere is outside as soon as it is fully behind one plane.
+inline unsigned int CullSpheres(const Frustum &frustum, const SphereBatch &spheres, vector<unsigned char> &visible)
+{
+    unsigned int n = spheres.Size();
+    visible.resize(n);
+    unsigned int count = 0;
+    unsigned int i = 0;
+#ifdef FRUSTUM_SSE
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for(unsigned int p = 0; p < 6; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for(unsigned int k = 0; k < 4; k++)
+        {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+    // scalar tail (and the whole batch without SSE)
+    for(; i < n; i++)
+    {
+        bool inside = true;
+        for(unsigned int p = 0; p < 6 && inside; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            inside = plane.x * spheres.x[i] + plane.y * spheres.y[i] + plane.z * spheres.z[i] + plane.w > -spheres.radius[i];
+        }
+        visible[i] = inside;
+        count += inside;
+    }
+    return count;
+}
+
+// Same for boxes: a box is outside a plane when even its corner furthest along the plane normal is behind it,
+// i.e. when dot(n, center) + d + dot(|n|, extents) < 0.
+inline unsigned int CullBoxes(const Frustum &frustum, const BoxBatch &boxes, vector<unsigned char> &visible)
+{
+    unsigned int n = boxes.Size();
+    visible.resize(n);
+    unsigned int count = 0;
+    unsigned int i = 0;
+#ifdef FRUSTUM_SSE
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&boxes.cx[i]);
+        __m128 cy = _mm_loadu_ps(&boxes.cy[i]);
+        __m128 cz = _mm_loadu_ps(&boxes.cz[i]);
+        __m128 ex = _mm_loadu_ps(&boxes.ex[i]);
+        __m128 ey = _mm_loadu_ps(&boxes.ey[i]);
+        __m128 ez = _mm_loadu_ps(&boxes.ez[i]);
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for(unsigned int p = 0; p < 6; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))),
+                                      _mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for(unsigned int k = 0; k < 4; k++)
+        {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        bool inside = true;
+        for(unsigned int p = 0; p < 6 && inside; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            float distance = plane.x * boxes.cx[i] + plane.y * boxes.cy[i] + plane.z * boxes.cz[i] + plane.w;
+            float reach = std::fabs(plane.x) * boxes.ex[i] + std::fabs(plane.y) * boxes.ey[i] + std::fabs(plane.z) * boxes.ez[i];
+            inside = distance + reach > 0.0f;
+        }
+        visible[i] = inside;
+        count += inside;
+    }
+    return count;
+}
+#endif
@@ -0,0 +1,101 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader.h>
+
+#include <iostream>
+using namespace std;
+
+// texture units the lighting pass reads the G-buffer from
+#define GBUFFER_UNIT 0
+
+// G-buffer of the deferred path. The opaque pass draws with the usual shaders, which write the attributes of their
+// surface instead of a lit color when gBufferPass is set (through the same two outputs, so nothing else changes):
+//   albedoSpecTexture (RGBA8):  albedo, specular intensity
+//   normalTexture (RGBA16F):    octahedral packed normal, shininess, surface kind (SURFACE_* in deferred_lighting.fs)
+// Depth is the HDR framebuffer's own depth texture, attached here too: the occlusion passes, the lighting pass and
+// the sky and transparent passes drawn forward afterwards all see the same depth, whichever path filled it.
+// The lighting pass reads that depth, so it writes the HDR color targets through a framebuffer without it.
+class GBuffer
+{
+public:
+    unsigned int FBO = 0;
+    unsigned int lightingFBO = 0;
+    unsigned int albedoSpecTexture = 0;
+    unsigned int normalTexture = 0;
+    unsigned int depthTexture = 0;
+
+    // hdrColorBuffers are the two color targets of the HDR framebuffer (color, bright parts for the bloom)
+    GBuffer(unsigned int width, unsigned int height, unsigned int depthTexture, const unsigned int *hdrColorBuffers)
+        : depthTexture(depthTexture)
+    {
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        unsigned int *textures[2] = {&albedoSpecTexture, &normalTexture};
+        GLenum formats[2] = {GL_RGBA8, GL_RGBA16F};
+        for(unsigned int i = 0; i < 2; i++)
+        {
+            glGenTextures(1, textures[i]);
+            glBindTexture(GL_TEXTURE_2D, *textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+            // read texel for texel, the lighting quad covers the screen exactly
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, *textures[i], 0);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        unsigned int attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, attachments);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "G-buffer framebuffer not complete!" << std::endl;
+
+        glGenFramebuffers(1, &lightingFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO);
+        for(unsigned int i = 0; i < 2; i++)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, hdrColorBuffers[i], 0);
+        glDrawBuffers(2, attachments);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Deferred lighting framebuffer not complete!" << std::endl;
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~GBuffer()
+    {
+        glDeleteTextures(1, &albedoSpecTexture);
+        glDeleteTextures(1, &normalTexture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteFramebuffers(1, &lightingFBO);
+    }
+
+    // binds it for the geometry pass and clears the color targets only: the depth was already cleared (and maybe
+    // pre-filled by the occlusion pass) through the HDR framebuffer. Surface kind 0 is then "nothing drawn here".
+    void Bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        glClearBufferfv(GL_COLOR, 0, zero);
+        glClearBufferfv(GL_COLOR, 1, zero);
+    }
+
+    // binds the HDR color targets for the lighting pass and the three G-buffer targets as its samplers;
+    // the shader has to be in use
+    void BeginLighting(Shader &shader)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO);
+        unsigned int textures[3] = {albedoSpecTexture, normalTexture, depthTexture};
+        const char *names[3] = {"gAlbedoSpec", "gNormal", "gDepth"};
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + GBUFFER_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            shader.setInt(names[i], GBUFFER_UNIT + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+};
+#endif
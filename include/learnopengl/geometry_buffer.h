@@ -0,0 +1,243 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/mesh.h>
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// first-fit free-list allocator over a linear range of elements (vertices or indices).
+// It only does the bookkeeping, the actual memory is owned by GeometryBuffer.
+class RangeAllocator
+{
+public:
+    struct Range {
+        unsigned int offset;
+        unsigned int size;
+    };
+
+    RangeAllocator(unsigned int capacity = 0)
+    {
+        Reset(capacity);
+    }
+
+    void Reset(unsigned int capacity)
+    {
+        freeList.clear();
+        if(capacity > 0)
+            freeList.push_back({0, capacity});
+        this->capacity = capacity;
+        used = 0;
+    }
+
+    // returns false if there is no free range big enough, offset is valid only on success
+    bool Allocate(unsigned int size, unsigned int &offset)
+    {
+        for(unsigned int i = 0; i < freeList.size(); i++)
+        {
+            if(freeList[i].size < size)
+                continue;
+            offset = freeList[i].offset;
+            freeList[i].offset += size;
+            freeList[i].size -= size;
+            if(freeList[i].size == 0)
+                freeList.erase(freeList.begin() + i);
+            used += size;
+            return true;
+        }
+        return false;
+    }
+
+    // gives a range back, merging it with its free neighbours so the list doesn't fragment
+    void Free(unsigned int offset, unsigned int size)
+    {
+        if(size == 0)
+            return;
+        vector<Range>::iterator it = std::lower_bound(freeList.begin(), freeList.end(), offset,
+                                                      [](const Range &r, unsigned int o) { return r.offset < o; });
+        it = freeList.insert(it, {offset, size});
+        used -= size;
+        // merge with the next range
+        vector<Range>::iterator next = it + 1;
+        if(next != freeList.end() && it->offset + it->size == next->offset)
+        {
+            it->size += next->size;
+            freeList.erase(next);
+        }
+        // merge with the previous range
+        if(it != freeList.begin())
+        {
+            vector<Range>::iterator prev = it - 1;
+            if(prev->offset + prev->size == it->offset)
+            {
+                prev->size += it->size;
+                freeList.erase(it);
+            }
+        }
+    }
+
+    // the new space is added at the end, merged with the trailing free range if there is one
+    void Grow(unsigned int newCapacity)
+    {
+        if(newCapacity <= capacity)
+            return;
+        if(!freeList.empty() && freeList.back().offset + freeList.back().size == capacity)
+            freeList.back().size += newCapacity - capacity;
+        else
+            freeList.push_back({capacity, newCapacity - capacity});
+        capacity = newCapacity;
+    }
+
+    unsigned int Capacity() const { return capacity; }
+    unsigned int Used() const { return used; }
+
+private:
+    vector<Range> freeList; // sorted by offset
+    unsigned int capacity;
+    unsigned int used;
+};
+
+// where a mesh lives inside the shared geometry buffer
+struct GeometryAllocation {
+    unsigned int baseVertex = 0;
+    unsigned int vertexCount = 0;
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+    bool valid = false;
+};
+
+// one big vertex buffer and one big index buffer shared by all meshes, behind a single VAO.
+// Indices are kept relative to the mesh, draws add baseVertex (glDrawElementsBaseVertex / indirect commands).
+class GeometryBuffer
+{
+public:
+    unsigned int VAO = 0;
+
+    GeometryBuffer(unsigned int vertexCapacity, unsigned int indexCapacity)
+        : vertexAllocator(vertexCapacity), indexAllocator(indexCapacity)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, (size_t)vertexCapacity * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+
+        setupVertexAttributes();
+    }
+
+    GeometryAllocation Allocate(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        GeometryAllocation allocation;
+        if(vertices.empty() || indices.empty())
+            return allocation;
+
+        if(!vertexAllocator.Allocate(vertices.size(), allocation.baseVertex))
+        {
+            growVertices(vertices.size());
+            vertexAllocator.Allocate(vertices.size(), allocation.baseVertex);
+        }
+        if(!indexAllocator.Allocate(indices.size(), allocation.firstIndex))
+        {
+            growIndices(indices.size());
+            indexAllocator.Allocate(indices.size(), allocation.firstIndex);
+        }
+        allocation.vertexCount = vertices.size();
+        allocation.indexCount = indices.size();
+        allocation.valid = true;
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, (size_t)allocation.baseVertex * sizeof(Vertex), vertices.size() * sizeof(Vertex), &vertices[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(VAO);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (size_t)allocation.firstIndex * sizeof(unsigned int), indices.size() * sizeof(unsigned int), &indices[0]);
+        glBindVertexArray(0);
+        return allocation;
+    }
+
+    void Free(GeometryAllocation &allocation)
+    {
+        if(!allocation.valid)
+            return;
+        vertexAllocator.Free(allocation.baseVertex, allocation.vertexCount);
+        indexAllocator.Free(allocation.firstIndex, allocation.indexCount);
+        allocation = GeometryAllocation();
+    }
+
+    unsigned int VertexBuffer() const { return VBO; }
+    unsigned int VerticesUsed() const { return vertexAllocator.Used(); }
+    unsigned int IndicesUsed() const { return indexAllocator.Used(); }
+
+private:
+    unsigned int VBO, EBO;
+    RangeAllocator vertexAllocator;
+    RangeAllocator indexAllocator;
+
+    // same attribute layout as Mesh::setupMesh, so every shader that draws meshes works with this VAO too
+    void setupVertexAttributes()
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // reallocates a buffer with at least double the size and copies the old contents over on the GPU
+    static void growBuffer(unsigned int &buffer, size_t oldBytes, size_t newBytes)
+    {
+        unsigned int newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newBytes, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = newBuffer;
+    }
+
+    void growVertices(unsigned int needed)
+    {
+        unsigned int oldCapacity = vertexAllocator.Capacity();
+        unsigned int newCapacity = std::max(2 * oldCapacity, oldCapacity + needed);
+        growBuffer(VBO, (size_t)oldCapacity * sizeof(Vertex), (size_t)newCapacity * sizeof(Vertex));
+        vertexAllocator.Grow(newCapacity);
+        // the VAO still points at the deleted buffer
+        setupVertexAttributes();
+        std::cout << "GeometryBuffer: vertex buffer grown to " << newCapacity << " vertices" << std::endl;
+    }
+
+    void growIndices(unsigned int needed)
+    {
+        unsigned int oldCapacity = indexAllocator.Capacity();
+        unsigned int newCapacity = std::max(2 * oldCapacity, oldCapacity + needed);
+        growBuffer(EBO, (size_t)oldCapacity * sizeof(unsigned int), (size_t)newCapacity * sizeof(unsigned int));
+        indexAllocator.Grow(newCapacity);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBindVertexArray(0);
+        std::cout << "GeometryBuffer: index buffer grown to " << newCapacity << " indices" << std::endl;
+    }
+};
+#endif
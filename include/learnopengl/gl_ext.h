@@ -0,0 +1,68 @@
+#ifndef GL_EXT_H
+#define GL_EXT_H
+
+#include <glad/glad.h>
+
+// glad in libs/ is generated for a 3.3 core profile only. The few newer entry points the renderer can use
+// when the driver gives us a 4.3+ context are loaded here by hand, the same way glad does it.
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC_EXT)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC_EXT)(GLbitfield barriers);
+
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT glext_glMultiDrawElementsIndirect = NULL;
+#define glMultiDrawElementsIndirect glext_glMultiDrawElementsIndirect
+PFNGLDISPATCHCOMPUTEPROC_EXT glext_glDispatchCompute = NULL;
+#define glDispatchCompute glext_glDispatchCompute
+PFNGLMEMORYBARRIERPROC_EXT glext_glMemoryBarrier = NULL;
+#define glMemoryBarrier glext_glMemoryBarrier
+
+// layout of one glMultiDrawElementsIndirect command, as defined by the GL spec
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+struct GLExtensions {
+    // GL 4.3: shader storage buffers + glMultiDrawElementsIndirect
+    bool multiDrawIndirect = false;
+    // GL 4.3: compute shaders, for culling on the GPU
+    bool computeShaders = false;
+};
+
+GLExtensions glExtensions;
+
+// must be called after gladLoadGLLoader, with the same loader
+void loadGLExtensions(GLADloadproc load)
+{
+    bool gl43 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3);
+    if(gl43)
+    {
+        glext_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT)load("glMultiDrawElementsIndirect");
+        glext_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC_EXT)load("glDispatchCompute");
+        glext_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC_EXT)load("glMemoryBarrier");
+    }
+    glExtensions.multiDrawIndirect = gl43 && glext_glMultiDrawElementsIndirect != NULL;
+    glExtensions.computeShaders = glExtensions.multiDrawIndirect && glext_glDispatchCompute != NULL && glext_glMemoryBarrier != NULL;
+}
+#endif
@@ -0,0 +1,165 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/compute_shader.h>
+#include <learnopengl/geometry_buffer.h>
+#include <learnopengl/multi_draw.h>
+#include <learnopengl/frustum.h>
+#include <learnopengl/depth_pyramid.h>
+#include <learnopengl/model.h>
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// SSBO bindings of gpu_cull.cs; the visible draws go to DRAW_DATA_BINDING, where model_lighting_mdi.vs reads them
+#define CULL_INSTANCES_BINDING 1
+#define CULL_COMMANDS_BINDING 2
+
+// GPU-driven instances of one model (GL 4.3). The CPU only uploads the instance transforms; a compute shader tests
+// every instance against the frustum (and the Hi-Z pyramid of an earlier frame when there is one), writes the
+// visible ones compacted into a DrawData buffer and counts them into the instanceCount of one indirect command per
+// mesh. Drawing is then a fixed number of glMultiDrawElementsIndirect calls (one per material) whatever the
+// instance count, and nothing is read back. Commands are per mesh, so their number is known on the CPU and
+// glMultiDrawElementsIndirectCount (4.6) isn't needed: a command nobody survived in just has 0 instances.
+class GpuInstanceCuller
+{
+public:
+    static const unsigned int GROUP_SIZE = 64;
+
+    // a run of commands that share a material: one glMultiDrawElementsIndirect
+    struct Bucket {
+        unsigned int materialId;
+        unsigned int firstCommand;
+        unsigned int commandCount;
+    };
+
+    GpuInstanceCuller(GeometryBuffer &geometry, MultiDrawRenderer &renderer, Model &model)
+        : geometry(geometry), renderer(renderer), bounds(model.bounds)
+    {
+        meshes = renderer.ModelMeshes(model);
+        std::stable_sort(meshes.begin(), meshes.end(), [](const MultiDrawRenderer::MeshEntry &a, const MultiDrawRenderer::MeshEntry &b) {
+            return a.materialId < b.materialId;
+        });
+        // every command draws the same compacted instances, so baseInstance is 0 for all of them
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if(!meshes[i].geometry.valid)
+                continue;
+            DrawElementsIndirectCommand command;
+            command.count = meshes[i].geometry.indexCount;
+            command.instanceCount = 0;
+            command.firstIndex = meshes[i].geometry.firstIndex;
+            command.baseVertex = meshes[i].geometry.baseVertex;
+            command.baseInstance = 0;
+            if(buckets.empty() || buckets.back().materialId != meshes[i].materialId)
+                buckets.push_back({meshes[i].materialId, (unsigned int)commands.size(), 0});
+            buckets.back().commandCount++;
+            commandMeshes.push_back(i);
+            commands.push_back(command);
+        }
+
+        glGenBuffers(1, &instanceBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // uploads this frame's transforms; the normal matrices are made on the GPU, only for the visible instances
+    void SetInstances(const vector<glm::mat4> &transforms)
+    {
+        instanceCount = transforms.size();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+        if(instanceCount > capacity)
+        {
+            capacity = std::max(instanceCount, 2 * capacity);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(DrawData), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+            // the draw id attribute of the shared VAO has to reach the last instance
+            renderer.ReserveInstances(capacity);
+        }
+        if(instanceCount > 0)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instanceCount * sizeof(glm::mat4), &transforms[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // resets the instance counts and runs the culling shader; hiZ may be NULL (frustum only)
+    void Cull(ComputeShader &cullShader, const Frustum &frustum, const DepthPyramid *hiZ)
+    {
+        // constant size reset, the counts are then only ever touched by the GPU
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        if(instanceCount == 0)
+            return;
+
+        cullShader.use();
+        cullShader.setInt("instanceCount", instanceCount);
+        cullShader.setInt("commandCount", commands.size());
+        cullShader.setVec4("boundingSphere", glm::vec4(bounds.Center, bounds.Radius));
+        for(unsigned int i = 0; i < 6; i++)
+            cullShader.setVec4("frustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+        bool useHiZ = hiZ && hiZ->Built();
+        cullShader.setBool("useHiZ", useHiZ);
+        if(useHiZ)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, hiZ->texture);
+            cullShader.setInt("depthPyramid", 0);
+            cullShader.setMat4("hiZViewProjection", hiZ->BuiltViewProjection());
+            cullShader.setVec2("hiZSize", glm::vec2(hiZ->Width(), hiZ->Height()));
+            cullShader.setInt("hiZLevels", hiZ->Levels());
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCES_BINDING, instanceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, commandBuffer);
+        cullShader.Dispatch(instanceCount, GROUP_SIZE);
+        // the draws read the compacted instances as vertex shader storage and the counts as indirect commands
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        if(useHiZ)
+            glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // binds the textures of a bucket; the shader has to be in use
+    void BindBucketMaterial(Shader &shader, unsigned int bucket)
+    {
+        meshes[commandMeshes[buckets[bucket].firstCommand]].mesh->BindTextures(shader);
+    }
+
+    // expects the geometry VAO bound and model_lighting_mdi.vs in use, like MultiDrawRenderer::DrawBucket
+    void DrawBucket(unsigned int bucket)
+    {
+        const Bucket &b = buckets[bucket];
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(b.firstCommand * sizeof(DrawElementsIndirectCommand)), b.commandCount, 0);
+    }
+
+    const vector<Bucket> &Buckets() const { return buckets; }
+    unsigned int InstanceCount() const { return instanceCount; }
+    unsigned int VAO() const { return geometry.VAO; }
+
+private:
+    GeometryBuffer &geometry;
+    MultiDrawRenderer &renderer;
+    Bounds bounds;
+    vector<MultiDrawRenderer::MeshEntry> meshes;
+    // command templates with 0 instances, sorted by material; commandMeshes[i] is the mesh of commands[i]
+    vector<DrawElementsIndirectCommand> commands;
+    vector<unsigned int> commandMeshes;
+    vector<Bucket> buckets;
+
+    unsigned int instanceBuffer = 0, drawDataBuffer = 0, commandBuffer = 0;
+    unsigned int instanceCount = 0;
+    unsigned int capacity = 0;
+};
+#endif
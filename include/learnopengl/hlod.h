@@ -0,0 +1,349 @@
+#ifndef HLOD_H
+#define HLOD_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/model.h>
+
+#include <vector>
+#include <map>
+#include <set>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// Hierarchical LOD for the static scenery. Instances are grouped into clusters by the same ground cells the
+// StaticBatcher chunks use, and each cluster is merged and simplified into a single proxy mesh at load time.
+// The proxy has no textures: while simplifying, the diffuse textures are baked into its vertex colors, so one
+// draw covers every material and instance of the cluster. A cluster that covers little of the screen is drawn
+// as its proxy instead of its chunks.
+class HlodBuilder
+{
+public:
+    struct ProxyVertex {
+        glm::vec3 Position;
+        glm::vec3 Normal;
+        glm::vec3 Color;
+    };
+
+    struct Cluster {
+        int cellX, cellZ;
+        unsigned int firstIndex;
+        unsigned int indexCount;
+        unsigned int sourceTriangles;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 center;
+        float radius;
+        bool useProxy;
+    };
+
+    unsigned int VAO = 0;
+
+    // clusterSize has to match the StaticBatcher's chunk size, simplifyCell is the grid the proxy vertices snap to
+    HlodBuilder(float clusterSize = 16.0f, float simplifyCell = 0.3f) : clusterSize(clusterSize), simplifyCell(simplifyCell)
+    {
+    }
+
+    // same instances as StaticBatcher::Add; an instance goes into the cluster its origin is in, whole
+    void Add(Model &model, const vector<glm::mat4> &transforms)
+    {
+        for(unsigned int t = 0; t < transforms.size(); t++)
+        {
+            const glm::mat4 &transform = transforms[t];
+            glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(transform)));
+            Source &source = sourceFor((int)std::floor(transform[3].x / clusterSize), (int)std::floor(transform[3].z / clusterSize));
+            for(unsigned int m = 0; m < model.meshes.size(); m++)
+            {
+                Mesh &mesh = model.meshes[m];
+                const TexturePixels *texture = diffusePixels(mesh);
+                unsigned int base = source.vertices.size();
+                for(unsigned int i = 0; i < mesh.vertices.size(); i++)
+                {
+                    SourceVertex vertex;
+                    vertex.position = glm::vec3(transform * glm::vec4(mesh.vertices[i].Position, 1.0f));
+                    vertex.normal = glm::normalize(normalMatrix * mesh.vertices[i].Normal);
+                    vertex.color = texture ? texture->Sample(mesh.vertices[i].TexCoords) : glm::vec3(0.8f);
+                    source.vertices.push_back(vertex);
+                }
+                for(unsigned int i = 0; i < mesh.indices.size(); i++)
+                    source.indices.push_back(base + mesh.indices[i]);
+            }
+        }
+    }
+
+    // simplifies every cluster, uploads the proxies into one vertex and one index buffer and drops the CPU copies
+    void Build()
+    {
+        vector<ProxyVertex> vertices;
+        vector<unsigned int> indices;
+        clusters.clear();
+        clusterIndex.clear();
+        unsigned int sourceTriangles = 0;
+        for(unsigned int s = 0; s < sources.size(); s++)
+        {
+            Cluster cluster;
+            simplify(sources[s], vertices, indices, cluster);
+            if(cluster.indexCount == 0)
+                continue;
+            sourceTriangles += cluster.sourceTriangles;
+            clusterIndex[make_pair(cluster.cellX, cluster.cellZ)] = clusters.size();
+            clusters.push_back(cluster);
+        }
+        sources.clear();
+        sourceIndex.clear();
+        textures.clear();
+        triangleCount = indices.size() / 3;
+        if(vertices.empty())
+            return;
+
+        if(VAO == 0)
+        {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+        }
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(ProxyVertex), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ProxyVertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ProxyVertex), (void*)offsetof(ProxyVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(ProxyVertex), (void*)offsetof(ProxyVertex, Color));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "HLOD: " << clusters.size() << " clusters, " << sourceTriangles << " triangles simplified to "
+                  << triangleCount << std::endl;
+    }
+
+    // Picks the proxy or the instances for every cluster by its projected size: radius / (distance * tan(fovY / 2))
+    // is the part of half the screen height the cluster covers. Going back to the instances needs a quarter more
+    // than the threshold, so a cluster right at the limit doesn't flip every frame.
+    void Update(const glm::vec3 &viewPos, float fovY, float threshold)
+    {
+        float tanHalfFov = std::tan(0.5f * fovY);
+        for(unsigned int i = 0; i < clusters.size(); i++)
+        {
+            Cluster &cluster = clusters[i];
+            float distance = glm::length(viewPos - cluster.center);
+            if(distance <= cluster.radius)
+            {
+                cluster.useProxy = false;
+                continue;
+            }
+            float size = cluster.radius / (distance * tanHalfFov);
+            cluster.useProxy = size < (cluster.useProxy ? 1.25f * threshold : threshold);
+        }
+    }
+
+    void UseInstances()
+    {
+        for(unsigned int i = 0; i < clusters.size(); i++)
+            clusters[i].useProxy = false;
+    }
+
+    // the cluster of a ground cell (StaticBatcher::Chunk::cellX/cellZ), -1 when nothing was added there
+    int ClusterOfCell(int cellX, int cellZ) const
+    {
+        map<pair<int, int>, unsigned int>::const_iterator it = clusterIndex.find(make_pair(cellX, cellZ));
+        return it == clusterIndex.end() ? -1 : (int)it->second;
+    }
+
+    // the cluster an instance with this origin went into
+    int ClusterAt(const glm::vec3 &position) const
+    {
+        return ClusterOfCell((int)std::floor(position.x / clusterSize), (int)std::floor(position.z / clusterSize));
+    }
+
+    bool UsesProxy(int cluster) const { return cluster >= 0 && clusters[cluster].useProxy; }
+
+    // expects VAO bound
+    void DrawCluster(unsigned int cluster)
+    {
+        const Cluster &c = clusters[cluster];
+        glDrawElements(GL_TRIANGLES, c.indexCount, GL_UNSIGNED_INT, (void*)((size_t)c.firstIndex * sizeof(unsigned int)));
+    }
+
+    const vector<Cluster> &Clusters() const { return clusters; }
+    unsigned int TriangleCount() const { return triangleCount; }
+
+private:
+    struct SourceVertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 color;
+    };
+
+    struct Source {
+        int cellX, cellZ;
+        vector<SourceVertex> vertices;
+        vector<unsigned int> indices;
+    };
+
+    // a CPU copy of a diffuse texture, from one of its smaller mip levels so a sample is already an average
+    struct TexturePixels {
+        int width = 0, height = 0;
+        vector<unsigned char> rgba;
+
+        glm::vec3 Sample(const glm::vec2 &uv) const
+        {
+            int x = (int)((uv.x - std::floor(uv.x)) * width) % width;
+            int y = (int)((uv.y - std::floor(uv.y)) * height) % height;
+            const unsigned char *texel = &rgba[4 * (y * width + x)];
+            return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+        }
+    };
+
+    float clusterSize;
+    float simplifyCell;
+    unsigned int VBO = 0, EBO = 0;
+    vector<Source> sources;
+    map<pair<int, int>, unsigned int> sourceIndex;
+    map<unsigned int, TexturePixels> textures;
+    vector<Cluster> clusters;
+    map<pair<int, int>, unsigned int> clusterIndex;
+    unsigned int triangleCount = 0;
+
+    Source &sourceFor(int cellX, int cellZ)
+    {
+        map<pair<int, int>, unsigned int>::iterator it = sourceIndex.find(make_pair(cellX, cellZ));
+        if(it != sourceIndex.end())
+            return sources[it->second];
+        Source source;
+        source.cellX = cellX;
+        source.cellZ = cellZ;
+        sourceIndex[make_pair(cellX, cellZ)] = sources.size();
+        sources.push_back(source);
+        return sources.back();
+    }
+
+    const TexturePixels *diffusePixels(const Mesh &mesh)
+    {
+        for(unsigned int i = 0; i < mesh.textures.size(); i++)
+        {
+            if(mesh.textures[i].type != "texture_diffuse")
+                continue;
+            unsigned int id = mesh.textures[i].id;
+            map<unsigned int, TexturePixels>::iterator it = textures.find(id);
+            if(it != textures.end())
+                return &it->second;
+
+            TexturePixels &pixels = textures[id];
+            glBindTexture(GL_TEXTURE_2D, id);
+            // the smallest of levels 0-3 that exists
+            for(int level = 3; level >= 0; level--)
+            {
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &pixels.width);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &pixels.height);
+                if(pixels.width > 0 && pixels.height > 0)
+                {
+                    pixels.rgba.resize(4 * pixels.width * pixels.height);
+                    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                    glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, &pixels.rgba[0]);
+                    break;
+                }
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            if(pixels.rgba.empty())
+            {
+                textures.erase(id);
+                return NULL;
+            }
+            return &pixels;
+        }
+        return NULL;
+    }
+
+    // Vertex clustering: vertices snap to a grid of simplifyCell and every grid cell becomes one vertex (the average
+    // of what fell in it). Cells are also split by the dominant axis of the normal, so the two sides of a thin wall
+    // don't collapse into each other. Triangles left with two corners in the same cell disappear, and so do the
+    // ones that became copies of another.
+    void simplify(const Source &source, vector<ProxyVertex> &vertices, vector<unsigned int> &indices, Cluster &cluster)
+    {
+        cluster.cellX = source.cellX;
+        cluster.cellZ = source.cellZ;
+        cluster.firstIndex = indices.size();
+        cluster.indexCount = 0;
+        cluster.sourceTriangles = source.indices.size() / 3;
+        cluster.useProxy = false;
+        cluster.boundsMin = glm::vec3(1e30f);
+        cluster.boundsMax = glm::vec3(-1e30f);
+        for(unsigned int i = 0; i < source.vertices.size(); i++)
+        {
+            cluster.boundsMin = glm::min(cluster.boundsMin, source.vertices[i].position);
+            cluster.boundsMax = glm::max(cluster.boundsMax, source.vertices[i].position);
+        }
+        cluster.center = 0.5f * (cluster.boundsMin + cluster.boundsMax);
+        cluster.radius = glm::length(cluster.boundsMax - cluster.center);
+
+        map<uint64_t, unsigned int> cellVertex;
+        vector<unsigned int> remap(source.vertices.size());
+        vector<ProxyVertex> sums;
+        vector<unsigned int> counts;
+        for(unsigned int i = 0; i < source.vertices.size(); i++)
+        {
+            const SourceVertex &vertex = source.vertices[i];
+            glm::vec3 cell = glm::floor((vertex.position - cluster.boundsMin) / simplifyCell);
+            glm::vec3 n = glm::abs(vertex.normal);
+            unsigned int axis = n.x >= n.y && n.x >= n.z ? 0 : (n.y >= n.z ? 1 : 2);
+            unsigned int side = 2 * axis + (vertex.normal[axis] < 0.0f ? 1 : 0);
+            uint64_t key = ((uint64_t)cell.x << 43) | ((uint64_t)cell.y << 23) | ((uint64_t)cell.z << 3) | side;
+            map<uint64_t, unsigned int>::iterator it = cellVertex.find(key);
+            if(it == cellVertex.end())
+            {
+                it = cellVertex.insert(make_pair(key, (unsigned int)sums.size())).first;
+                ProxyVertex zero;
+                zero.Position = zero.Normal = zero.Color = glm::vec3(0.0f);
+                sums.push_back(zero);
+                counts.push_back(0);
+            }
+            ProxyVertex &sum = sums[it->second];
+            sum.Position += vertex.position;
+            sum.Normal += vertex.normal;
+            sum.Color += vertex.color;
+            counts[it->second]++;
+            remap[i] = it->second;
+        }
+
+        unsigned int base = vertices.size();
+        for(unsigned int i = 0; i < sums.size(); i++)
+        {
+            ProxyVertex vertex;
+            vertex.Position = sums[i].Position / (float)counts[i];
+            vertex.Color = sums[i].Color / (float)counts[i];
+            float length = glm::length(sums[i].Normal);
+            vertex.Normal = length > 0.0f ? sums[i].Normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+            vertices.push_back(vertex);
+        }
+
+        set<uint64_t> kept;
+        for(unsigned int i = 0; i + 2 < source.indices.size(); i += 3)
+        {
+            unsigned int a = remap[source.indices[i]];
+            unsigned int b = remap[source.indices[i + 1]];
+            unsigned int c = remap[source.indices[i + 2]];
+            if(a == b || b == c || a == c)
+                continue;
+            unsigned int sorted[3] = {a, b, c};
+            std::sort(sorted, sorted + 3);
+            uint64_t key = ((uint64_t)sorted[0] << 42) | ((uint64_t)sorted[1] << 21) | sorted[2];
+            if(!kept.insert(key).second)
+                continue;
+            indices.push_back(base + a);
+            indices.push_back(base + b);
+            indices.push_back(base + c);
+        }
+        cluster.indexCount = indices.size() - cluster.firstIndex;
+    }
+};
+#endif
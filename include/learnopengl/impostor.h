@@ -0,0 +1,237 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+#include <learnopengl/model.h>
+#include <learnopengl/geometry_buffer.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// first instance attribute of impostor.vs, same place as the instance data of the models
+#define IMPOSTOR_ATTRIB_LOCATION 5
+
+// Octahedral impostor of a model: at load time the model is rendered from frames x frames directions spread over
+// the upper hemisphere (hemi-octahedral mapping) into one atlas of albedo + alpha and one of normal + depth.
+// Far away instances are then a single camera-facing quad each, drawn instanced, that shows the frame baked closest
+// to the direction they are seen from. The baked normals and depth keep them lit by the scene lights and let them
+// intersect the ground and each other about where the mesh would.
+// Models are baked upright: orientation takes the model from its file's axes to y-up, and instances may only add a
+// rotation about y, a uniform scale and a translation on top of it (the igloos and penguins do exactly that).
+// The bake draws the model out of the shared geometry buffer, its meshes are only in there while it runs.
+class ImpostorAtlas
+{
+public:
+    unsigned int albedoTexture = 0;
+    unsigned int normalDepthTexture = 0;
+    // an instance is fully the mesh up to fadeStart, fully the impostor from fadeEnd, and dithered in between
+    float fadeStart = 30.0f;
+    float fadeEnd = 40.0f;
+
+    ImpostorAtlas(Model &model, GeometryBuffer &geometry, Shader &bakeShader, const glm::mat4 &orientation = glm::mat4(1.0f), unsigned int frames = 8, unsigned int frameSize = 128)
+        : frames(frames), frameSize(frameSize), orientation(orientation), inverseOrientation(glm::inverse(orientation))
+    {
+        // bounding sphere in the upright space the frames are rendered in
+        center = glm::vec3(orientation * glm::vec4(model.bounds.Center, 1.0f));
+        radius = model.bounds.Radius * glm::length(glm::vec3(orientation[0]));
+        bake(model, geometry, bakeShader);
+
+        // one quad, corners in [-1, 1], and the per-instance data behind it
+        float corners[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &quadVBO);
+        glGenBuffers(1, &instanceVBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(IMPOSTOR_ATTRIB_LOCATION);
+        glVertexAttribPointer(IMPOSTOR_ATTRIB_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, positionScale));
+        glVertexAttribDivisor(IMPOSTOR_ATTRIB_LOCATION, 1);
+        glEnableVertexAttribArray(IMPOSTOR_ATTRIB_LOCATION + 1);
+        glVertexAttribPointer(IMPOSTOR_ATTRIB_LOCATION + 1, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, yawFade));
+        glVertexAttribDivisor(IMPOSTOR_ATTRIB_LOCATION + 1, 1);
+        glBindVertexArray(0);
+    }
+
+    ~ImpostorAtlas()
+    {
+        glDeleteTextures(1, &albedoTexture);
+        glDeleteTextures(1, &normalDepthTexture);
+        glDeleteBuffers(1, &quadVBO);
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    // how much of an instance at this distance is impostor: 0 draws only the mesh, 1 only the impostor
+    float Weight(float distance) const
+    {
+        if(fadeEnd <= fadeStart)
+            return distance >= fadeEnd ? 1.0f : 0.0f;
+        return std::min(std::max((distance - fadeStart) / (fadeEnd - fadeStart), 0.0f), 1.0f);
+    }
+
+    void Clear() { instances.clear(); }
+
+    // transform is the same one the mesh would be drawn with
+    void Add(const glm::mat4 &transform, float weight)
+    {
+        glm::mat4 upright = transform * inverseOrientation;
+        Instance instance;
+        instance.positionScale = glm::vec4(glm::vec3(upright[3]), glm::length(glm::vec3(upright[0])));
+        instance.yawFade = glm::vec2(std::atan2(upright[2][0], upright[0][0]), weight);
+        instances.push_back(instance);
+    }
+
+    // binds the atlases and the per-model uniforms; the shader has to be in use
+    void BindMaterial(Shader &shader)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, albedoTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, normalDepthTexture);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("albedoAtlas", 0);
+        shader.setInt("normalDepthAtlas", 1);
+        shader.setInt("frames", frames);
+        shader.setVec3("boundsCenter", center);
+        shader.setFloat("boundsRadius", radius);
+    }
+
+    // one instanced draw of every quad added since Clear, expects VAO bound
+    void Draw()
+    {
+        if(instances.empty())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // orphaned every frame, the instance count is small and changes as the camera moves
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), &instances[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
+    }
+
+    unsigned int InstanceCount() const { return instances.size(); }
+    unsigned int GetVAO() const { return VAO; }
+
+private:
+    struct Instance {
+        glm::vec4 positionScale;
+        glm::vec2 yawFade;
+    };
+
+    unsigned int frames, frameSize;
+    glm::mat4 orientation, inverseOrientation;
+    glm::vec3 center;
+    float radius;
+    vector<Instance> instances;
+    unsigned int VAO = 0, quadVBO = 0, instanceVBO = 0;
+
+    // direction (upright space, y >= 0) a frame was rendered from; the inverse of the mapping in impostor.vs
+    glm::vec3 frameDirection(unsigned int x, unsigned int y) const
+    {
+        glm::vec2 e = glm::vec2((x + 0.5f) / frames, (y + 0.5f) / frames) * 2.0f - 1.0f;
+        glm::vec2 p = glm::vec2(e.x + e.y, e.x - e.y) * 0.5f;
+        return glm::normalize(glm::vec3(p.x, 1.0f - std::fabs(p.x) - std::fabs(p.y), p.y));
+    }
+
+    void bake(Model &model, GeometryBuffer &geometry, Shader &bakeShader)
+    {
+        unsigned int size = frames * frameSize;
+        glGenTextures(1, &albedoTexture);
+        glBindTexture(GL_TEXTURE_2D, albedoTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glGenTextures(1, &normalDepthTexture);
+        glBindTexture(GL_TEXTURE_2D, normalDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, NULL);
+        unsigned int depthBuffer;
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+
+        GLint previousFBO, previousViewport[4];
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        unsigned int FBO;
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepthTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        unsigned int attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, attachments);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Impostor framebuffer not complete!" << std::endl;
+
+        // alpha 0 marks the texels the model doesn't cover
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);
+
+        vector<GeometryAllocation> allocations;
+        for(Mesh &mesh : model.meshes)
+            allocations.push_back(geometry.Allocate(mesh.vertices, mesh.indices));
+
+        bakeShader.use();
+        bakeShader.setMat4("model", orientation);
+        bakeShader.setVec3("bakeCenter", center);
+        bakeShader.setFloat("bakeRadius", radius);
+        // orthographic, the quad drawn at runtime is flat too
+        bakeShader.setMat4("projection", glm::ortho(-radius, radius, -radius, radius, 0.5f * radius, 3.5f * radius));
+        for(unsigned int y = 0; y < frames; y++)
+        {
+            for(unsigned int x = 0; x < frames; x++)
+            {
+                glm::vec3 direction = frameDirection(x, y);
+                // frame centers never hit the pole, so world up always works (impostor.vs builds the same basis)
+                glm::mat4 view = glm::lookAt(center + 2.0f * radius * direction, center, glm::vec3(0.0f, 1.0f, 0.0f));
+                bakeShader.setMat4("view", view);
+                bakeShader.setVec3("bakeDirection", direction);
+                glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+                glBindVertexArray(geometry.VAO);
+                for(unsigned int i = 0; i < model.meshes.size(); i++)
+                {
+                    if(!allocations[i].valid)
+                        continue;
+                    model.meshes[i].BindTextures(bakeShader);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, allocations[i].indexCount, GL_UNSIGNED_INT,
+                                             (void*)((size_t)allocations[i].firstIndex * sizeof(unsigned int)), allocations[i].baseVertex);
+                }
+                glBindVertexArray(0);
+                glActiveTexture(GL_TEXTURE0);
+            }
+        }
+        for(GeometryAllocation &allocation : allocations)
+            geometry.Free(allocation);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &depthBuffer);
+
+        // mipmaps bleed a little across frame borders, but those are transparent anyway
+        unsigned int textures[2] = {albedoTexture, normalDepthTexture};
+        for(unsigned int i = 0; i < 2; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+#endif
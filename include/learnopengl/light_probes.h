@@ -0,0 +1,192 @@
+#ifndef LIGHT_PROBES_H
+#define LIGHT_PROBES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <learnopengl/clustered_lights.h>
+#include <learnopengl/lightmap.h>
+#include <learnopengl/spherical_harmonics.h>
+#include <learnopengl/bake_cache.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// texture unit of the probe grid, after the cluster buffers
+#define LIGHT_PROBE_UNIT 11
+
+// Irradiance probes on a regular 3D grid, for what moves through the static lighting (the penguins): each probe
+// holds the baked lights' irradiance at its position as L2 spherical harmonics, so a fragment gets them for any
+// normal from 9 fetches of the trilinearly filtered grid instead of a loop over the lights. Probes see the lights
+// the same way the lightmap bake does (no shadowing, diffuse only).
+// The grid is one RGB16F 3D texture: coefficient i of every probe is the i-th slab of layers along y, so filtering
+// stays within a slab as long as the shader clamps y to the slab's texel centers (ShIrradiance in the lit shaders).
+// Bakes are cached on disk like the lightmaps.
+class LightProbeGrid
+{
+public:
+    unsigned int texture = 0;
+
+    LightProbeGrid(const glm::vec3 &min, const glm::vec3 &max, float spacing)
+        : min(min), spacing(spacing)
+    {
+        count.x = std::max(1, (int)std::ceil((max.x - min.x) / spacing) + 1);
+        count.y = std::max(1, (int)std::ceil((max.y - min.y) / spacing) + 1);
+        count.z = std::max(1, (int)std::ceil((max.z - min.z) / spacing) + 1);
+    }
+
+    ~LightProbeGrid()
+    {
+        glDeleteTextures(1, &texture);
+    }
+
+    // identifies what a bake was made from: the grid and the lights
+    uint64_t Signature(const vector<ClusteredLights::Light> &lights) const
+    {
+        uint64_t hash = BAKE_SIGNATURE_SEED;
+        hash = BakeSignature(hash, &min, sizeof(min));
+        hash = BakeSignature(hash, &spacing, sizeof(spacing));
+        hash = BakeSignature(hash, &count, sizeof(count));
+        if(!lights.empty())
+            hash = BakeSignature(hash, &lights[0], lights.size() * sizeof(ClusteredLights::Light));
+        return hash;
+    }
+
+    // bakes every probe, a z row at a time per thread; Upload creates the grid from it
+    void Bake(const vector<ClusteredLights::Light> &lights, unsigned int threadCount = 0)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if(threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        // texel (x, i * count.y + y, z) is coefficient i of probe (x, y, z)
+        texels.assign(count.x * SH_COEFFICIENTS * count.y * count.z, glm::vec3(0.0f));
+        std::atomic<int> nextRow(0);
+        vector<std::thread> workers;
+        for(unsigned int t = 0; t < threadCount; t++)
+        {
+            workers.push_back(std::thread([&]() {
+                for(int z = nextRow++; z < count.z; z = nextRow++)
+                {
+                    for(int y = 0; y < count.y; y++)
+                    {
+                        for(int x = 0; x < count.x; x++)
+                        {
+                            SphericalHarmonics sh = Probe(min + glm::vec3(x, y, z) * spacing, lights);
+                            for(int i = 0; i < SH_COEFFICIENTS; i++)
+                                texels[(z * SH_COEFFICIENTS * count.y + i * count.y + y) * count.x + x] = sh.c[i];
+                        }
+                    }
+                }
+            }));
+        }
+        for(unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+        bakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    bool Load(const string &path, uint64_t signature)
+    {
+        std::ifstream in;
+        if(!OpenBakeCache(in, path, "PRB1", signature))
+            return false;
+        texels.resize(count.x * SH_COEFFICIENTS * count.y * count.z);
+        in.read((char*)&texels[0], texels.size() * sizeof(glm::vec3));
+        if(!in)
+        {
+            texels.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void Save(const string &path, uint64_t signature) const
+    {
+        std::ofstream out;
+        if(!CreateBakeCache(out, path, "PRB1", signature))
+            return;
+        out.write((const char*)&texels[0], texels.size() * sizeof(glm::vec3));
+    }
+
+    // creates the grid from a bake or a load, the CPU copy is dropped afterwards
+    void Upload()
+    {
+        if(texture == 0)
+            glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, count.x, SH_COEFFICIENTS * count.y, count.z, 0, GL_RGB, GL_FLOAT, &texels[0]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // outside the grid the border probes hold, which are beyond the lights' range anyway
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        texels.clear();
+    }
+
+    // the irradiance of the lights at one point, each one as light from its direction
+    static SphericalHarmonics Probe(const glm::vec3 &position, const vector<ClusteredLights::Light> &lights)
+    {
+        SphericalHarmonics sh;
+        for(unsigned int l = 0; l < lights.size(); l++)
+        {
+            const ClusteredLights::Light &light = lights[l];
+            float distance = glm::length(light.position - position);
+            float attenuation = Lightmap::Attenuation(light, distance);
+            if(attenuation <= 0.0f)
+                continue;
+            sh.AddDirectional((light.position - position) / distance, attenuation * light.diffuse);
+        }
+        return sh;
+    }
+
+    // the box around the lights' ranges, clamped to the heights things move at
+    static void LightBounds(const vector<ClusteredLights::Light> &lights, float minY, float maxY, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+    {
+        boundsMin = glm::vec3(1e30f);
+        boundsMax = glm::vec3(-1e30f);
+        for(unsigned int l = 0; l < lights.size(); l++)
+        {
+            float range = lights[l].range > 0.0f ? lights[l].range : ClusteredLights::Range(lights[l]);
+            boundsMin = glm::min(boundsMin, lights[l].position - glm::vec3(range));
+            boundsMax = glm::max(boundsMax, lights[l].position + glm::vec3(range));
+        }
+        boundsMin.y = minY;
+        boundsMax.y = maxY;
+    }
+
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE0 + LIGHT_PROBE_UNIT);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the shader has to be in use
+    void SetUniforms(Shader &shader) const
+    {
+        shader.setInt("lightProbes", LIGHT_PROBE_UNIT);
+        shader.setVec3("lightProbeMin", min);
+        shader.setFloat("lightProbeSpacing", spacing);
+        glUniform3i(glGetUniformLocation(shader.ID, "lightProbeCount"), count.x, count.y, count.z);
+    }
+
+    unsigned int ProbeCount() const { return count.x * count.y * count.z; }
+    float BakeMilliseconds() const { return bakeMs; }
+
+private:
+    glm::vec3 min;
+    float spacing;
+    glm::ivec3 count;
+    vector<glm::vec3> texels;
+    float bakeMs = 0.0f;
+};
+#endif
@@ -0,0 +1,382 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/clustered_lights.h>
+#include <learnopengl/bake_cache.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// vertex attribute of the lightmap coordinates in the static batches, after the draw id of multi_draw.h
+#define LIGHTMAP_ATTRIB_LOCATION 13
+// texture units of the static geometry's lightmap and the ground's
+#define LIGHTMAP_UNIT 6
+#define GROUND_LIGHTMAP_UNIT 7
+
+// HDR lightmap of static lights on static surfaces. Every surface (one mesh of one instance) gets its own square tile
+// of the map and is laid out in it by its own texture coordinates, used as the lightmap UV set: the models here
+// keep their UVs in [0, 1] without overlaps, so no unwrapping is needed. Tiles are sized by world area and packed in
+// rows as they are added. The bake rasterizes each surface's triangles into its tile to find the point every texel
+// stands for, then adds up the diffuse irradiance of the lights there on all cores, the way the lit shaders would
+// (same attenuation and range fade, no specular since that depends on the view). The shaders multiply it by the
+// albedo and skip those lights in their loops.
+// Bakes are cached on disk like the PVS: only baked again when the surfaces or the lights change.
+class Lightmap
+{
+public:
+    unsigned int texture = 0;
+
+    Lightmap(unsigned int width, unsigned int height, float texelsPerUnit = 16.0f, unsigned int minTile = 16, unsigned int maxTile = 256)
+        : width(width), height(height), texelsPerUnit(texelsPerUnit), minTile(minTile), maxTile(maxTile)
+    {
+    }
+
+    ~Lightmap()
+    {
+        glDeleteTextures(1, &texture);
+    }
+
+    // world-space triangles of one surface; returns its vertices' coordinates in the lightmap, (0, 0) when the map
+    // is full (the surface then reads an unlit corner, which is reported)
+    vector<glm::vec2> AddSurface(const vector<glm::vec3> &positions, const vector<glm::vec3> &normals, const vector<glm::vec2> &texCoords,
+                                 const vector<unsigned int> &indices)
+    {
+        Surface surface;
+        surface.positions = positions;
+        surface.normals = normals;
+        surface.texCoords = texCoords;
+        surface.indices = indices;
+
+        // as many texels per uv unit as it takes for texelsPerUnit on the surface
+        float worldArea = 0.0f, uvArea = 0.0f;
+        for(unsigned int i = 0; i + 2 < indices.size(); i += 3)
+        {
+            worldArea += 0.5f * glm::length(glm::cross(positions[indices[i + 1]] - positions[indices[i]], positions[indices[i + 2]] - positions[indices[i]]));
+            glm::vec2 a = texCoords[indices[i + 1]] - texCoords[indices[i]];
+            glm::vec2 b = texCoords[indices[i + 2]] - texCoords[indices[i]];
+            uvArea += 0.5f * std::fabs(a.x * b.y - a.y * b.x);
+        }
+        float wanted = uvArea > 0.0f ? std::sqrt(worldArea / uvArea) * texelsPerUnit : (float)minTile;
+        surface.size = minTile;
+        while(surface.size < wanted && surface.size < maxTile && surface.size < std::min(width, height))
+            surface.size *= 2;
+
+        // rows of tiles, a new row starts when the current one is full
+        if(rowX + surface.size > width)
+        {
+            rowX = 0;
+            rowY += rowHeight;
+            rowHeight = 0;
+        }
+        vector<glm::vec2> lightmapCoords(positions.size(), glm::vec2(0.0f));
+        if(rowY + surface.size > height)
+        {
+            std::cout << "Lightmap: no room left for a " << surface.size << "x" << surface.size << " tile" << std::endl;
+            return lightmapCoords;
+        }
+        surface.x = rowX;
+        surface.y = rowY;
+        rowX += surface.size;
+        rowHeight = std::max(rowHeight, surface.size);
+        for(unsigned int i = 0; i < positions.size(); i++)
+            lightmapCoords[i] = toLightmap(surface, texCoords[i]);
+        surfaces.push_back(surface);
+        return lightmapCoords;
+    }
+
+    // normal the surface is shaded with at a texture coordinate, given the interpolated geometric one
+    // (for normal mapped surfaces)
+    typedef std::function<glm::vec3(const glm::vec2 &texCoords, const glm::vec3 &normal)> ShadingNormal;
+
+    // identifies what a bake was made from: the map's layout, every surface added so far and the lights. A shading
+    // normal is not part of it, feed what it reads to BakeSignature on top
+    uint64_t Signature(const vector<ClusteredLights::Light> &lights) const
+    {
+        uint64_t hash = BAKE_SIGNATURE_SEED;
+        unsigned int parameters[2] = {width, height};
+        hash = BakeSignature(hash, parameters, sizeof(parameters));
+        for(const Surface &surface : surfaces)
+        {
+            unsigned int tile[3] = {surface.x, surface.y, surface.size};
+            hash = BakeSignature(hash, tile, sizeof(tile));
+            hash = BakeSignature(hash, &surface.positions[0], surface.positions.size() * sizeof(glm::vec3));
+            hash = BakeSignature(hash, &surface.normals[0], surface.normals.size() * sizeof(glm::vec3));
+            hash = BakeSignature(hash, &surface.texCoords[0], surface.texCoords.size() * sizeof(glm::vec2));
+            hash = BakeSignature(hash, &surface.indices[0], surface.indices.size() * sizeof(unsigned int));
+        }
+        if(!lights.empty())
+            hash = BakeSignature(hash, &lights[0], lights.size() * sizeof(ClusteredLights::Light));
+        return hash;
+    }
+
+    // bakes the lights into every surface added so far; Upload creates the map from it
+    void Bake(const vector<ClusteredLights::Light> &lights, unsigned int threadCount = 0, const ShadingNormal &shadingNormal = ShadingNormal())
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if(threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        texels.assign(width * height, Texel());
+
+        // which surface point each texel stands for: one surface at a time per thread (tiles don't overlap)
+        std::atomic<unsigned int> nextSurface(0);
+        runThreads(threadCount, [&]() {
+            for(unsigned int s = nextSurface++; s < surfaces.size(); s = nextSurface++)
+                rasterize(surfaces[s]);
+        });
+
+        // the irradiance, a row at a time per thread
+        irradiance.assign(width * height, glm::vec3(0.0f));
+        std::atomic<unsigned int> nextRow(0);
+        runThreads(threadCount, [&]() {
+            for(unsigned int y = nextRow++; y < height; y = nextRow++)
+            {
+                for(unsigned int x = 0; x < width; x++)
+                {
+                    Texel &texel = texels[y * width + x];
+                    if(!texel.covered)
+                        continue;
+                    glm::vec3 normal = shadingNormal ? shadingNormal(texel.texCoords, texel.normal) : texel.normal;
+                    irradiance[y * width + x] = Irradiance(texel.position, normal, lights);
+                }
+            }
+        });
+
+        // texels around the triangles get their neighbors' value, so bilinear filtering at the edges doesn't
+        // pull in the unlit background; one ring is all it reaches, more would bleed into the next tile's border
+        dilate(1);
+        coveredTexels = 0;
+        for(unsigned int i = 0; i < texels.size(); i++)
+            coveredTexels += texels[i].covered;
+        texels.clear();
+        bakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    bool Load(const string &path, uint64_t signature)
+    {
+        std::ifstream in;
+        if(!OpenBakeCache(in, path, "LMP1", signature))
+            return false;
+        irradiance.resize(width * height);
+        in.read((char*)&coveredTexels, sizeof(coveredTexels));
+        in.read((char*)&irradiance[0], irradiance.size() * sizeof(glm::vec3));
+        if(!in)
+        {
+            irradiance.clear();
+            coveredTexels = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void Save(const string &path, uint64_t signature) const
+    {
+        std::ofstream out;
+        if(!CreateBakeCache(out, path, "LMP1", signature))
+            return;
+        out.write((const char*)&coveredTexels, sizeof(coveredTexels));
+        out.write((const char*)&irradiance[0], irradiance.size() * sizeof(glm::vec3));
+    }
+
+    // creates the map from a bake or a load (RGB16F, bilinear, no mipmaps since they would bleed across tiles),
+    // the CPU copy is dropped afterwards
+    void Upload()
+    {
+        if(texture == 0)
+            glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, &irradiance[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        irradiance.clear();
+    }
+
+    void Bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // what the lit shaders add up for these lights, without the specular part (and without ambient, that comes
+    // from the sky once per fragment)
+    static glm::vec3 Irradiance(const glm::vec3 &position, const glm::vec3 &normal, const vector<ClusteredLights::Light> &lights)
+    {
+        glm::vec3 sum(0.0f);
+        for(unsigned int l = 0; l < lights.size(); l++)
+        {
+            const ClusteredLights::Light &light = lights[l];
+            float distance = glm::length(light.position - position);
+            float attenuation = Attenuation(light, distance);
+            if(attenuation <= 0.0f)
+                continue;
+            glm::vec3 lightDir = (light.position - position) / distance;
+            sum += attenuation * light.diffuse * std::max(glm::dot(normal, lightDir), 0.0f);
+        }
+        return sum;
+    }
+
+    // the shaders' attenuation with the fade towards the light's range, 0 at and beyond it
+    static float Attenuation(const ClusteredLights::Light &light, float distance)
+    {
+        float range = light.range > 0.0f ? light.range : ClusteredLights::Range(light);
+        if(distance >= range || distance == 0.0f)
+            return 0.0f;
+        float d2 = distance * distance;
+        float fade = 1.0f - std::pow(distance / range, 4.0f);
+        return fade * fade / (light.constant + light.linear * d2 + light.quadratic * d2 * d2);
+    }
+
+    // (scale, offset) taking a surface's texture coordinates into its tile, for surfaces whose shader has no
+    // lightmap coordinates of their own; surfaces are numbered in the order they were added
+    glm::vec4 TileTransform(unsigned int surface) const
+    {
+        const Surface &s = surfaces[surface];
+        glm::vec2 scale = glm::vec2((float)(s.size - 2)) / glm::vec2(width, height);
+        glm::vec2 offset = (glm::vec2(s.x, s.y) + 1.0f) / glm::vec2(width, height);
+        return glm::vec4(scale.x, scale.y, offset.x, offset.y);
+    }
+
+    unsigned int SurfaceCount() const { return surfaces.size(); }
+    unsigned int CoveredTexels() const { return coveredTexels; }
+    unsigned int Width() const { return width; }
+    unsigned int Height() const { return height; }
+    float BakeMilliseconds() const { return bakeMs; }
+
+private:
+    struct Surface {
+        vector<glm::vec3> positions;
+        vector<glm::vec3> normals;
+        vector<glm::vec2> texCoords;
+        vector<unsigned int> indices;
+        unsigned int x = 0, y = 0, size = 0;
+    };
+
+    struct Texel {
+        bool covered = false;
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 texCoords;
+    };
+
+    unsigned int width, height;
+    float texelsPerUnit;
+    unsigned int minTile, maxTile;
+    unsigned int rowX = 0, rowY = 0, rowHeight = 0;
+    vector<Surface> surfaces;
+    vector<Texel> texels;
+    vector<glm::vec3> irradiance;
+    unsigned int coveredTexels = 0;
+    float bakeMs = 0.0f;
+
+    // a texel's width inside the tile stays free on every side, bilinear samples near the border then stay in it
+    glm::vec2 toLightmap(const Surface &surface, const glm::vec2 &texCoords) const
+    {
+        glm::vec2 uv = glm::clamp(texCoords, glm::vec2(0.0f), glm::vec2(1.0f));
+        glm::vec2 texel = glm::vec2(surface.x, surface.y) + 1.0f + uv * (float)(surface.size - 2);
+        return texel / glm::vec2(width, height);
+    }
+
+    template<typename Function>
+    static void runThreads(unsigned int threadCount, Function work)
+    {
+        vector<std::thread> workers;
+        for(unsigned int t = 0; t < threadCount; t++)
+            workers.push_back(std::thread(work));
+        for(unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+    // every texel whose center is inside a triangle (in lightmap texels) gets the interpolated point
+    void rasterize(const Surface &surface)
+    {
+        glm::vec2 scale(width, height);
+        for(unsigned int i = 0; i + 2 < surface.indices.size(); i += 3)
+        {
+            unsigned int i0 = surface.indices[i], i1 = surface.indices[i + 1], i2 = surface.indices[i + 2];
+            glm::vec2 a = toLightmap(surface, surface.texCoords[i0]) * scale;
+            glm::vec2 b = toLightmap(surface, surface.texCoords[i1]) * scale;
+            glm::vec2 c = toLightmap(surface, surface.texCoords[i2]) * scale;
+            float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+            if(std::fabs(area) < 1e-8f)
+                continue;
+            int minX = std::max((int)std::floor(std::min(a.x, std::min(b.x, c.x))), 0);
+            int minY = std::max((int)std::floor(std::min(a.y, std::min(b.y, c.y))), 0);
+            int maxX = std::min((int)std::ceil(std::max(a.x, std::max(b.x, c.x))), (int)width - 1);
+            int maxY = std::min((int)std::ceil(std::max(a.y, std::max(b.y, c.y))), (int)height - 1);
+            for(int y = minY; y <= maxY; y++)
+            {
+                for(int x = minX; x <= maxX; x++)
+                {
+                    glm::vec2 p(x + 0.5f, y + 0.5f);
+                    float w0 = ((b.x - p.x) * (c.y - p.y) - (c.x - p.x) * (b.y - p.y)) / area;
+                    float w1 = ((c.x - p.x) * (a.y - p.y) - (a.x - p.x) * (c.y - p.y)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if(w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+                    Texel &texel = texels[y * width + x];
+                    texel.covered = true;
+                    texel.position = w0 * surface.positions[i0] + w1 * surface.positions[i1] + w2 * surface.positions[i2];
+                    texel.normal = glm::normalize(w0 * surface.normals[i0] + w1 * surface.normals[i1] + w2 * surface.normals[i2]);
+                    texel.texCoords = w0 * surface.texCoords[i0] + w1 * surface.texCoords[i1] + w2 * surface.texCoords[i2];
+                }
+            }
+        }
+    }
+
+    // uncovered texels take the average of their covered neighbors, passes times
+    void dilate(unsigned int passes)
+    {
+        for(unsigned int pass = 0; pass < passes; pass++)
+        {
+            vector<unsigned int> filled;
+            vector<glm::vec3> values;
+            for(int y = 0; y < (int)height; y++)
+            {
+                for(int x = 0; x < (int)width; x++)
+                {
+                    if(texels[y * width + x].covered)
+                        continue;
+                    glm::vec3 sum(0.0f);
+                    unsigned int count = 0;
+                    for(int dy = -1; dy <= 1; dy++)
+                    {
+                        for(int dx = -1; dx <= 1; dx++)
+                        {
+                            int nx = x + dx, ny = y + dy;
+                            if(nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height || !texels[ny * width + nx].covered)
+                                continue;
+                            sum += irradiance[ny * width + nx];
+                            count++;
+                        }
+                    }
+                    if(count > 0)
+                    {
+                        filled.push_back(y * width + x);
+                        values.push_back(sum / (float)count);
+                    }
+                }
+            }
+            for(unsigned int i = 0; i < filled.size(); i++)
+            {
+                irradiance[filled[i]] = values[i];
+                texels[filled[i]].covered = true;
+            }
+        }
+    }
+};
+#endif
@@ -10,6 +10,9 @@
 
 #include <string>
 #include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
 using namespace std;
 
 struct Vertex {
@@ -25,6 +28,37 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// axis aligned box and bounding sphere of a mesh or model, in its local space
+struct Bounds {
+    glm::vec3 Min = glm::vec3(0.0f);
+    glm::vec3 Max = glm::vec3(0.0f);
+    glm::vec3 Center = glm::vec3(0.0f);
+    float Radius = 0.0f;
+};
+
+// first attribute location of the per-instance transforms (after the 5 per-vertex attributes), see DrawData in multi_draw.h
+#define INSTANCE_ATTRIB_LOCATION 5
+
+// a cluster of at most MESHLET_MAX_TRIANGLES triangles, stored as a contiguous range of Mesh::indices, with a bounding
+// sphere and a cone holding all of its face normals so it can be culled on its own (local space, like Bounds)
+struct Meshlet {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    // sine of the angle between the axis and the farthest normal; 1 when the normals spread too far to ever cull
+    float coneCutoff;
+};
+
+#define MESHLET_MAX_TRIANGLES 64
+
+// the whole cluster faces away from a camera at cameraPos (everything in the same space)
+inline bool MeshletBackFacing(const Meshlet &meshlet, const glm::vec3 &center, float radius, const glm::vec3 &coneAxis, const glm::vec3 &cameraPos)
+{
+    glm::vec3 toCluster = center - cameraPos;
+    return glm::dot(toCluster, coneAxis) >= meshlet.coneCutoff * glm::length(toCluster) + radius;
+}
 
 
 struct Texture {
@@ -40,8 +74,11 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
 
-    unsigned int VAO;
+    // only created by the first Draw: meshes drawn out of a GeometryBuffer or a static batch never upload their own copy
+    unsigned int VAO = 0;
     std::string glslIdentifierPrefix;
+    Bounds bounds;
+    vector<Meshlet> meshlets;
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
@@ -49,18 +86,34 @@ public:
         this->indices = indices;
         this->textures = textures;
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        computeBounds();
+        buildMeshlets();
     }
 
     // render the mesh
     void Draw(Shader &shader)
     {
-        // bind appropriate textures
+        BindTextures(shader);
+
+        // draw mesh
+        if(VAO == 0)
+            setupMesh();
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // bind appropriate textures
+    void BindTextures(Shader &shader)
+    {
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        unsigned int metallicRoughnessNr = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
             glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
@@ -75,27 +128,132 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
+            else if(name == "texture_metallicRoughness")
+                number = std::to_string(metallicRoughnessNr++);
 
             // now set the sampler to the correct texture unit
             glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
+        // the lit shaders shade a mesh with this map physically based, the others with Phong
+        shader.setBool(glslIdentifierPrefix + "hasMetallicRoughness", metallicRoughnessNr > 1);
+    }
 
+private:
+    // render data
+    unsigned int VBO = 0, EBO = 0;
 
+    // box around all vertices; the sphere is centered in the box, with the radius of the farthest vertex
+    void computeBounds()
+    {
+        if(vertices.empty())
+            return;
+        bounds.Min = bounds.Max = vertices[0].Position;
+        for(unsigned int i = 1; i < vertices.size(); i++)
+        {
+            bounds.Min = glm::min(bounds.Min, vertices[i].Position);
+            bounds.Max = glm::max(bounds.Max, vertices[i].Position);
+        }
+        bounds.Center = 0.5f * (bounds.Min + bounds.Max);
+        float radius2 = 0.0f;
+        for(unsigned int i = 0; i < vertices.size(); i++)
+        {
+            glm::vec3 d = vertices[i].Position - bounds.Center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        bounds.Radius = std::sqrt(radius2);
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    // Splits the triangles into meshlets, reordering the indices so every meshlet is one contiguous range (the mesh
+    // itself draws the same). Triangles are grouped by the axis their face normal points along the most, then
+    // ordered along a Morton curve of their centroids: consecutive triangles are close and face about the same way,
+    // which keeps both the spheres and the normal cones of the meshlets tight.
+    void buildMeshlets()
+    {
+        unsigned int triangleCount = indices.size() / 3;
+        if(triangleCount == 0)
+            return;
+        glm::vec3 extent = glm::max(bounds.Max - bounds.Min, glm::vec3(1e-6f));
+        vector<pair<uint64_t, unsigned int> > order(triangleCount);
+        vector<glm::vec3> faceNormals(triangleCount);
+        for(unsigned int t = 0; t < triangleCount; t++)
+        {
+            const glm::vec3 &a = vertices[indices[3 * t]].Position;
+            const glm::vec3 &b = vertices[indices[3 * t + 1]].Position;
+            const glm::vec3 &c = vertices[indices[3 * t + 2]].Position;
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+            faceNormals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
-    }
+            glm::vec3 n = glm::abs(faceNormals[t]);
+            unsigned int axis = n.x >= n.y && n.x >= n.z ? 0 : (n.y >= n.z ? 1 : 2);
+            unsigned int direction = 2 * axis + (faceNormals[t][axis] < 0.0f ? 1 : 0);
+            glm::vec3 cell = ((a + b + c) / 3.0f - bounds.Min) / extent * 1023.0f;
+            uint64_t morton = 0;
+            for(unsigned int bit = 0; bit < 10; bit++)
+            {
+                morton |= (uint64_t)(((unsigned int)cell.x >> bit) & 1) << (3 * bit);
+                morton |= (uint64_t)(((unsigned int)cell.y >> bit) & 1) << (3 * bit + 1);
+                morton |= (uint64_t)(((unsigned int)cell.z >> bit) & 1) << (3 * bit + 2);
+            }
+            order[t] = make_pair(((uint64_t)direction << 32) | morton, t);
+        }
+        std::sort(order.begin(), order.end());
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+        vector<unsigned int> sorted(indices.size());
+        meshlets.clear();
+        for(unsigned int i = 0; i < triangleCount; i++)
+        {
+            unsigned int t = order[i].second;
+            for(unsigned int k = 0; k < 3; k++)
+                sorted[3 * i + k] = indices[3 * t + k];
+            // a new meshlet when the current one is full or the triangles start facing another way
+            if(meshlets.empty() || meshlets.back().indexCount == 3 * MESHLET_MAX_TRIANGLES || (order[i].first >> 32) != (order[i - 1].first >> 32))
+            {
+                Meshlet meshlet;
+                meshlet.firstIndex = 3 * i;
+                meshlet.indexCount = 0;
+                meshlets.push_back(meshlet);
+            }
+            meshlets.back().indexCount += 3;
+        }
+        indices.swap(sorted);
+
+        for(unsigned int m = 0; m < meshlets.size(); m++)
+        {
+            Meshlet &meshlet = meshlets[m];
+            glm::vec3 boxMin(1e30f), boxMax(-1e30f), normalSum(0.0f);
+            for(unsigned int i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++)
+            {
+                boxMin = glm::min(boxMin, vertices[indices[i]].Position);
+                boxMax = glm::max(boxMax, vertices[indices[i]].Position);
+            }
+            for(unsigned int i = meshlet.firstIndex / 3; i < (meshlet.firstIndex + meshlet.indexCount) / 3; i++)
+                normalSum += faceNormals[order[i].second];
+            meshlet.center = 0.5f * (boxMin + boxMax);
+            float radius2 = 0.0f;
+            for(unsigned int i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++)
+            {
+                glm::vec3 d = vertices[indices[i]].Position - meshlet.center;
+                radius2 = std::max(radius2, glm::dot(d, d));
+            }
+            meshlet.radius = std::sqrt(radius2);
+
+            // the cone: average normal as the axis, opened up to the normal farthest from it
+            float sumLength = glm::length(normalSum);
+            meshlet.coneAxis = sumLength > 0.0f ? normalSum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+            float minDot = 1.0f;
+            for(unsigned int i = meshlet.firstIndex / 3; i < (meshlet.firstIndex + meshlet.indexCount) / 3; i++)
+            {
+                const glm::vec3 &normal = faceNormals[order[i].second];
+                if(normal != glm::vec3(0.0f))
+                    minDot = std::min(minDot, glm::dot(meshlet.coneAxis, normal));
+            }
+            // wider than ~85 degrees, some triangle is always facing the camera
+            meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+        }
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
@@ -19,6 +19,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <algorithm>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
@@ -33,6 +34,8 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // union of the mesh bounds
+    Bounds bounds;
 
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
@@ -70,6 +73,26 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+        computeBounds();
+    }
+
+    void computeBounds()
+    {
+        if(meshes.empty())
+            return;
+        bounds.Min = meshes[0].bounds.Min;
+        bounds.Max = meshes[0].bounds.Max;
+        for(unsigned int i = 1; i < meshes.size(); i++)
+        {
+            bounds.Min = glm::min(bounds.Min, meshes[i].bounds.Min);
+            bounds.Max = glm::max(bounds.Max, meshes[i].bounds.Max);
+        }
+        bounds.Center = 0.5f * (bounds.Min + bounds.Max);
+        // a sphere around the mesh spheres, tighter than the box diagonal for most models
+        bounds.Radius = 0.0f;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            bounds.Radius = std::max(bounds.Radius, glm::length(meshes[i].bounds.Center - bounds.Center) + meshes[i].bounds.Radius);
+        bounds.Radius = std::min(bounds.Radius, 0.5f * glm::length(bounds.Max - bounds.Min));
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -159,6 +182,7 @@ private:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
+        // metallic/roughness: texture_metallicRoughnessN
         aiColor3D color(0.0f, 0.0f, 0.0f);
         material->Get(AI_MATKEY_COLOR_AMBIENT, color);
 
@@ -175,6 +199,9 @@ private:
         // 4. height maps
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        // 5. metallic/roughness maps (glTF keeps them as the unknown type: roughness in g, metalness in b)
+        std::vector<Texture> metallicRoughnessMaps = loadMaterialTextures(material, aiTextureType_UNKNOWN, "texture_metallicRoughness");
+        textures.insert(textures.end(), metallicRoughnessMaps.begin(), metallicRoughnessMaps.end());
 
 
 
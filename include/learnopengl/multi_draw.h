@@ -0,0 +1,739 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/geometry_buffer.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <learnopengl/frustum.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+// what the GPU sees per drawn instance: an std430 SSBO entry on the GL 4.3 path, vertex attributes on the 3.3 path
+struct DrawData {
+    glm::mat4 Model;
+    glm::mat4 NormalMatrix; // mat3 in the first 3 columns, padded to vec4 columns the way std430 lays out a mat3
+};
+
+// attribute that carries the index into the DrawData SSBO (baseInstance + gl_InstanceID)
+#define DRAW_ID_ATTRIB_LOCATION 12
+// binding point of the DrawData SSBO, must match model_lighting_mdi.vs
+#define DRAW_DATA_BINDING 0
+
+// Draws every registered model out of one GeometryBuffer / one VAO.
+// With GL 4.3 each material bucket is a single glMultiDrawElementsIndirect call and transforms come from an SSBO,
+// on a 3.3 context the same commands are issued one by one with glDrawElementsInstancedBaseVertex.
+class MultiDrawRenderer
+{
+public:
+    // dynamic instances are drawn meshlet by meshlet, leaving out the ones that face away from the camera or are
+    // outside the frustum: each instance gets commands for just the index ranges that survive
+    bool meshletCulling = false;
+
+    struct MeshletStats {
+        unsigned int tested = 0;
+        unsigned int backFacing = 0;
+        unsigned int outside = 0;
+        unsigned int trianglesDrawn = 0;
+        unsigned int trianglesTotal = 0;
+    };
+
+    MultiDrawRenderer(GeometryBuffer &geometry, bool useIndirect)
+        : geometry(geometry), useIndirect(useIndirect)
+    {
+        glGenBuffers(1, &drawDataBuffer);
+        glGenBuffers(1, &indirectBuffer);
+        glGenBuffers(1, &drawIdBuffer);
+        glGenBuffers(1, &extraIndirectBuffer);
+    }
+
+    // copies the model's meshes into the shared geometry buffer, has to be called once before drawing the model
+    void AddModel(Model &model)
+    {
+        ModelEntry entry;
+        entry.model = &model;
+        entry.firstMesh = meshes.size();
+        entry.meshCount = model.meshes.size();
+        for(unsigned int i = 0; i < model.meshes.size(); i++)
+        {
+            Mesh &mesh = model.meshes[i];
+            MeshEntry meshEntry;
+            meshEntry.mesh = &mesh;
+            meshEntry.geometry = geometry.Allocate(mesh.vertices, mesh.indices);
+            meshEntry.materialId = materialIdFor(mesh);
+            meshes.push_back(meshEntry);
+        }
+        models.push_back(entry);
+        staticCommandsDirty = true;
+    }
+
+    // transforms that don't change from frame to frame, uploaded to the GPU only when they are set
+    void SetStaticInstances(Model &model, const vector<glm::mat4> &transforms)
+    {
+        ModelEntry *entry = findModel(model);
+        if(!entry)
+            return;
+        entry->staticInstances.resize(transforms.size());
+        for(unsigned int i = 0; i < transforms.size(); i++)
+            entry->staticInstances[i] = makeDrawData(transforms[i]);
+        staticDirty = true;
+        staticCommandsDirty = true;
+    }
+
+    // forgets the instances added with AddInstances and AddUnculledInstances last frame
+    void BeginFrame()
+    {
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            models[i].dynamicInstances.clear();
+            models[i].unculledInstances.clear();
+        }
+    }
+
+    void AddInstances(Model &model, const vector<glm::mat4> &transforms)
+    {
+        ModelEntry *entry = findModel(model);
+        if(!entry)
+            return;
+        for(unsigned int i = 0; i < transforms.size(); i++)
+            entry->dynamicInstances.push_back(makeDrawData(transforms[i]));
+    }
+
+    // every instance of a model before culling, for the passes that don't look through the camera (shadow maps)
+    // or look again at what culling dropped (the Hi-Z second chance). They go into the same DrawData buffer behind
+    // the culled ones, but get no commands of the frame's buckets: only DrawUnculledDepth and DrawUnculled draw them.
+    void AddUnculledInstances(Model &model, const vector<glm::mat4> &transforms)
+    {
+        ModelEntry *entry = findModel(model);
+        if(!entry)
+            return;
+        for(unsigned int i = 0; i < transforms.size(); i++)
+            entry->unculledInstances.push_back(makeDrawData(transforms[i]));
+    }
+
+    // a run of commands that share a material: one glMultiDrawElementsIndirect on the 4.3 path
+    struct Bucket {
+        unsigned int materialId;
+        unsigned int firstCommand;
+        unsigned int commandCount;
+        // distance from the camera to the closest instance in the bucket, for sorting
+        float nearestDistance;
+    };
+
+    // builds this frame's commands and uploads instances and commands, call once before DrawBucket.
+    // Commands of static instances are retained between frames, only the dynamic ones are rebuilt.
+    // The frustum is only used by meshlet culling, without one meshlets are culled by facing alone.
+    void Prepare(const glm::vec3 &viewPos, const Frustum *frustum = NULL)
+    {
+        drawCalls = 0;
+        cameraPos = viewPos;
+        meshletFrustum = frustum;
+        bool staticRebuilt = false;
+        if(staticCommandsDirty)
+        {
+            buildStaticCommands();
+            staticRebuilt = true;
+        }
+        buildDynamicCommands();
+        updateBucketDistances(viewPos, staticRebuilt);
+        if(commands.empty() && unculledCount == 0)
+            return;
+        uploadInstances();
+
+        glBindVertexArray(geometry.VAO);
+        if(useIndirect)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            if(commands.size() > indirectCapacity)
+            {
+                indirectCapacity = std::max((unsigned int)commands.size(), 2 * indirectCapacity);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_DRAW);
+                staticRebuilt = true;
+            }
+            // the static commands stay in the buffer, only the dynamic ones behind them are rewritten
+            unsigned int first = staticRebuilt ? 0 : staticCommandCount;
+            if(commands.size() > first)
+                glBufferSubData(GL_DRAW_INDIRECT_BUFFER, first * sizeof(DrawElementsIndirectCommand),
+                                (commands.size() - first) * sizeof(DrawElementsIndirectCommand), &commands[first]);
+        }
+        else
+        {
+            for(unsigned int i = 0; i < 7; i++)
+            {
+                glEnableVertexAttribArray(INSTANCE_ATTRIB_LOCATION + i);
+                glVertexAttribDivisor(INSTANCE_ATTRIB_LOCATION + i, 1);
+            }
+        }
+        glBindVertexArray(0);
+    }
+
+    // binds the textures of a bucket; the shader has to be in use
+    void BindBucketMaterial(Shader &shader, unsigned int bucket)
+    {
+        meshes[commandMeshes[buckets[bucket].firstCommand]].mesh->BindTextures(shader);
+    }
+
+    // draws one bucket, expects the geometry VAO bound, the shader in use and the bucket's material bound
+    void DrawBucket(unsigned int bucket)
+    {
+        const Bucket &b = buckets[bucket];
+        if(useIndirect)
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(b.firstCommand * sizeof(DrawElementsIndirectCommand)), b.commandCount, 0);
+            drawCalls++;
+        }
+        else
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+            for(unsigned int c = b.firstCommand; c < b.firstCommand + b.commandCount; c++)
+                drawFallback(commands[c]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    // draws everything in one go, without going through a RenderQueue
+    void Draw(Shader &shader, const glm::vec3 &viewPos)
+    {
+        Prepare(viewPos);
+        glBindVertexArray(geometry.VAO);
+        for(unsigned int i = 0; i < buckets.size(); i++)
+        {
+            BindBucketMaterial(shader, i);
+            DrawBucket(i);
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // depth only: the meshes of every unculled instance whose bounding sphere passes include(center, radius), as
+    // one multi-draw whatever their materials (one draw per mesh and run of included instances on GL 3.3).
+    // Needs Prepare first; no textures are bound, the depth shader has to be in use and read the instances like
+    // the model shader does.
+    template<typename Include>
+    void DrawUnculledDepth(Include include)
+    {
+        extraCommands.clear();
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            const ModelEntry &entry = models[i];
+            included.resize(entry.unculledInstances.size());
+            for(unsigned int k = 0; k < entry.unculledInstances.size(); k++)
+            {
+                glm::vec3 center;
+                float radius;
+                TransformSphere(entry.model->bounds, entry.unculledInstances[k].Model, center, radius);
+                included[k] = include(center, radius);
+            }
+            for(unsigned int m = entry.firstMesh; m < entry.firstMesh + entry.meshCount; m++)
+            {
+                if(!meshes[m].geometry.valid)
+                    continue;
+                // neighbours that are both included are one command
+                for(unsigned int k = 0; k < included.size(); k++)
+                {
+                    if(!included[k])
+                        continue;
+                    unsigned int first = k;
+                    while(k + 1 < included.size() && included[k + 1])
+                        k++;
+                    extraCommands.push_back(makeCommand(meshes[m].geometry, entry.unculledBase + first, k + 1 - first));
+                }
+            }
+        }
+        if(extraCommands.empty())
+            return;
+
+        beginExtraCommands();
+        drawExtraCommands(0, extraCommands.size());
+        endExtraCommands();
+    }
+
+    void DrawUnculledDepth()
+    {
+        DrawUnculledDepth([](const glm::vec3 &, float) { return true; });
+    }
+
+    // the unculled instances of one model picked by index (into the transforms of AddUnculledInstances), each drawn
+    // inside wrap(index, draw), e.g. under a conditional render of its own. Every material is bound once; per
+    // material and instance, the instance's meshes of that material are one multi-draw. The shader has to be in use.
+    template<typename Wrap>
+    void DrawUnculled(Shader &shader, Model &model, const vector<unsigned int> &picked, Wrap wrap)
+    {
+        ModelEntry *entry = findModel(model);
+        if(!entry || picked.empty())
+            return;
+        // the model's meshes grouped by material; a group's commands for one instance are next to each other
+        vector<unsigned int> order;
+        for(unsigned int m = entry->firstMesh; m < entry->firstMesh + entry->meshCount; m++)
+            if(meshes[m].geometry.valid)
+                order.push_back(m);
+        std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+            return meshes[a].materialId < meshes[b].materialId;
+        });
+        vector<unsigned int> groups;
+        for(unsigned int i = 0; i < order.size(); i++)
+            if(groups.empty() || meshes[order[i]].materialId != meshes[order[groups.back()]].materialId)
+                groups.push_back(i);
+        groups.push_back(order.size());
+
+        extraCommands.clear();
+        for(unsigned int g = 0; g + 1 < groups.size(); g++)
+            for(unsigned int p = 0; p < picked.size(); p++)
+                for(unsigned int i = groups[g]; i < groups[g + 1]; i++)
+                    extraCommands.push_back(makeCommand(meshes[order[i]].geometry, entry->unculledBase + picked[p], 1));
+        if(extraCommands.empty())
+            return;
+
+        beginExtraCommands();
+        unsigned int first = 0;
+        for(unsigned int g = 0; g + 1 < groups.size(); g++)
+        {
+            unsigned int count = groups[g + 1] - groups[g];
+            meshes[order[groups[g]]].mesh->BindTextures(shader);
+            for(unsigned int p = 0; p < picked.size(); p++, first += count)
+                wrap(picked[p], [this, first, count]() { drawExtraCommands(first, count); });
+        }
+        endExtraCommands();
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    const vector<Bucket> &Buckets() const { return buckets; }
+    unsigned int DrawCalls() const { return drawCalls; }
+    unsigned int CommandCount() const { return commands.size(); }
+    unsigned int StaticCommandCount() const { return staticCommandCount; }
+    const MeshletStats &GetMeshletStats() const { return meshletStats; }
+
+    struct MeshEntry {
+        Mesh *mesh;
+        GeometryAllocation geometry;
+        unsigned int materialId;
+    };
+
+    // where the meshes of an added model live, for commands that are built somewhere else (on the GPU)
+    vector<MeshEntry> ModelMeshes(Model &model)
+    {
+        vector<MeshEntry> result;
+        ModelEntry *entry = findModel(model);
+        if(entry)
+            result.assign(meshes.begin() + entry->firstMesh, meshes.begin() + entry->firstMesh + entry->meshCount);
+        return result;
+    }
+
+    // makes the draw id attribute cover at least count instances, so draws with baseInstance 0 and up to count
+    // instances can read a DrawData buffer of their own through the same vertex shader
+    void ReserveInstances(unsigned int count)
+    {
+        if(count <= instanceCapacity)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+        growInstances(count);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+private:
+    struct ModelEntry {
+        Model *model;
+        unsigned int firstMesh;
+        unsigned int meshCount;
+        vector<DrawData> staticInstances;
+        vector<DrawData> dynamicInstances;
+        vector<DrawData> unculledInstances;
+        // where this model's instances start in the DrawData buffer, filled in when the commands are built
+        unsigned int staticBase = 0;
+        unsigned int dynamicBase = 0;
+        unsigned int unculledBase = 0;
+    };
+
+    GeometryBuffer &geometry;
+    bool useIndirect;
+
+    vector<MeshEntry> meshes;
+    vector<ModelEntry> models;
+    // meshes that bind exactly the same textures share a material id and can go into one multi-draw
+    map<vector<unsigned int>, unsigned int> materialIds;
+
+    // command list: the retained static commands first, then this frame's dynamic ones, each part sorted by material.
+    // commandMeshes[i] is the mesh entry of commands[i], commandSources[i] its instance set (2 * model + dynamic)
+    vector<DrawElementsIndirectCommand> commands;
+    vector<unsigned int> commandMeshes;
+    vector<unsigned int> commandSources;
+    vector<Bucket> buckets;
+    unsigned int staticCommandCount = 0;
+    unsigned int staticBucketCount = 0;
+    bool staticCommandsDirty = true;
+    // nearest instance distance of every instance set, the static ones are redone only when the camera moved
+    vector<float> sourceDistances;
+    glm::vec3 lastViewPos = glm::vec3(0.0f);
+
+    unsigned int drawDataBuffer, indirectBuffer, drawIdBuffer;
+    // commands of DrawUnculledDepth and DrawUnculled, rewritten for every call
+    unsigned int extraIndirectBuffer;
+    vector<DrawElementsIndirectCommand> extraCommands;
+    vector<unsigned char> included;
+    unsigned int unculledCount = 0;
+    unsigned int instanceCapacity = 0;
+    unsigned int indirectCapacity = 0;
+    unsigned int staticCount = 0;
+    bool staticDirty = true;
+    vector<DrawData> dynamicScratch;
+    unsigned int drawCalls = 0;
+    glm::vec3 cameraPos = glm::vec3(0.0f);
+    const Frustum *meshletFrustum = NULL;
+    MeshletStats meshletStats;
+
+    static DrawData makeDrawData(const glm::mat4 &model)
+    {
+        DrawData data;
+        data.Model = model;
+        data.NormalMatrix = glm::mat4(glm::mat3(glm::transpose(glm::inverse(model))));
+        return data;
+    }
+
+    ModelEntry *findModel(Model &model)
+    {
+        for(unsigned int i = 0; i < models.size(); i++)
+            if(models[i].model == &model)
+                return &models[i];
+        std::cout << "MultiDrawRenderer: model was not added with AddModel" << std::endl;
+        return NULL;
+    }
+
+    unsigned int materialIdFor(const Mesh &mesh)
+    {
+        vector<unsigned int> key;
+        for(unsigned int i = 0; i < mesh.textures.size(); i++)
+            key.push_back(mesh.textures[i].id);
+        map<vector<unsigned int>, unsigned int>::iterator it = materialIds.find(key);
+        if(it != materialIds.end())
+            return it->second;
+        unsigned int id = materialIds.size();
+        materialIds[key] = id;
+        return id;
+    }
+
+    void buildStaticCommands()
+    {
+        // static instances are packed first so their part of the buffer can stay untouched between frames
+        staticCount = 0;
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            models[i].staticBase = staticCount;
+            staticCount += models[i].staticInstances.size();
+        }
+
+        commands.clear();
+        commandMeshes.clear();
+        commandSources.clear();
+        buckets.clear();
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            const ModelEntry &entry = models[i];
+            if(entry.staticInstances.empty())
+                continue;
+            for(unsigned int m = entry.firstMesh; m < entry.firstMesh + entry.meshCount; m++)
+                if(meshes[m].geometry.valid)
+                    pushCommand(m, entry.staticBase, entry.staticInstances.size(), 2 * i);
+        }
+        sortCommands(0);
+        staticCommandCount = commands.size();
+        staticBucketCount = buckets.size();
+        staticCommandsDirty = false;
+    }
+
+    void buildDynamicCommands()
+    {
+        commands.resize(staticCommandCount);
+        commandMeshes.resize(staticCommandCount);
+        commandSources.resize(staticCommandCount);
+        buckets.resize(staticBucketCount);
+
+        unsigned int dynamicCount = 0;
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            models[i].dynamicBase = staticCount + dynamicCount;
+            dynamicCount += models[i].dynamicInstances.size();
+        }
+        // the unculled instances go behind all of them
+        unculledCount = 0;
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            models[i].unculledBase = staticCount + dynamicCount + unculledCount;
+            unculledCount += models[i].unculledInstances.size();
+        }
+        meshletStats = MeshletStats();
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            const ModelEntry &entry = models[i];
+            if(entry.dynamicInstances.empty())
+                continue;
+            for(unsigned int m = entry.firstMesh; m < entry.firstMesh + entry.meshCount; m++)
+            {
+                if(!meshes[m].geometry.valid)
+                    continue;
+                if(meshletCulling && !meshes[m].mesh->meshlets.empty())
+                    pushMeshletCommands(m, entry, 2 * i + 1);
+                else
+                    pushCommand(m, entry.dynamicBase, entry.dynamicInstances.size(), 2 * i + 1);
+            }
+        }
+        sortCommands(staticCommandCount);
+    }
+
+    // one command per instance and per run of surviving meshlets (they are contiguous in the index buffer,
+    // so neighbours that both survive are drawn as one range)
+    void pushMeshletCommands(unsigned int meshIndex, const ModelEntry &entry, unsigned int source)
+    {
+        const vector<Meshlet> &meshlets = meshes[meshIndex].mesh->meshlets;
+        for(unsigned int instance = 0; instance < entry.dynamicInstances.size(); instance++)
+        {
+            const DrawData &data = entry.dynamicInstances[instance];
+            glm::mat3 normalMatrix = glm::mat3(data.NormalMatrix);
+            float scale = std::max(glm::length(glm::vec3(data.Model[0])),
+                                   std::max(glm::length(glm::vec3(data.Model[1])), glm::length(glm::vec3(data.Model[2]))));
+            int rangeStart = -1;
+            unsigned int rangeEnd = 0;
+            for(unsigned int k = 0; k < meshlets.size(); k++)
+            {
+                const Meshlet &meshlet = meshlets[k];
+                glm::vec3 center = glm::vec3(data.Model * glm::vec4(meshlet.center, 1.0f));
+                float radius = meshlet.radius * scale;
+                bool visible = true;
+                if(MeshletBackFacing(meshlet, center, radius, glm::normalize(normalMatrix * meshlet.coneAxis), cameraPos))
+                {
+                    visible = false;
+                    meshletStats.backFacing++;
+                }
+                else if(meshletFrustum)
+                {
+                    for(unsigned int p = 0; p < 6 && visible; p++)
+                        visible = glm::dot(glm::vec3(meshletFrustum->planes[p]), center) + meshletFrustum->planes[p].w > -radius;
+                    if(!visible)
+                        meshletStats.outside++;
+                }
+                meshletStats.tested++;
+                meshletStats.trianglesTotal += meshlet.indexCount / 3;
+                if(!visible)
+                    continue;
+                meshletStats.trianglesDrawn += meshlet.indexCount / 3;
+                if(rangeStart >= 0 && meshlet.firstIndex == rangeEnd)
+                {
+                    rangeEnd += meshlet.indexCount;
+                    continue;
+                }
+                if(rangeStart >= 0)
+                    pushCommand(meshIndex, entry.dynamicBase + instance, 1, source, rangeStart, rangeEnd - rangeStart);
+                rangeStart = meshlet.firstIndex;
+                rangeEnd = meshlet.firstIndex + meshlet.indexCount;
+            }
+            if(rangeStart >= 0)
+                pushCommand(meshIndex, entry.dynamicBase + instance, 1, source, rangeStart, rangeEnd - rangeStart);
+        }
+    }
+
+    // sorts commands[first..] by material and appends a bucket for every run of equal materials
+    void sortCommands(unsigned int first)
+    {
+        unsigned int count = commands.size() - first;
+        vector<unsigned int> order(count);
+        for(unsigned int i = 0; i < count; i++)
+            order[i] = first + i;
+        std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+            return meshes[commandMeshes[a]].materialId < meshes[commandMeshes[b]].materialId;
+        });
+        vector<DrawElementsIndirectCommand> sortedCommands(count);
+        vector<unsigned int> sortedMeshes(count);
+        vector<unsigned int> sortedSources(count);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            sortedCommands[i] = commands[order[i]];
+            sortedMeshes[i] = commandMeshes[order[i]];
+            sortedSources[i] = commandSources[order[i]];
+        }
+        std::copy(sortedCommands.begin(), sortedCommands.end(), commands.begin() + first);
+        std::copy(sortedMeshes.begin(), sortedMeshes.end(), commandMeshes.begin() + first);
+        std::copy(sortedSources.begin(), sortedSources.end(), commandSources.begin() + first);
+
+        // a bucket never spans the static and the dynamic part
+        unsigned int firstBucket = buckets.size();
+        for(unsigned int i = first; i < commands.size(); i++)
+        {
+            unsigned int material = meshes[commandMeshes[i]].materialId;
+            if(buckets.size() == firstBucket || buckets.back().materialId != material)
+                buckets.push_back({material, i, 0, 1e30f});
+            buckets.back().commandCount++;
+        }
+    }
+
+    void updateBucketDistances(const glm::vec3 &viewPos, bool force)
+    {
+        bool cameraMoved = force || viewPos != lastViewPos;
+        sourceDistances.resize(2 * models.size());
+        for(unsigned int i = 0; i < models.size(); i++)
+        {
+            if(cameraMoved)
+                sourceDistances[2 * i] = nearestDistance(models[i].staticInstances, viewPos);
+            sourceDistances[2 * i + 1] = nearestDistance(models[i].dynamicInstances, viewPos);
+        }
+        lastViewPos = viewPos;
+
+        for(unsigned int b = cameraMoved ? 0 : staticBucketCount; b < buckets.size(); b++)
+        {
+            Bucket &bucket = buckets[b];
+            bucket.nearestDistance = 1e30f;
+            for(unsigned int c = bucket.firstCommand; c < bucket.firstCommand + bucket.commandCount; c++)
+                bucket.nearestDistance = std::min(bucket.nearestDistance, sourceDistances[commandSources[c]]);
+        }
+    }
+
+    static float nearestDistance(const vector<DrawData> &instances, const glm::vec3 &viewPos)
+    {
+        float nearest = 1e30f;
+        for(unsigned int i = 0; i < instances.size(); i++)
+            nearest = std::min(nearest, glm::length(glm::vec3(instances[i].Model[3]) - viewPos));
+        return nearest;
+    }
+
+    // draws the whole mesh, or only indexCount of its indices from firstIndex on
+    void pushCommand(unsigned int meshIndex, unsigned int baseInstance, unsigned int instanceCount, unsigned int source,
+                     unsigned int firstIndex = 0, unsigned int indexCount = 0)
+    {
+        commands.push_back(makeCommand(meshes[meshIndex].geometry, baseInstance, instanceCount, firstIndex, indexCount));
+        commandMeshes.push_back(meshIndex);
+        commandSources.push_back(source);
+    }
+
+    static DrawElementsIndirectCommand makeCommand(const GeometryAllocation &g, unsigned int baseInstance, unsigned int instanceCount,
+                                                   unsigned int firstIndex = 0, unsigned int indexCount = 0)
+    {
+        DrawElementsIndirectCommand command;
+        command.count = indexCount > 0 ? indexCount : g.indexCount;
+        command.instanceCount = instanceCount;
+        command.firstIndex = g.firstIndex + firstIndex;
+        command.baseVertex = g.baseVertex;
+        command.baseInstance = baseInstance;
+        return command;
+    }
+
+    void uploadInstances()
+    {
+        unsigned int total = staticCount;
+        dynamicScratch.clear();
+        for(unsigned int i = 0; i < models.size(); i++)
+            dynamicScratch.insert(dynamicScratch.end(), models[i].dynamicInstances.begin(), models[i].dynamicInstances.end());
+        for(unsigned int i = 0; i < models.size(); i++)
+            dynamicScratch.insert(dynamicScratch.end(), models[i].unculledInstances.begin(), models[i].unculledInstances.end());
+        total += dynamicScratch.size();
+
+        glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+        if(total > instanceCapacity)
+            growInstances(total);
+        if(staticDirty)
+        {
+            unsigned int offset = 0;
+            for(unsigned int i = 0; i < models.size(); i++)
+            {
+                const vector<DrawData> &instances = models[i].staticInstances;
+                if(instances.empty())
+                    continue;
+                glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(DrawData), instances.size() * sizeof(DrawData), &instances[0]);
+                offset += instances.size();
+            }
+            staticDirty = false;
+        }
+        if(!dynamicScratch.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, staticCount * sizeof(DrawData), dynamicScratch.size() * sizeof(DrawData), &dynamicScratch[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // expects drawDataBuffer bound to GL_ARRAY_BUFFER; the contents are lost, static instances are uploaded again
+    void growInstances(unsigned int total)
+    {
+        instanceCapacity = std::max(total, 2 * instanceCapacity);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(DrawData), NULL, GL_DYNAMIC_DRAW);
+        staticDirty = true;
+        if(useIndirect)
+            resizeDrawIds();
+    }
+
+    // gl_BaseInstance needs GL 4.6, so the draw id comes from an instanced attribute holding 0, 1, 2, ...
+    // which baseInstance offsets for every command
+    void resizeDrawIds()
+    {
+        vector<unsigned int> ids(instanceCapacity);
+        for(unsigned int i = 0; i < instanceCapacity; i++)
+            ids[i] = i;
+        glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(unsigned int), &ids[0], GL_STATIC_DRAW);
+
+        glBindVertexArray(geometry.VAO);
+        glEnableVertexAttribArray(DRAW_ID_ATTRIB_LOCATION);
+        glVertexAttribIPointer(DRAW_ID_ATTRIB_LOCATION, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+        glVertexAttribDivisor(DRAW_ID_ATTRIB_LOCATION, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+    }
+
+    // binds what extraCommands are drawn with and uploads them (orphaned, a shadow pass draws several times a frame)
+    void beginExtraCommands()
+    {
+        glBindVertexArray(geometry.VAO);
+        if(useIndirect)
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, extraIndirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, extraCommands.size() * sizeof(DrawElementsIndirectCommand), &extraCommands[0], GL_STREAM_DRAW);
+        }
+        else
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+        }
+    }
+
+    void drawExtraCommands(unsigned int first, unsigned int count)
+    {
+        if(useIndirect)
+        {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(DrawElementsIndirectCommand)), count, 0);
+            drawCalls++;
+        }
+        else
+        {
+            for(unsigned int c = first; c < first + count; c++)
+                drawFallback(extraCommands[c]);
+        }
+    }
+
+    void endExtraCommands()
+    {
+        if(!useIndirect)
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    // GL 3.3: no baseInstance, so the per-instance attributes are re-pointed at the command's slice of the buffer
+    void drawFallback(const DrawElementsIndirectCommand &command)
+    {
+        size_t base = (size_t)command.baseInstance * sizeof(DrawData);
+        for(unsigned int i = 0; i < 4; i++)
+            glVertexAttribPointer(INSTANCE_ATTRIB_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(DrawData),
+                                  (void*)(base + offsetof(DrawData, Model) + i * sizeof(glm::vec4)));
+        for(unsigned int i = 0; i < 3; i++)
+            glVertexAttribPointer(INSTANCE_ATTRIB_LOCATION + 4 + i, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData),
+                                  (void*)(base + offsetof(DrawData, NormalMatrix) + i * sizeof(glm::vec4)));
+
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                          (void*)((size_t)command.firstIndex * sizeof(unsigned int)),
+                                          command.instanceCount, command.baseVertex);
+        drawCalls++;
+    }
+};
+#endif
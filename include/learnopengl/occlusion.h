@@ -0,0 +1,377 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/frustum.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cfloat>
+#include <algorithm>
+using namespace std;
+
+// a box that lies completely inside a model, so whatever it hides is hidden by the model too
+struct OccluderBox {
+    glm::vec3 Min = glm::vec3(0.0f);
+    glm::vec3 Max = glm::vec3(0.0f);
+    bool Valid = false;
+};
+
+// Generates the occluder proxy of a closed model (an igloo dome) at import: the model's box is shrunk around its
+// center until no vertex is inside it any more (with a small margin, so the triangles between vertices don't cut
+// through the corners), which leaves a box inside the shell. Models with geometry inside get no occluder.
+inline OccluderBox BuildOccluderBox(const Model &model, float margin = 0.05f)
+{
+    OccluderBox occluder;
+    glm::vec3 center = model.bounds.Center;
+    glm::vec3 half = 0.5f * (model.bounds.Max - model.bounds.Min);
+    for(float scale = 0.95f; scale > 0.1f; scale -= 0.05f)
+    {
+        glm::vec3 testMin = center - half * (scale + margin);
+        glm::vec3 testMax = center + half * (scale + margin);
+        bool empty = true;
+        for(unsigned int m = 0; m < model.meshes.size() && empty; m++)
+        {
+            const vector<Vertex> &vertices = model.meshes[m].vertices;
+            for(unsigned int i = 0; i < vertices.size(); i++)
+            {
+                const glm::vec3 &p = vertices[i].Position;
+                if(p.x > testMin.x && p.x < testMax.x && p.y > testMin.y && p.y < testMax.y && p.z > testMin.z && p.z < testMax.z)
+                {
+                    empty = false;
+                    break;
+                }
+            }
+        }
+        if(empty)
+        {
+            occluder.Min = center - half * scale;
+            occluder.Max = center + half * scale;
+            occluder.Valid = true;
+            return occluder;
+        }
+    }
+    return occluder;
+}
+
+// appends the 12 triangles of an occluder box placed by an instance transform
+inline void AppendOccluderTriangles(const OccluderBox &box, const glm::mat4 &transform, vector<glm::vec3> &triangles)
+{
+    if(!box.Valid)
+        return;
+    glm::vec3 corners[8];
+    for(unsigned int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner((i & 1) ? box.Max.x : box.Min.x, (i & 2) ? box.Max.y : box.Min.y, (i & 4) ? box.Max.z : box.Min.z);
+        corners[i] = glm::vec3(transform * glm::vec4(corner, 1.0f));
+    }
+    static const unsigned int faces[6][4] = {
+        {0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}
+    };
+    for(unsigned int f = 0; f < 6; f++)
+    {
+        triangles.push_back(corners[faces[f][0]]);
+        triangles.push_back(corners[faces[f][1]]);
+        triangles.push_back(corners[faces[f][2]]);
+        triangles.push_back(corners[faces[f][0]]);
+        triangles.push_back(corners[faces[f][2]]);
+        triangles.push_back(corners[faces[f][3]]);
+    }
+}
+
+// CPU occlusion culling: the occluder triangles are rasterized into a small depth buffer and the occludee boxes
+// are tested against it, all on worker threads. The buffer is split into horizontal bands the workers rasterize
+// independently (4 pixels at a time with SSE), then the occludees are shared out between them.
+// Start kicks off a frame and returns, Finish waits for it, so the main thread can do other work in between.
+class OcclusionCuller
+{
+public:
+    static const int WIDTH = 256;
+    static const int HEIGHT = 192;
+    static const int BAND_HEIGHT = 16;
+
+    struct Stats {
+        unsigned int occluderTriangles = 0;
+        unsigned int occludeesTested = 0;
+        unsigned int occluded = 0;
+        float milliseconds = 0.0f;
+    };
+
+    OcclusionCuller(unsigned int threadCount = 0)
+    {
+        if(threadCount == 0)
+            threadCount = std::min(4u, std::max(1u, std::thread::hardware_concurrency() - 1));
+        depth.resize(WIDTH * HEIGHT, FLT_MAX);
+        for(unsigned int i = 0; i < threadCount; i++)
+            workers.push_back(std::thread(&OcclusionCuller::workerLoop, this));
+    }
+
+    // the worker threads have to be stopped before the object goes away
+    ~OcclusionCuller()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        startCondition.notify_all();
+        for(unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // world-space occluder triangles, 3 vertices each; kept until they are set again
+    void SetOccluders(const vector<glm::vec3> &triangles)
+    {
+        occluders = triangles;
+    }
+
+    // occludees must stay untouched until Finish returns
+    void Start(const glm::mat4 &viewProjection, const BoxBatch &occludees)
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+        this->viewProjection = viewProjection;
+        this->occludees = &occludees;
+        visible.assign(occludees.Size(), 1);
+        setupTriangles();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        nextBand = 0;
+        bandsDone = 0;
+        nextOccludee = 0;
+        workersDone = 0;
+        frame++;
+        startCondition.notify_all();
+    }
+
+    // waits for the workers, visible[i] is 0 for every occludee hidden behind the occluders
+    const vector<unsigned char> &Finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [this]() { return workersDone == workers.size(); });
+        stats.occluderTriangles = triangles.size();
+        stats.occludeesTested = visible.size();
+        stats.occluded = 0;
+        for(unsigned int i = 0; i < visible.size(); i++)
+            stats.occluded += !visible[i];
+        stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        return visible;
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    // screen-space triangle: depth is a plane z = zx * x + zy * y + z0 over the screen
+    struct ScreenTriangle {
+        glm::vec2 v[3];
+        float zx, zy, z0;
+        int minX, maxX, minY, maxY;
+    };
+
+    vector<float> depth; // NDC depth, FLT_MAX where nothing was drawn
+    vector<glm::vec3> occluders;
+    vector<ScreenTriangle> triangles;
+    glm::mat4 viewProjection;
+    const BoxBatch *occludees = NULL;
+    vector<unsigned char> visible;
+    Stats stats;
+    std::chrono::high_resolution_clock::time_point startTime;
+
+    vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    unsigned long long frame = 0;
+    bool quit = false;
+    unsigned int workersDone = 0;
+    std::atomic<int> nextBand;
+    std::atomic<int> bandsDone;
+    std::atomic<unsigned int> nextOccludee;
+
+    // projects the occluders; triangles crossing the near plane are dropped, which only makes culling less aggressive
+    void setupTriangles()
+    {
+        triangles.clear();
+        for(unsigned int i = 0; i + 2 < occluders.size(); i += 3)
+        {
+            ScreenTriangle t;
+            float z[3];
+            bool clipped = false;
+            for(unsigned int k = 0; k < 3; k++)
+            {
+                glm::vec4 clip = viewProjection * glm::vec4(occluders[i + k], 1.0f);
+                if(clip.w < 0.01f)
+                {
+                    clipped = true;
+                    break;
+                }
+                t.v[k] = glm::vec2((clip.x / clip.w * 0.5f + 0.5f) * WIDTH, (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT);
+                z[k] = clip.z / clip.w;
+            }
+            if(clipped)
+                continue;
+            float area = (t.v[1].x - t.v[0].x) * (t.v[2].y - t.v[0].y) - (t.v[1].y - t.v[0].y) * (t.v[2].x - t.v[0].x);
+            if(std::fabs(area) < 1e-6f)
+                continue;
+            // counter-clockwise for the edge functions
+            if(area < 0.0f)
+            {
+                std::swap(t.v[1], t.v[2]);
+                std::swap(z[1], z[2]);
+                area = -area;
+            }
+            glm::vec2 e1 = t.v[1] - t.v[0], e2 = t.v[2] - t.v[0];
+            float dz1 = z[1] - z[0], dz2 = z[2] - z[0];
+            t.zx = (dz1 * e2.y - dz2 * e1.y) / area;
+            t.zy = (dz2 * e1.x - dz1 * e2.x) / area;
+            t.z0 = z[0] - t.zx * t.v[0].x - t.zy * t.v[0].y;
+            t.minX = std::max(0, (int)std::floor(std::min(t.v[0].x, std::min(t.v[1].x, t.v[2].x))));
+            t.maxX = std::min(WIDTH - 1, (int)std::ceil(std::max(t.v[0].x, std::max(t.v[1].x, t.v[2].x))));
+            t.minY = std::max(0, (int)std::floor(std::min(t.v[0].y, std::min(t.v[1].y, t.v[2].y))));
+            t.maxY = std::min(HEIGHT - 1, (int)std::ceil(std::max(t.v[0].y, std::max(t.v[1].y, t.v[2].y))));
+            if(t.minX > t.maxX || t.minY > t.maxY)
+                continue;
+            triangles.push_back(t);
+        }
+    }
+
+    void workerLoop()
+    {
+        unsigned long long seenFrame = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                startCondition.wait(lock, [this, seenFrame]() { return quit || frame != seenFrame; });
+                if(quit)
+                    return;
+                seenFrame = frame;
+            }
+
+            const int bandCount = HEIGHT / BAND_HEIGHT;
+            for(int band = nextBand++; band < bandCount; band = nextBand++)
+            {
+                rasterizeBand(band);
+                bandsDone++;
+            }
+            // every band has to be finished before occludees can be tested against the whole buffer
+            while(bandsDone.load() < bandCount)
+                std::this_thread::yield();
+
+            const unsigned int batch = 16;
+            unsigned int count = occludees->Size();
+            for(unsigned int first = nextOccludee.fetch_add(batch); first < count; first = nextOccludee.fetch_add(batch))
+                for(unsigned int i = first; i < std::min(count, first + batch); i++)
+                    visible[i] = testOccludee(i);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            workersDone++;
+            doneCondition.notify_all();
+        }
+    }
+
+    void rasterizeBand(int band)
+    {
+        int bandMinY = band * BAND_HEIGHT;
+        int bandMaxY = bandMinY + BAND_HEIGHT - 1;
+        std::fill(depth.begin() + bandMinY * WIDTH, depth.begin() + (bandMaxY + 1) * WIDTH, FLT_MAX);
+
+        for(unsigned int i = 0; i < triangles.size(); i++)
+        {
+            const ScreenTriangle &t = triangles[i];
+            int minY = std::max(t.minY, bandMinY);
+            int maxY = std::min(t.maxY, bandMaxY);
+            if(minY > maxY)
+                continue;
+            // edge function of edge a->b: (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x) = A * p.x + B * p.y + C
+            float A[3], B[3], C[3];
+            for(unsigned int e = 0; e < 3; e++)
+            {
+                const glm::vec2 &a = t.v[(e + 1) % 3];
+                const glm::vec2 &b = t.v[(e + 2) % 3];
+                A[e] = -(b.y - a.y);
+                B[e] = b.x - a.x;
+                C[e] = (b.y - a.y) * a.x - (b.x - a.x) * a.y;
+            }
+            int minX = t.minX & ~3;
+            for(int y = minY; y <= maxY; y++)
+            {
+                float py = y + 0.5f;
+                float *row = &depth[y * WIDTH];
+#ifdef FRUSTUM_SSE
+                __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                __m128 zero = _mm_setzero_ps();
+                for(int x = minX; x <= t.maxX; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                    __m128 inside = _mm_cmpeq_ps(zero, zero);
+                    for(unsigned int e = 0; e < 3; e++)
+                    {
+                        __m128 w = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(A[e])), _mm_set1_ps(B[e] * py + C[e]));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(w, zero));
+                    }
+                    if(_mm_movemask_ps(inside) == 0)
+                        continue;
+                    __m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(t.zx)), _mm_set1_ps(t.zy * py + t.z0));
+                    __m128 old = _mm_loadu_ps(row + x);
+                    __m128 nearer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+#else
+                for(int x = minX; x <= t.maxX; x++)
+                {
+                    float px = x + 0.5f;
+                    if(A[0] * px + B[0] * py + C[0] < 0.0f || A[1] * px + B[1] * py + C[1] < 0.0f || A[2] * px + B[2] * py + C[2] < 0.0f)
+                        continue;
+                    row[x] = std::min(row[x], t.zx * px + t.zy * py + t.z0);
+                }
+#endif
+            }
+        }
+    }
+
+    // an occludee is hidden if every pixel its box covers has an occluder in front of the box's nearest point
+    unsigned char testOccludee(unsigned int i) const
+    {
+        glm::vec3 center(occludees->cx[i], occludees->cy[i], occludees->cz[i]);
+        glm::vec3 extents(occludees->ex[i], occludees->ey[i], occludees->ez[i]);
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+        for(unsigned int c = 0; c < 8; c++)
+        {
+            glm::vec3 corner = center + glm::vec3((c & 1) ? extents.x : -extents.x, (c & 2) ? extents.y : -extents.y, (c & 4) ? extents.z : -extents.z);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+            // touching the near plane, can't be hidden by anything
+            if(clip.w < 0.01f)
+                return 1;
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+            minZ = std::min(minZ, clip.z / clip.w);
+        }
+        int x0 = std::max(0, (int)std::floor(minX)), x1 = std::min(WIDTH - 1, (int)std::ceil(maxX));
+        int y0 = std::max(0, (int)std::floor(minY)), y1 = std::min(HEIGHT - 1, (int)std::ceil(maxY));
+        if(x0 > x1 || y0 > y1)
+            return 1;
+        for(int y = y0; y <= y1; y++)
+        {
+            const float *row = &depth[y * WIDTH];
+            int x = x0;
+#ifdef FRUSTUM_SSE
+            __m128 boxDepth = _mm_set1_ps(minZ);
+            for(; x + 3 <= x1; x += 4)
+                if(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxDepth)) != 0)
+                    return 1;
+#endif
+            for(; x <= x1; x++)
+                if(row[x] >= minZ)
+                    return 1;
+        }
+        return 0;
+    }
+};
+#endif
@@ -0,0 +1,188 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <vector>
+#include <cassert>
+using namespace std;
+
+// GPU occlusion culling with GL_ANY_SAMPLES_PASSED queries: after a depth pre-pass the bounding box of every
+// object is drawn (no color or depth writes) inside a query, and the real draw is then wrapped in a conditional
+// render on that query. Results are only ever read when the GPU says they are available, so nothing stalls;
+// objects that can't use conditional rendering (instances of a multi-draw) use the last result that arrived.
+// A slot whose previous query is still in flight isn't queried again, and once maxInFlight queries are pending
+// no new ones are issued at all: those objects are simply drawn.
+class OcclusionQueries
+{
+public:
+    unsigned int maxInFlight = 256;
+
+    struct Stats {
+        unsigned int issued = 0;
+        unsigned int inFlight = 0;
+        unsigned int skipped = 0; // not queried because too many were in flight
+        unsigned int occluded = 0; // results that came back as hidden this frame
+    };
+
+    OcclusionQueries()
+    {
+        // unit cube, 36 vertices
+        float cube[] = {
+            0,0,0, 1,0,0, 1,1,0,  0,0,0, 1,1,0, 0,1,0,
+            0,0,1, 1,1,1, 1,0,1,  0,0,1, 0,1,1, 1,1,1,
+            0,0,0, 0,1,0, 0,1,1,  0,0,0, 0,1,1, 0,0,1,
+            1,0,0, 1,0,1, 1,1,1,  1,0,0, 1,1,1, 1,1,0,
+            0,0,0, 0,0,1, 1,0,1,  0,0,0, 1,0,1, 1,0,0,
+            0,1,0, 1,1,0, 1,1,1,  0,1,0, 1,1,1, 0,1,1
+        };
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    // one slot per object that can be occluded
+    void Resize(unsigned int count)
+    {
+        unsigned int old = slots.size();
+        if(count <= old)
+            return;
+        slots.resize(count);
+        for(unsigned int i = old; i < count; i++)
+            glGenQueries(1, &slots[i].query);
+    }
+
+    // collects every result that has arrived since last frame
+    void BeginFrame()
+    {
+        stats = Stats();
+        inFlight = 0;
+        for(unsigned int i = 0; i < slots.size(); i++)
+        {
+            Slot &slot = slots[i];
+            slot.issuedThisFrame = false;
+            slot.skippedThisFrame = false;
+            if(!slot.pending)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available)
+            {
+                inFlight++;
+                continue;
+            }
+            GLuint passed = 0;
+            glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT, &passed);
+            slot.visible = passed != 0;
+            slot.pending = false;
+            stats.occluded += !slot.visible;
+        }
+    }
+
+    // state for drawing the proxy boxes: the shader only needs model/view/projection and writes nothing
+    void BeginQueries(Shader &boxShader)
+    {
+        shader = &boxShader;
+        shader->use();
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(boxVAO);
+    }
+
+    // issues the query of one object, returns false when it wasn't issued (the object then has to be drawn)
+    bool Query(unsigned int index, const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &viewPos, float nearPlane)
+    {
+        Slot &slot = slots[index];
+        // with the camera inside the box its faces may all be behind the near plane or behind the camera
+        float margin = nearPlane * 2.0f;
+        if(viewPos.x > min.x - margin && viewPos.y > min.y - margin && viewPos.z > min.z - margin &&
+           viewPos.x < max.x + margin && viewPos.y < max.y + margin && viewPos.z < max.z + margin)
+        {
+            slot.visible = true;
+            return false;
+        }
+        if(slot.pending)
+            return false;
+        if(inFlight >= maxInFlight)
+        {
+            // an older hidden result must not keep it culled, nothing will come back to correct it
+            slot.visible = true;
+            slot.skippedThisFrame = true;
+            stats.skipped++;
+            return false;
+        }
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), min);
+        model = glm::scale(model, max - min);
+        shader->setMat4("model", model);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, slot.query);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        slot.pending = true;
+        slot.issuedThisFrame = true;
+        inFlight++;
+        stats.issued++;
+        return true;
+    }
+
+    void EndQueries()
+    {
+        glBindVertexArray(0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        stats.inFlight = inFlight;
+    }
+
+    // draws through a conditional render when the object was queried this frame; without a fresh query the last
+    // result decides. GL_QUERY_NO_WAIT draws anyway if the GPU hasn't got the result yet, so this never stalls.
+    template<typename DrawFunction>
+    void DrawConditional(unsigned int index, DrawFunction draw)
+    {
+        Slot &slot = slots[index];
+        // what was skipped at the cap is always drawn
+        assert(!slot.skippedThisFrame || slot.visible);
+        if(slot.issuedThisFrame)
+        {
+            glBeginConditionalRender(slot.query, GL_QUERY_NO_WAIT);
+            draw();
+            glEndConditionalRender();
+        }
+        else if(slot.visible)
+        {
+            draw();
+        }
+    }
+
+    // last result that came back, objects never queried count as visible
+    bool Visible(unsigned int index) const { return slots[index].visible; }
+    // objects that aren't even tested this frame (outside the frustum) start again as visible, so they don't pop in late
+    void Reset(unsigned int index) { slots[index].visible = true; }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    struct Slot {
+        unsigned int query = 0;
+        bool pending = false;
+        bool issuedThisFrame = false;
+        bool skippedThisFrame = false;
+        bool visible = true;
+    };
+
+    vector<Slot> slots;
+    unsigned int inFlight = 0;
+    unsigned int boxVAO = 0, boxVBO = 0;
+    Shader *shader = NULL;
+    Stats stats;
+};
+#endif
@@ -0,0 +1,408 @@
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+#include <learnopengl/clustered_lights.h>
+#include <learnopengl/frustum.h>
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// texture unit of the atlas, the per-light records are on the next one
+#define POINT_SHADOW_UNIT 14
+// near plane of every cube face
+#define POINT_SHADOW_NEAR 0.05f
+
+// Cube shadow maps of the point lights, every face a square tile of one shared depth atlas. Each frame a light gets
+// a face size from its importance (how large its reach looks on screen), the most important lights are placed
+// first and the least important ones make room when the atlas is full; a light's six faces are one 3x2 block.
+// A face is only rendered again when something in it changed: its block is new or resized, or a moving caster
+// passed through it. At most faceBudget faces are rendered per frame, those of lights with moving casters around
+// first; the others keep their cached depth a frame or two longer. So the cost is bounded however many lights
+// there are. A block is used by the shaders once all its six faces have been rendered.
+// The shaders read two texels per light from a buffer texture: (position, range) and (atlas offset, face size, 0),
+// face size 0 meaning unshadowed. PointShadow in the lit shaders takes the face axes FaceView looks along.
+class PointShadowAtlas
+{
+public:
+    struct Stats {
+        unsigned int shadowedLights = 0; // lights whose block the shaders read
+        unsigned int facesRendered = 0;
+        unsigned int facesPending = 0;   // still out of date after the budget
+        float atlasUsage = 0.0f;         // part of the atlas covered by blocks
+        float milliseconds = 0.0f;
+    };
+
+    // a caster that moved this frame, as a bounding sphere (where it was and where it is now are both given)
+    struct Caster {
+        glm::vec3 center;
+        float radius;
+    };
+
+    int faceBudget = 12;
+    unsigned int minFaceSize = 64;
+    unsigned int maxFaceSize = 512;
+
+    PointShadowAtlas(unsigned int size = 4096)
+        : size(size), cells(size / CELL_SIZE)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &recordBuffer);
+        glGenTextures(1, &recordTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, recordBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, 2 * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, recordTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, recordBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        used.assign(cells * cells, 0);
+    }
+
+    ~PointShadowAtlas()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteTextures(1, &recordTexture);
+        glDeleteBuffers(1, &recordBuffer);
+        glDeleteFramebuffers(1, &FBO);
+    }
+
+    // the same lights in the same order as the ClusteredLights set the shaders index; drops every block
+    void SetLights(const vector<ClusteredLights::Light> &newLights)
+    {
+        lights = newLights;
+        for(unsigned int i = 0; i < lights.size(); i++)
+            if(lights[i].range <= 0.0f)
+                lights[i].range = ClusteredLights::Range(lights[i]);
+        slots.assign(lights.size(), Slot());
+        std::fill(used.begin(), used.end(), 0);
+        recordsChanged = true;
+    }
+
+    // the static casters changed, every face is out of date
+    void Invalidate()
+    {
+        for(unsigned int i = 0; i < slots.size(); i++)
+            if(slots[i].faceSize > 0)
+                slots[i].dirtyFaces = ALL_FACES;
+    }
+
+    // sizes and places the blocks for this frame's view and marks the faces moving casters went through; lights
+    // before firstLight aren't lit per fragment (baked) and get none. screenHeight in pixels, fovY in radians.
+    void Update(const glm::mat4 &viewProjection, const glm::vec3 &viewPos, float fovY, float screenHeight,
+                const vector<Caster> &movingCasters, unsigned int firstLight)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        stats = Stats();
+        Frustum frustum = Frustum::FromMatrix(viewProjection);
+        float pixelsPerUnit = screenHeight / (2.0f * std::tan(0.5f * fovY));
+        for(unsigned int i = 0; i < lights.size(); i++)
+        {
+            Slot &slot = slots[i];
+            slot.importance = 0.0f;
+            slot.movingCasters = false;
+            const ClusteredLights::Light &light = lights[i];
+            glm::vec3 reach(light.range);
+            if(i < firstLight || TestBox(frustum, light.position - reach, light.position + reach) == FRUSTUM_OUTSIDE)
+                continue;
+            // radius of the light's reach on screen, as if the camera were at its edge once it is inside
+            slot.importance = light.range / std::max(glm::length(light.position - viewPos), light.range) * pixelsPerUnit;
+        }
+
+        // blocks that no longer fit their light are dropped, then the missing ones placed, most important first.
+        // Lights out of view keep theirs until the space is needed, and shrinking by one size isn't worth
+        // rendering six faces again.
+        for(unsigned int i = 0; i < lights.size(); i++)
+        {
+            Slot &slot = slots[i];
+            unsigned int wanted = faceSizeFor(slot.importance);
+            if(slot.faceSize > 0 && (i < firstLight || (wanted > 0 && (wanted > slot.faceSize || wanted * 4 <= slot.faceSize))))
+                release(slot);
+        }
+        order.clear();
+        for(unsigned int i = 0; i < lights.size(); i++)
+            order.push_back(i);
+        std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return slots[a].importance > slots[b].importance; });
+        for(unsigned int i = 0; i < order.size(); i++)
+        {
+            Slot &slot = slots[order[i]];
+            unsigned int wanted = faceSizeFor(slot.importance);
+            if(wanted == 0 || slot.faceSize > 0)
+                continue;
+            // smaller and smaller, then at the expense of the least important block left
+            while(true)
+            {
+                for(unsigned int faceSize = wanted; faceSize >= minFaceSize && slot.faceSize == 0; faceSize /= 2)
+                    place(slot, faceSize);
+                if(slot.faceSize > 0)
+                    break;
+                int victim = -1;
+                for(unsigned int k = order.size(); k-- > i + 1 && victim < 0; )
+                    if(slots[order[k]].faceSize > 0)
+                        victim = order[k];
+                if(victim < 0)
+                    break;
+                release(slots[victim]);
+            }
+        }
+
+        // a moving caster invalidates the faces it overlaps, where it was as well as where it is
+        for(unsigned int i = 0; i < lights.size(); i++)
+        {
+            Slot &slot = slots[i];
+            if(slot.faceSize == 0)
+                continue;
+            for(unsigned int c = 0; c < movingCasters.size(); c++)
+            {
+                glm::vec3 offset = movingCasters[c].center - lights[i].position;
+                if(glm::length(offset) >= lights[i].range + movingCasters[c].radius)
+                    continue;
+                unsigned char faces = FacesOverlapping(offset, movingCasters[c].radius);
+                slot.dirtyFaces |= faces;
+                slot.movingCasters = slot.movingCasters || faces != 0;
+            }
+        }
+
+        unsigned int usedCells = 0;
+        for(unsigned int i = 0; i < used.size(); i++)
+            usedCells += used[i];
+        stats.atlasUsage = (float)usedCells / used.size();
+    }
+
+    // renders the most urgent out of date faces within the budget, draw gets a face's view-projection and the light's
+    // position and range and issues the depth-only draws of the casters in reach. Leaves the framebuffer unbound (0).
+    void Render(const std::function<void(const glm::mat4 &, const glm::vec3 &, float)> &draw)
+    {
+        jobs.clear();
+        for(unsigned int i = 0; i < slots.size(); i++)
+        {
+            // what can't be seen can wait
+            if(slots[i].importance <= 0.0f)
+                continue;
+            for(unsigned int face = 0; face < 6; face++)
+            {
+                if(!(slots[i].dirtyFaces & (1 << face)))
+                    continue;
+                Job job;
+                job.light = i;
+                job.face = face;
+                job.priority = slots[i].importance * (slots[i].movingCasters ? 2.0f : 1.0f);
+                jobs.push_back(job);
+            }
+        }
+        std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.priority > b.priority; });
+        unsigned int rendered = std::min((unsigned int)jobs.size(), (unsigned int)std::max(faceBudget, 0));
+
+        if(rendered > 0)
+        {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            glEnable(GL_SCISSOR_TEST);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(1.5f, 3.0f);
+            for(unsigned int j = 0; j < rendered; j++)
+            {
+                Slot &slot = slots[jobs[j].light];
+                const ClusteredLights::Light &light = lights[jobs[j].light];
+                int x = slot.x * CELL_SIZE + (jobs[j].face % 3) * slot.faceSize;
+                int y = slot.y * CELL_SIZE + (jobs[j].face / 3) * slot.faceSize;
+                glViewport(x, y, slot.faceSize, slot.faceSize);
+                glScissor(x, y, slot.faceSize, slot.faceSize);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, light.range);
+                draw(projection * FaceView(light.position, jobs[j].face), light.position, light.range);
+                slot.dirtyFaces &= ~(1 << jobs[j].face);
+                if(slot.dirtyFaces == 0 && !slot.ready)
+                {
+                    slot.ready = true;
+                    recordsChanged = true;
+                }
+            }
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+
+        if(recordsChanged)
+        {
+            vector<glm::vec4> records(2 * std::max((size_t)1, lights.size()), glm::vec4(0.0f));
+            for(unsigned int i = 0; i < lights.size(); i++)
+            {
+                records[2 * i] = glm::vec4(lights[i].position, lights[i].range);
+                if(slots[i].ready)
+                    records[2 * i + 1] = glm::vec4((float)(slots[i].x * CELL_SIZE) / size, (float)(slots[i].y * CELL_SIZE) / size,
+                                                   (float)slots[i].faceSize / size, 0.0f);
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, recordBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, records.size() * sizeof(glm::vec4), &records[0], GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            recordsChanged = false;
+        }
+
+        for(unsigned int i = 0; i < slots.size(); i++)
+            stats.shadowedLights += slots[i].ready;
+        stats.facesRendered = rendered;
+        stats.facesPending = jobs.size() - rendered;
+        stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, recordTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the shader has to be in use
+    static void SetUniforms(Shader &shader)
+    {
+        shader.setInt("pointShadowAtlas", POINT_SHADOW_UNIT);
+        shader.setInt("pointShadowData", POINT_SHADOW_UNIT + 1);
+        shader.setFloat("pointShadowNear", POINT_SHADOW_NEAR);
+    }
+
+    // view of cube face 0-5 (+x, -x, +y, -y, +z, -z)
+    static glm::mat4 FaceView(const glm::vec3 &position, unsigned int face)
+    {
+        static const glm::vec3 directions[6] = {glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+                                                glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+        static const glm::vec3 ups[6] = {glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+                                         glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)};
+        return glm::lookAt(position, position + directions[face], ups[face]);
+    }
+
+    // the faces whose 90 degree pyramid a sphere at offset from the light reaches into, as a bit mask
+    static unsigned char FacesOverlapping(const glm::vec3 &offset, float radius)
+    {
+        unsigned char faces = 0;
+        for(unsigned int face = 0; face < 6; face++)
+        {
+            int axis = face / 2;
+            float along = face % 2 ? -offset[axis] : offset[axis];
+            // the four side planes are at 45 degrees, a point is inside while |across| <= along
+            float a = offset[(axis + 1) % 3], b = offset[(axis + 2) % 3];
+            float reach = radius * 1.41421356f;
+            if(along - std::fabs(a) >= -reach && along - std::fabs(b) >= -reach)
+                faces |= 1 << face;
+        }
+        return faces;
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    static const unsigned int CELL_SIZE = 64;
+    static const unsigned char ALL_FACES = 63;
+
+    struct Slot {
+        unsigned int x = 0, y = 0;     // block corner, in cells
+        unsigned int faceSize = 0;     // 0 without a block
+        unsigned char dirtyFaces = 0;
+        bool ready = false;            // every face rendered at least once
+        bool movingCasters = false;
+        float importance = 0.0f;
+    };
+    struct Job {
+        unsigned int light, face;
+        float priority;
+    };
+
+    unsigned int size, cells;
+    unsigned int texture = 0, FBO = 0;
+    unsigned int recordBuffer = 0, recordTexture = 0;
+    vector<ClusteredLights::Light> lights;
+    vector<Slot> slots;
+    vector<unsigned char> used; // one per cell
+    vector<unsigned int> order;
+    vector<Job> jobs;
+    bool recordsChanged = true;
+    Stats stats;
+    std::chrono::high_resolution_clock::time_point start;
+
+    unsigned int faceSizeFor(float importance) const
+    {
+        if(importance < minFaceSize)
+            return 0;
+        unsigned int faceSize = minFaceSize;
+        while(faceSize * 2 <= std::min((float)maxFaceSize, importance))
+            faceSize *= 2;
+        return faceSize;
+    }
+
+    // first free 3x2 block of faceSize tiles, scanning corners aligned to the tile size
+    void place(Slot &slot, unsigned int faceSize)
+    {
+        unsigned int n = faceSize / CELL_SIZE;
+        for(unsigned int y = 0; y + 2 * n <= cells; y += n)
+        {
+            for(unsigned int x = 0; x + 3 * n <= cells; x += n)
+            {
+                if(!isFree(x, y, 3 * n, 2 * n))
+                    continue;
+                mark(x, y, 3 * n, 2 * n, 1);
+                slot.x = x;
+                slot.y = y;
+                slot.faceSize = faceSize;
+                slot.dirtyFaces = ALL_FACES;
+                slot.ready = false;
+                return;
+            }
+        }
+    }
+
+    void release(Slot &slot)
+    {
+        unsigned int n = slot.faceSize / CELL_SIZE;
+        mark(slot.x, slot.y, 3 * n, 2 * n, 0);
+        if(slot.ready)
+            recordsChanged = true;
+        slot.faceSize = 0;
+        slot.dirtyFaces = 0;
+        slot.ready = false;
+    }
+
+    bool isFree(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height) const
+    {
+        for(unsigned int y = y0; y < y0 + height; y++)
+            for(unsigned int x = x0; x < x0 + width; x++)
+                if(used[y * cells + x])
+                    return false;
+        return true;
+    }
+
+    void mark(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height, unsigned char value)
+    {
+        for(unsigned int y = y0; y < y0 + height; y++)
+            for(unsigned int x = x0; x < x0 + width; x++)
+                used[y * cells + x] = value;
+    }
+};
+#endif
@@ -0,0 +1,219 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/bake_cache.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// Potentially visible sets of the static scene. The area the camera moves in is split into view cells on the ground
+// plane (each one spans the whole height), and for every cell a bitset records which static targets (the chunks of
+// the StaticBatcher) can be seen from anywhere inside it. The bake casts segments between random points of the
+// cell and random points of a target's box against the occluder triangles, on all cores; one clear segment is
+// enough. The result is cached on disk and only baked again when the scene it was made for changes, so at runtime
+// the visible set is one bitset lookup.
+// Sampling can miss a thin gap, so fewer samples trade bake time for the odd target that pops in late.
+class PotentiallyVisibleSet
+{
+public:
+    PotentiallyVisibleSet(const glm::vec3 &min, const glm::vec3 &max, float cellSize)
+        : min(min), max(max), cellSize(cellSize)
+    {
+        cellsX = std::max(1, (int)std::ceil((max.x - min.x) / cellSize));
+        cellsZ = std::max(1, (int)std::ceil((max.z - min.z) / cellSize));
+    }
+
+    // identifies what a bake was made from: grid, sample count, occluders and targets
+    uint64_t Signature(const vector<glm::vec3> &occluderTriangles, const vector<glm::vec3> &targetMin, const vector<glm::vec3> &targetMax,
+                       unsigned int samples) const
+    {
+        uint64_t hash = BAKE_SIGNATURE_SEED;
+        float grid[7] = {min.x, min.y, min.z, max.x, max.y, max.z, cellSize};
+        hash = BakeSignature(hash, grid, sizeof(grid));
+        hash = BakeSignature(hash, &samples, sizeof(samples));
+        if(!occluderTriangles.empty())
+            hash = BakeSignature(hash, &occluderTriangles[0], occluderTriangles.size() * sizeof(glm::vec3));
+        if(!targetMin.empty())
+        {
+            hash = BakeSignature(hash, &targetMin[0], targetMin.size() * sizeof(glm::vec3));
+            hash = BakeSignature(hash, &targetMax[0], targetMax.size() * sizeof(glm::vec3));
+        }
+        return hash;
+    }
+
+    // occluder triangles as 3 consecutive points each (see AppendOccluderTriangles), targets as world-space boxes
+    void Bake(const vector<glm::vec3> &occluderTriangles, const vector<glm::vec3> &targetMin, const vector<glm::vec3> &targetMax,
+              unsigned int samples = 64, unsigned int threadCount = 0)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        targetCount = targetMin.size();
+        words = (targetCount + 63) / 64;
+        bits.assign(cellsX * cellsZ * words, 0);
+
+        if(threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        // cells are handed out one at a time, they take very different times (open ground vs. behind a row of igloos)
+        std::atomic<int> nextCell(0);
+        vector<std::thread> workers;
+        for(unsigned int t = 0; t < threadCount; t++)
+        {
+            workers.push_back(std::thread([&]() {
+                for(int cell = nextCell++; cell < cellsX * cellsZ; cell = nextCell++)
+                    bakeCell(cell, occluderTriangles, targetMin, targetMax, samples);
+            }));
+        }
+        for(unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+        bakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    bool Load(const string &path, uint64_t signature)
+    {
+        std::ifstream in;
+        if(!OpenBakeCache(in, path, "PVS1", signature))
+            return false;
+        int storedX, storedZ;
+        unsigned int storedTargets;
+        in.read((char*)&storedX, sizeof(storedX));
+        in.read((char*)&storedZ, sizeof(storedZ));
+        in.read((char*)&storedTargets, sizeof(storedTargets));
+        if(!in || storedX != cellsX || storedZ != cellsZ)
+            return false;
+        targetCount = storedTargets;
+        words = (targetCount + 63) / 64;
+        bits.resize(cellsX * cellsZ * words);
+        if(!bits.empty())
+            in.read((char*)&bits[0], bits.size() * sizeof(uint64_t));
+        if(!in)
+        {
+            bits.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void Save(const string &path, uint64_t signature) const
+    {
+        std::ofstream out;
+        if(!CreateBakeCache(out, path, "PVS1", signature))
+            return;
+        out.write((const char*)&cellsX, sizeof(cellsX));
+        out.write((const char*)&cellsZ, sizeof(cellsZ));
+        out.write((const char*)&targetCount, sizeof(targetCount));
+        if(!bits.empty())
+            out.write((const char*)&bits[0], bits.size() * sizeof(uint64_t));
+    }
+
+    // the view cell a point is in, -1 outside the baked area (nothing is known there, so everything counts as visible)
+    int CellAt(const glm::vec3 &position) const
+    {
+        if(bits.empty() || position.x < min.x || position.y < min.y || position.z < min.z ||
+           position.x >= max.x || position.y >= max.y || position.z >= max.z)
+            return -1;
+        int x = std::min((int)((position.x - min.x) / cellSize), cellsX - 1);
+        int z = std::min((int)((position.z - min.z) / cellSize), cellsZ - 1);
+        return z * cellsX + x;
+    }
+
+    bool Visible(int cell, unsigned int target) const
+    {
+        return (bits[cell * words + target / 64] >> (target % 64)) & 1;
+    }
+
+    unsigned int VisibleCount(int cell) const
+    {
+        unsigned int count = 0;
+        for(unsigned int t = 0; t < targetCount; t++)
+            count += Visible(cell, t);
+        return count;
+    }
+
+    unsigned int CellCount() const { return cellsX * cellsZ; }
+    unsigned int TargetCount() const { return targetCount; }
+    float BakeMilliseconds() const { return bakeMs; }
+
+private:
+    glm::vec3 min, max;
+    float cellSize;
+    int cellsX, cellsZ;
+    unsigned int targetCount = 0;
+    unsigned int words = 0;
+    // cell c owns words [c * words, (c + 1) * words), bit t of those is target t
+    vector<uint64_t> bits;
+    float bakeMs = 0.0f;
+
+    // xorshift, seeded per cell so a bake gives the same result whatever the thread count
+    static float random(uint32_t &state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static glm::vec3 randomPoint(const glm::vec3 &boxMin, const glm::vec3 &boxMax, uint32_t &state)
+    {
+        float x = random(state);
+        float y = random(state);
+        float z = random(state);
+        return boxMin + (boxMax - boxMin) * glm::vec3(x, y, z);
+    }
+
+    // Moller-Trumbore against every triangle, only hits strictly between the two points count
+    static bool segmentBlocked(const glm::vec3 &from, const glm::vec3 &to, const vector<glm::vec3> &triangles)
+    {
+        glm::vec3 direction = to - from;
+        for(unsigned int i = 0; i + 2 < triangles.size(); i += 3)
+        {
+            glm::vec3 edge1 = triangles[i + 1] - triangles[i];
+            glm::vec3 edge2 = triangles[i + 2] - triangles[i];
+            glm::vec3 p = glm::cross(direction, edge2);
+            float determinant = glm::dot(edge1, p);
+            if(std::fabs(determinant) < 1e-8f)
+                continue;
+            float inverse = 1.0f / determinant;
+            glm::vec3 s = from - triangles[i];
+            float u = glm::dot(s, p) * inverse;
+            if(u < 0.0f || u > 1.0f)
+                continue;
+            glm::vec3 q = glm::cross(s, edge1);
+            float v = glm::dot(direction, q) * inverse;
+            if(v < 0.0f || u + v > 1.0f)
+                continue;
+            float t = glm::dot(edge2, q) * inverse;
+            if(t > 1e-4f && t < 1.0f - 1e-4f)
+                return true;
+        }
+        return false;
+    }
+
+    void bakeCell(int cell, const vector<glm::vec3> &triangles, const vector<glm::vec3> &targetMin, const vector<glm::vec3> &targetMax,
+                  unsigned int samples)
+    {
+        glm::vec3 cellMin(min.x + (cell % cellsX) * cellSize, min.y, min.z + (cell / cellsX) * cellSize);
+        glm::vec3 cellMax(cellMin.x + cellSize, max.y, cellMin.z + cellSize);
+        uint32_t state = 2654435761u * (cell + 1);
+        for(unsigned int t = 0; t < targetCount; t++)
+        {
+            // a target reaching into the cell is always visible from it
+            bool visible = targetMin[t].x <= cellMax.x && targetMax[t].x >= cellMin.x && targetMin[t].y <= cellMax.y &&
+                           targetMax[t].y >= cellMin.y && targetMin[t].z <= cellMax.z && targetMax[t].z >= cellMin.z;
+            for(unsigned int s = 0; s < samples && !visible; s++)
+                visible = !segmentBlocked(randomPoint(cellMin, cellMax, state), randomPoint(targetMin[t], targetMax[t], state), triangles);
+            if(visible)
+                bits[cell * words + t / 64] |= 1ULL << (t % 64);
+        }
+    }
+};
+#endif
@@ -0,0 +1,357 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+using namespace std;
+
+// passes are executed in this order, each one sets up its own depth/blend state
+enum RenderPass {
+    PASS_OPAQUE = 0,
+    PASS_SKY = 1,
+    PASS_TRANSPARENT = 2
+};
+
+// one draw collected for the frame. The queue only orders them and removes redundant program/VAO/material
+// binds, the draw callback does the actual GL draw (and sets its own per-draw uniforms).
+struct DrawPacket {
+    uint64_t key;
+    Shader *shader;
+    unsigned int VAO;
+    unsigned int materialId;
+    bool cullFace;
+    std::function<void()> bindMaterial; // may be empty
+    std::function<void()> draw;
+};
+
+// Draws that are recorded once and replayed every frame (static scenery), so their matrices, callbacks
+// and sort keys aren't rebuilt per frame. Each draw remembers the world position its depth is measured
+// from; RenderQueue re-keys and re-sorts the list only when the camera has moved.
+class DrawList
+{
+public:
+    void Clear()
+    {
+        packets.clear();
+        positions.clear();
+        fixedDepths.clear();
+        passes.clear();
+        enabled.clear();
+        dirty = true;
+    }
+
+    // depth of the draw is its distance from the camera. Returns the index of the draw in the list.
+    unsigned int Record(RenderPass pass, const glm::vec3 &position, Shader &shader, unsigned int VAO, unsigned int materialId, bool cullFace,
+                        std::function<void()> draw, std::function<void()> bindMaterial = std::function<void()>())
+    {
+        return record(pass, position, -1.0f, shader, VAO, materialId, cullFace, draw, bindMaterial);
+    }
+
+    // for draws without a meaningful position (ground plane, sky), depth never changes
+    unsigned int RecordAtDepth(RenderPass pass, float depth, Shader &shader, unsigned int VAO, unsigned int materialId, bool cullFace,
+                               std::function<void()> draw, std::function<void()> bindMaterial = std::function<void()>())
+    {
+        return record(pass, glm::vec3(0.0f), depth, shader, VAO, materialId, cullFace, draw, bindMaterial);
+    }
+
+    // disabled draws (e.g. culled this frame) stay in the list and keep their place in the order, they are just skipped
+    void SetEnabled(unsigned int draw, bool enable) { enabled[draw] = enable; }
+    bool Enabled(unsigned int draw) const { return enabled[draw]; }
+
+    unsigned int Size() const { return packets.size(); }
+
+private:
+    friend class RenderQueue;
+    vector<DrawPacket> packets;
+    vector<glm::vec3> positions;
+    vector<float> fixedDepths; // < 0 when the depth is measured from the position
+    vector<RenderPass> passes;
+    vector<unsigned char> enabled;
+    // sorted keys and the matching packet indices, valid while dirty is false
+    vector<uint64_t> keys;
+    vector<unsigned int> order;
+    glm::vec3 keyedFrom = glm::vec3(0.0f);
+    bool dirty = true;
+
+    unsigned int record(RenderPass pass, const glm::vec3 &position, float fixedDepth, Shader &shader, unsigned int VAO, unsigned int materialId,
+                bool cullFace, std::function<void()> &draw, std::function<void()> &bindMaterial)
+    {
+        DrawPacket packet;
+        packet.key = 0;
+        packet.shader = &shader;
+        packet.VAO = VAO;
+        packet.materialId = materialId;
+        packet.cullFace = cullFace;
+        packet.bindMaterial = bindMaterial;
+        packet.draw = draw;
+        packets.push_back(packet);
+        positions.push_back(position);
+        fixedDepths.push_back(fixedDepth);
+        passes.push_back(pass);
+        enabled.push_back(1);
+        dirty = true;
+        return packets.size() - 1;
+    }
+};
+
+// 64-bit sort key layout (most significant bits first):
+//   opaque:       pass(2) | depth bucket(4) | program(8) | material(12) | VAO(12) | depth(24) | 0(2)
+//   sky:          pass(2) | 0 ...
+//   transparent:  pass(2) | inverted depth(24) | program(8) | material(12) | VAO(12) | 0(6)
+// Opaque draws are grouped into 16 coarse distance buckets first so near objects fill the depth buffer early
+// (early-Z then rejects what is behind them), and only inside a bucket are they grouped by state.
+// Transparent draws have to be blended back to front, so depth comes before everything else there.
+class RenderQueue
+{
+public:
+    float farPlane = 100.0f;
+    // GL_LEQUAL when a depth pre-pass has already laid down the opaque depth
+    GLenum opaqueDepthFunc = GL_LESS;
+    // how far the camera can move before a retained DrawList is re-keyed
+    float rekeyDistance = 0.25f;
+
+    void Clear()
+    {
+        packets.clear();
+        lists.clear();
+    }
+
+    // depth is the view distance of the draw, clamped to [0, farPlane]
+    void Submit(RenderPass pass, float depth, Shader &shader, unsigned int VAO, unsigned int materialId, bool cullFace,
+                std::function<void()> draw, std::function<void()> bindMaterial = std::function<void()>())
+    {
+        DrawPacket packet;
+        packet.key = makeKey(pass, depth, shader.ID, materialId, VAO);
+        packet.shader = &shader;
+        packet.VAO = VAO;
+        packet.materialId = materialId;
+        packet.cullFace = cullFace;
+        packet.bindMaterial = bindMaterial;
+        packet.draw = draw;
+        packets.push_back(packet);
+    }
+
+    // adds a retained list to this frame. Its keys are only rebuilt when the list changed or the camera moved,
+    // otherwise the order from an earlier frame is reused as is.
+    void Submit(DrawList &list, const glm::vec3 &viewPos)
+    {
+        if(list.dirty || glm::length(viewPos - list.keyedFrom) > rekeyDistance)
+        {
+            list.keys.resize(list.packets.size());
+            for(unsigned int i = 0; i < list.packets.size(); i++)
+            {
+                float depth = list.fixedDepths[i] >= 0.0f ? list.fixedDepths[i] : glm::length(viewPos - list.positions[i]);
+                const DrawPacket &packet = list.packets[i];
+                list.keys[i] = makeKey(list.passes[i], depth, packet.shader->ID, packet.materialId, packet.VAO);
+            }
+            radixSort(list.keys, list.order);
+            list.keyedFrom = viewPos;
+            list.dirty = false;
+        }
+        lists.push_back(&list);
+    }
+
+    // sorts the packets submitted this frame, retained lists are already sorted
+    void Sort()
+    {
+        keys.resize(packets.size());
+        for(unsigned int i = 0; i < packets.size(); i++)
+            keys[i] = packets[i].key;
+        radixSort(keys, order);
+    }
+
+    // runs the sorted packets, changing GL state only when the next packet needs something different.
+    // This frame's packets and the retained lists are each sorted already, so they are merged on the fly.
+    // Only the passes first..last are run, so the caller can do its own work between passes.
+    void Execute(RenderPass first = PASS_OPAQUE, RenderPass last = PASS_TRANSPARENT)
+    {
+        int currentPass = -1;
+        unsigned int currentProgram = 0;
+        int currentVAO = -1;
+        int currentMaterial = -1;
+        int currentCull = -1;
+        if(first == PASS_OPAQUE)
+            stateChanges = 0;
+
+        // read position in every stream: 0 is this frame's packets, 1.. the retained lists
+        vector<unsigned int> heads(lists.size() + 1, 0);
+        while(true)
+        {
+            int stream = -1;
+            uint64_t key = 0;
+            if(heads[0] < order.size())
+            {
+                stream = 0;
+                key = keys[heads[0]];
+            }
+            for(unsigned int l = 0; l < lists.size(); l++)
+            {
+                if(heads[l + 1] < lists[l]->order.size() && (stream < 0 || lists[l]->keys[heads[l + 1]] < key))
+                {
+                    stream = l + 1;
+                    key = lists[l]->keys[heads[l + 1]];
+                }
+            }
+            if(stream < 0 || (int)(key >> 62) > last)
+                break;
+            if((int)(key >> 62) < first || (stream > 0 && !lists[stream - 1]->enabled[lists[stream - 1]->order[heads[stream]]]))
+            {
+                heads[stream]++;
+                continue;
+            }
+            DrawPacket &packet = stream == 0 ? packets[order[heads[0]]] : lists[stream - 1]->packets[lists[stream - 1]->order[heads[stream]]];
+            heads[stream]++;
+
+            int pass = (int)(key >> 62);
+            if(pass != currentPass)
+            {
+                beginPass((RenderPass)pass);
+                currentPass = pass;
+            }
+            if(packet.shader->ID != currentProgram)
+            {
+                packet.shader->use();
+                currentProgram = packet.shader->ID;
+                // material bindings set sampler uniforms of the program, so they don't carry over
+                currentMaterial = -1;
+                stateChanges++;
+            }
+            if((int)packet.VAO != currentVAO)
+            {
+                glBindVertexArray(packet.VAO);
+                currentVAO = packet.VAO;
+                stateChanges++;
+            }
+            if((int)packet.materialId != currentMaterial && packet.bindMaterial)
+            {
+                packet.bindMaterial();
+                currentMaterial = packet.materialId;
+                stateChanges++;
+            }
+            if((int)packet.cullFace != currentCull)
+            {
+                if(packet.cullFace)
+                    glEnable(GL_CULL_FACE);
+                else
+                    glDisable(GL_CULL_FACE);
+                currentCull = packet.cullFace;
+            }
+            packet.draw();
+        }
+
+        // leave the state the way the rest of main() expects it
+        glBindVertexArray(0);
+        glDisable(GL_CULL_FACE);
+        glDepthFunc(GL_LESS);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    unsigned int PacketCount() const
+    {
+        unsigned int count = packets.size();
+        for(unsigned int i = 0; i < lists.size(); i++)
+            count += lists[i]->packets.size();
+        return count;
+    }
+    unsigned int RetainedPacketCount() const { return PacketCount() - packets.size(); }
+    unsigned int StateChanges() const { return stateChanges; }
+
+private:
+    vector<DrawPacket> packets;
+    vector<uint64_t> keys;
+    vector<unsigned int> order;
+    vector<DrawList*> lists;
+    // scratch buffers of the radix sort
+    vector<uint64_t> keysTmp;
+    vector<unsigned int> orderTmp;
+    unsigned int stateChanges = 0;
+
+    void beginPass(RenderPass pass)
+    {
+        if(pass == PASS_SKY)
+        {
+            // the sky box is drawn at depth 1.0, behind everything already in the depth buffer
+            glDepthFunc(GL_LEQUAL);
+        }
+        else if(pass == PASS_OPAQUE)
+        {
+            glDepthFunc(opaqueDepthFunc);
+        }
+        else
+        {
+            glDepthFunc(GL_LESS);
+        }
+    }
+
+    uint64_t makeKey(RenderPass pass, float depth, unsigned int program, unsigned int material, unsigned int VAO) const
+    {
+        float d = std::min(std::max(depth / farPlane, 0.0f), 1.0f);
+        uint64_t depthBits = (uint64_t)(d * 16777215.0f); // 24 bits
+        uint64_t key = (uint64_t)pass << 62;
+        if(pass == PASS_OPAQUE)
+        {
+            // log-spaced buckets, so there is more resolution close to the camera where overdraw matters most
+            uint64_t bucket = (uint64_t)std::min(15.0f, std::log2(1.0f + depth));
+            key |= bucket << 58;
+            key |= (uint64_t)(program & 0xFF) << 50;
+            key |= (uint64_t)(material & 0xFFF) << 38;
+            key |= (uint64_t)(VAO & 0xFFF) << 26;
+            key |= depthBits << 2;
+        }
+        else if(pass == PASS_TRANSPARENT)
+        {
+            key |= (16777215ull - depthBits) << 38;
+            key |= (uint64_t)(program & 0xFF) << 30;
+            key |= (uint64_t)(material & 0xFFF) << 18;
+            key |= (uint64_t)(VAO & 0xFFF) << 6;
+        }
+        return key;
+    }
+
+    // LSD radix sort of the keys, 8 bits per pass, producing the sorted permutation in order.
+    // Passes where every key has the same byte are skipped, which with our key layout is most of them.
+    void radixSort(vector<uint64_t> &k, vector<unsigned int> &idx)
+    {
+        unsigned int n = k.size();
+        idx.resize(n);
+        for(unsigned int i = 0; i < n; i++)
+            idx[i] = i;
+        keysTmp.resize(n);
+        orderTmp.resize(n);
+
+        for(unsigned int shift = 0; shift < 64; shift += 8)
+        {
+            unsigned int count[256] = {0};
+            for(unsigned int i = 0; i < n; i++)
+                count[(k[i] >> shift) & 0xFF]++;
+            if(n == 0 || count[(k[0] >> shift) & 0xFF] == n)
+                continue;
+
+            unsigned int offset = 0;
+            for(unsigned int b = 0; b < 256; b++)
+            {
+                unsigned int c = count[b];
+                count[b] = offset;
+                offset += c;
+            }
+            for(unsigned int i = 0; i < n; i++)
+            {
+                unsigned int dst = count[(k[i] >> shift) & 0xFF]++;
+                keysTmp[dst] = k[i];
+                orderTmp[dst] = idx[i];
+            }
+            k.swap(keysTmp);
+            idx.swap(orderTmp);
+        }
+    }
+};
+#endif
@@ -45,9 +45,9 @@ public:
             // close file handlers
             vShaderFile.close();
             fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            // convert stream into string, with the files they include spliced in
+            vertexCode = resolveIncludes(vShaderStream.str(), vertexPath);
+            fragmentCode = resolveIncludes(fShaderStream.str(), fragmentPath);
             // if geometry shader path is present, also load a geometry shader
             if(geometryPath != nullptr)
             {
@@ -57,7 +57,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = resolveIncludes(gShaderStream.str(), geometryPath);
             }
         }
         catch (std::ifstream::failure& e)
@@ -168,7 +168,44 @@ public:
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
 
-private:
+protected:
+    // for programs built from other stages (ComputeShader), which compile themselves
+    Shader() : ID(0)
+    {
+    }
+
+    // replaces every #include "file" line with that file, looked up next to the shader including it. The #line
+    // after it keeps the compiler's line numbers those of the shader's own file
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(const std::string &source, const std::string &path)
+    {
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::istringstream lines(source);
+        std::stringstream result;
+        std::string line;
+        int lineNumber = 0;
+        while(std::getline(lines, line))
+        {
+            lineNumber++;
+            size_t open = line.find('"');
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if(line.compare(0, 8, "#include") != 0 || close == std::string::npos)
+            {
+                result << line << "\n";
+                continue;
+            }
+            std::string includePath = directory + line.substr(open + 1, close - open - 1);
+            std::ifstream includeFile(includePath.c_str());
+            if(!includeFile)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << includePath << std::endl;
+                continue;
+            }
+            result << includeFile.rdbuf() << "\n#line " << lineNumber + 1 << "\n";
+        }
+        return result.str();
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
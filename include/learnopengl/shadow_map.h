@@ -0,0 +1,195 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// texture units of the two directional shadow maps, after the light probes
+#define STATIC_SHADOW_UNIT 12
+#define DYNAMIC_SHADOW_UNIT 13
+
+// Shadows of the directional light, split by what moves: the static scene is rendered into a large depth map once
+// and only again after Invalidate() or a change of the light's direction, the dynamic casters go into a small map
+// every frame, fitted around just them. The lit shaders look both up and keep the darker of the two (ShadowFactor).
+// Both maps are orthographic from the light, fitted to the casters' box: a caster's shadow lies along the light
+// direction, which is the map's depth axis, so the casters' footprint covers their shadows too. Receivers only
+// extend the depth range; outside a map's footprint the border reads as lit.
+class DirectionalShadows
+{
+public:
+    struct Stats {
+        unsigned int staticRenders = 0;   // since the start, stays put while nothing static changes
+        unsigned int dynamicCasters = 0;  // draws of the last dynamic render
+        float staticMs = 0.0f;            // CPU time of the last static render
+        float dynamicMs = 0.0f;           // CPU time of the last dynamic render
+    };
+
+    // light space (projection * view) of the maps, for the lookup in the shaders
+    glm::mat4 staticLightSpace = glm::mat4(1.0f);
+    glm::mat4 dynamicLightSpace = glm::mat4(1.0f);
+
+    DirectionalShadows(unsigned int staticSize = 2048, unsigned int dynamicSize = 1024)
+        : staticSize(staticSize), dynamicSize(dynamicSize)
+    {
+        staticTexture = createMap(staticSize);
+        dynamicTexture = createMap(dynamicSize);
+        glGenFramebuffers(1, &FBO);
+    }
+
+    ~DirectionalShadows()
+    {
+        glDeleteTextures(1, &staticTexture);
+        glDeleteTextures(1, &dynamicTexture);
+        glDeleteFramebuffers(1, &FBO);
+    }
+
+    // the static map follows the light, it is redone on the next RenderStatic when the direction changes
+    void SetDirection(const glm::vec3 &lightDirection)
+    {
+        glm::vec3 d = glm::normalize(lightDirection);
+        if(d != direction)
+        {
+            direction = d;
+            staticDirty = true;
+        }
+    }
+
+    // a static prop was added, removed or moved
+    void Invalidate() { staticDirty = true; }
+    bool StaticDirty() const { return staticDirty; }
+
+    // renders the static map if it is out of date, draw gets the light space matrix and issues the depth-only draws.
+    // Returns whether it rendered. Leaves the framebuffer unbound (0), the caller rebinds its own.
+    bool RenderStatic(const glm::vec3 &casterMin, const glm::vec3 &casterMax, const glm::vec3 &receiverMin, const glm::vec3 &receiverMax,
+                      const std::function<void(const glm::mat4 &)> &draw)
+    {
+        if(!staticDirty)
+            return false;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        staticLightSpace = fit(casterMin, casterMax, receiverMin, receiverMax);
+        render(staticTexture, staticSize, staticLightSpace, draw);
+        staticDirty = false;
+        stats.staticRenders++;
+        stats.staticMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // renders the dynamic map around this frame's casters, casters is the number of draws issued (for the stats)
+    void RenderDynamic(const glm::vec3 &casterMin, const glm::vec3 &casterMax, const glm::vec3 &receiverMin, const glm::vec3 &receiverMax,
+                       unsigned int casters, const std::function<void(const glm::mat4 &)> &draw)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        dynamicLightSpace = fit(casterMin, casterMax, receiverMin, receiverMax);
+        render(dynamicTexture, dynamicSize, dynamicLightSpace, draw);
+        stats.dynamicCasters = casters;
+        stats.dynamicMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE0 + STATIC_SHADOW_UNIT);
+        glBindTexture(GL_TEXTURE_2D, staticTexture);
+        glActiveTexture(GL_TEXTURE0 + DYNAMIC_SHADOW_UNIT);
+        glBindTexture(GL_TEXTURE_2D, dynamicTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the shader has to be in use; the units never change, so this is done once at setup
+    static void SetSamplers(Shader &shader)
+    {
+        shader.setInt("staticShadowMap", STATIC_SHADOW_UNIT);
+        shader.setInt("dynamicShadowMap", DYNAMIC_SHADOW_UNIT);
+    }
+
+    // the shader has to be in use; the light spaces change, so this is called again after every render
+    void SetUniforms(Shader &shader) const
+    {
+        shader.setMat4("staticLightSpace", staticLightSpace);
+        shader.setMat4("dynamicLightSpace", dynamicLightSpace);
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    unsigned int staticSize, dynamicSize;
+    unsigned int staticTexture = 0;
+    unsigned int dynamicTexture = 0;
+    unsigned int FBO = 0;
+    glm::vec3 direction = glm::vec3(0.0f);
+    bool staticDirty = true;
+    Stats stats;
+
+    // 24 bit depth with hardware comparison: a filtered lookup in a sampler2DShadow gives 2x2 PCF for free
+    static unsigned int createMap(unsigned int size)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        // outside the footprint nothing casts, the border is the far plane
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        const float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    // orthographic light space around the casters' box, its depth range stretched over the receivers' box
+    glm::mat4 fit(const glm::vec3 &casterMin, const glm::vec3 &casterMax, const glm::vec3 &receiverMin, const glm::vec3 &receiverMax) const
+    {
+        glm::vec3 center = 0.5f * (casterMin + casterMax);
+        glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(center - direction, center, up);
+        glm::vec3 footprintMin(1e30f), footprintMax(-1e30f);
+        float farthest = -1e30f;
+        for(int i = 0; i < 8; i++)
+        {
+            glm::vec3 caster = glm::vec3(lightView * glm::vec4(i & 1 ? casterMax.x : casterMin.x, i & 2 ? casterMax.y : casterMin.y,
+                                                              i & 4 ? casterMax.z : casterMin.z, 1.0f));
+            glm::vec3 receiver = glm::vec3(lightView * glm::vec4(i & 1 ? receiverMax.x : receiverMin.x, i & 2 ? receiverMax.y : receiverMin.y,
+                                                                i & 4 ? receiverMax.z : receiverMin.z, 1.0f));
+            footprintMin = glm::min(footprintMin, caster);
+            footprintMax = glm::max(footprintMax, caster);
+            farthest = std::max(farthest, -receiver.z);
+        }
+        // the view looks down -z: the nearest caster is at -footprintMax.z
+        float nearPlane = -footprintMax.z - 0.1f;
+        float farPlane = std::max(farthest, -footprintMin.z) + 0.1f;
+        return glm::ortho(footprintMin.x, footprintMax.x, footprintMin.y, footprintMax.y, nearPlane, farPlane) * lightView;
+    }
+
+    void render(unsigned int texture, unsigned int size, const glm::mat4 &lightSpace, const std::function<void(const glm::mat4 &)> &draw)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // the sun is low, most receivers are at grazing angles: a slope scaled offset keeps them from shadowing themselves
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        draw(lightSpace);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+};
+#endif
@@ -0,0 +1,345 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/frustum.h>
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+using namespace std;
+
+// Loose uniform grid over the ground (xz) plane for lots of moving objects. An object lives in the cell of its
+// center; cells and 8x8 blocks of cells keep a box around everything they hold (it only grows until they are
+// emptied), so moving an object is O(1) and queries walk blocks -> cells -> objects, skipping whole blocks
+// outside the frustum and accepting blocks/cells fully inside it without testing their objects.
+class SpatialGrid
+{
+public:
+    struct Stats {
+        unsigned int moves = 0;
+        unsigned int cellChanges = 0;
+        unsigned int blocksVisited = 0;
+        unsigned int cellsVisited = 0;
+        unsigned int objectsTested = 0;
+        unsigned int objectsReturned = 0;
+    };
+
+    SpatialGrid(const glm::vec2 &min, const glm::vec2 &max, float cellSize)
+        : origin(min), cellSize(cellSize)
+    {
+        cellsX = std::max(1, (int)std::ceil((max.x - min.x) / cellSize));
+        cellsZ = std::max(1, (int)std::ceil((max.y - min.y) / cellSize));
+        blocksX = (cellsX + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        blocksZ = (cellsZ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        cells.resize(cellsX * cellsZ);
+        blocks.resize(blocksX * blocksZ);
+    }
+
+    // returns a handle for Move/Remove, userData is what queries return
+    unsigned int Insert(const glm::vec3 &center, float radius, unsigned int userData)
+    {
+        unsigned int handle;
+        if(!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        }
+        else
+        {
+            handle = objects.size();
+            objects.push_back(Object());
+        }
+        Object &object = objects[handle];
+        object.center = center;
+        object.radius = radius;
+        object.userData = userData;
+        object.alive = true;
+        addToCell(handle, cellOf(center));
+        return handle;
+    }
+
+    void Move(unsigned int handle, const glm::vec3 &center, float radius)
+    {
+        Object &object = objects[handle];
+        object.center = center;
+        object.radius = radius;
+        stats.moves++;
+        int cell = cellOf(center);
+        if(cell != object.cell)
+        {
+            removeFromCell(handle);
+            addToCell(handle, cell);
+            stats.cellChanges++;
+        }
+        else
+        {
+            grow(cell, center, radius);
+        }
+    }
+
+    void Remove(unsigned int handle)
+    {
+        if(!objects[handle].alive)
+            return;
+        removeFromCell(handle);
+        objects[handle].alive = false;
+        freeHandles.push_back(handle);
+    }
+
+    // appends the userData of every object whose sphere intersects the frustum
+    void QueryFrustum(const Frustum &frustum, vector<unsigned int> &result)
+    {
+        candidates.Clear();
+        candidateIds.clear();
+        for(unsigned int b = 0; b < blocks.size(); b++)
+        {
+            const Node &block = blocks[b];
+            if(block.count == 0)
+                continue;
+            stats.blocksVisited++;
+            FrustumTest blockTest = TestBox(frustum, block.boundsMin, block.boundsMax);
+            if(blockTest == FRUSTUM_OUTSIDE)
+                continue;
+
+            int bx = b % blocksX, bz = b / blocksX;
+            for(int z = bz * BLOCK_SIZE; z < std::min(cellsZ, (bz + 1) * BLOCK_SIZE); z++)
+            {
+                for(int x = bx * BLOCK_SIZE; x < std::min(cellsX, (bx + 1) * BLOCK_SIZE); x++)
+                {
+                    const Node &cell = cells[z * cellsX + x];
+                    if(cell.count == 0)
+                        continue;
+                    FrustumTest cellTest = blockTest;
+                    if(blockTest == FRUSTUM_INTERSECT)
+                    {
+                        stats.cellsVisited++;
+                        cellTest = TestBox(frustum, cell.boundsMin, cell.boundsMax);
+                    }
+                    if(cellTest == FRUSTUM_OUTSIDE)
+                        continue;
+                    for(unsigned int i = 0; i < cell.objects.size(); i++)
+                    {
+                        const Object &object = objects[cell.objects[i]];
+                        if(cellTest == FRUSTUM_INSIDE)
+                        {
+                            result.push_back(object.userData);
+                            stats.objectsReturned++;
+                        }
+                        else
+                        {
+                            // objects of cells on the frustum border are tested together with SSE below
+                            candidates.Add(object.center, object.radius);
+                            candidateIds.push_back(object.userData);
+                        }
+                    }
+                }
+            }
+        }
+        stats.objectsTested += candidates.Size();
+        CullSpheres(frustum, candidates, candidateVisible);
+        for(unsigned int i = 0; i < candidateIds.size(); i++)
+        {
+            if(candidateVisible[i])
+            {
+                result.push_back(candidateIds[i]);
+                stats.objectsReturned++;
+            }
+        }
+    }
+
+    // appends the userData of every object whose sphere intersects the query sphere
+    void QueryRadius(const glm::vec3 &center, float radius, vector<unsigned int> &result)
+    {
+        for(unsigned int b = 0; b < blocks.size(); b++)
+        {
+            const Node &block = blocks[b];
+            if(block.count == 0)
+                continue;
+            stats.blocksVisited++;
+            if(!sphereTouchesBox(center, radius, block.boundsMin, block.boundsMax))
+                continue;
+            int bx = b % blocksX, bz = b / blocksX;
+            for(int z = bz * BLOCK_SIZE; z < std::min(cellsZ, (bz + 1) * BLOCK_SIZE); z++)
+            {
+                for(int x = bx * BLOCK_SIZE; x < std::min(cellsX, (bx + 1) * BLOCK_SIZE); x++)
+                {
+                    const Node &cell = cells[z * cellsX + x];
+                    if(cell.count == 0)
+                        continue;
+                    stats.cellsVisited++;
+                    if(!sphereTouchesBox(center, radius, cell.boundsMin, cell.boundsMax))
+                        continue;
+                    for(unsigned int i = 0; i < cell.objects.size(); i++)
+                    {
+                        const Object &object = objects[cell.objects[i]];
+                        stats.objectsTested++;
+                        float reach = radius + object.radius;
+                        glm::vec3 d = object.center - center;
+                        if(glm::dot(d, d) <= reach * reach)
+                        {
+                            result.push_back(object.userData);
+                            stats.objectsReturned++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void ResetStats() { stats = Stats(); }
+    const Stats &GetStats() const { return stats; }
+    unsigned int Size() const { return objects.size() - freeHandles.size(); }
+
+private:
+    static const int BLOCK_SIZE = 8;
+
+    struct Object {
+        glm::vec3 center;
+        float radius;
+        unsigned int userData;
+        int cell;
+        unsigned int slot; // index in the cell's object list
+        bool alive;
+    };
+    // a cell or a block of cells
+    struct Node {
+        vector<unsigned int> objects; // only used by cells
+        unsigned int count = 0;
+        glm::vec3 boundsMin = glm::vec3(1e30f);
+        glm::vec3 boundsMax = glm::vec3(-1e30f);
+    };
+
+    glm::vec2 origin;
+    float cellSize;
+    int cellsX, cellsZ;
+    int blocksX, blocksZ;
+    vector<Node> cells;
+    vector<Node> blocks;
+    vector<Object> objects;
+    vector<unsigned int> freeHandles;
+    Stats stats;
+
+    // scratch of QueryFrustum
+    SphereBatch candidates;
+    vector<unsigned int> candidateIds;
+    vector<unsigned char> candidateVisible;
+
+    // objects outside the grid go into the border cells, the loose bounds still cover them
+    int cellOf(const glm::vec3 &center) const
+    {
+        int x = std::min(std::max((int)std::floor((center.x - origin.x) / cellSize), 0), cellsX - 1);
+        int z = std::min(std::max((int)std::floor((center.z - origin.y) / cellSize), 0), cellsZ - 1);
+        return z * cellsX + x;
+    }
+
+    int blockOf(int cell) const
+    {
+        return (cell / cellsX / BLOCK_SIZE) * blocksX + (cell % cellsX) / BLOCK_SIZE;
+    }
+
+    void grow(int cell, const glm::vec3 &center, float radius)
+    {
+        glm::vec3 reach(radius);
+        Node &c = cells[cell];
+        c.boundsMin = glm::min(c.boundsMin, center - reach);
+        c.boundsMax = glm::max(c.boundsMax, center + reach);
+        Node &b = blocks[blockOf(cell)];
+        b.boundsMin = glm::min(b.boundsMin, center - reach);
+        b.boundsMax = glm::max(b.boundsMax, center + reach);
+    }
+
+    void addToCell(unsigned int handle, int cell)
+    {
+        Object &object = objects[handle];
+        object.cell = cell;
+        object.slot = cells[cell].objects.size();
+        cells[cell].objects.push_back(handle);
+        cells[cell].count++;
+        blocks[blockOf(cell)].count++;
+        grow(cell, object.center, object.radius);
+    }
+
+    void removeFromCell(unsigned int handle)
+    {
+        Object &object = objects[handle];
+        Node &cell = cells[object.cell];
+        // swap with the last object of the cell
+        unsigned int last = cell.objects.back();
+        cell.objects[object.slot] = last;
+        objects[last].slot = object.slot;
+        cell.objects.pop_back();
+        cell.count--;
+        if(cell.count == 0)
+        {
+            cell.boundsMin = glm::vec3(1e30f);
+            cell.boundsMax = glm::vec3(-1e30f);
+        }
+        Node &block = blocks[blockOf(object.cell)];
+        block.count--;
+        if(block.count == 0)
+        {
+            block.boundsMin = glm::vec3(1e30f);
+            block.boundsMax = glm::vec3(-1e30f);
+        }
+    }
+
+    static bool sphereTouchesBox(const glm::vec3 &center, float radius, const glm::vec3 &min, const glm::vec3 &max)
+    {
+        glm::vec3 d = center - glm::clamp(center, min, max);
+        return glm::dot(d, d) <= radius * radius;
+    }
+};
+
+// Inserts, moves and frustum-queries 1k, 10k and 100k random objects on the 120x120 ground and prints the timings,
+// next to a brute force CullSpheres over all objects for comparison.
+inline void BenchmarkSpatialGrid(const Frustum &frustum)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coordinate(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+    unsigned int counts[] = {1000, 10000, 100000};
+
+    for(unsigned int count : counts)
+    {
+        SpatialGrid grid(glm::vec2(-60.0f), glm::vec2(60.0f), 4.0f);
+        vector<glm::vec3> positions(count);
+        vector<unsigned int> handles(count);
+        for(unsigned int i = 0; i < count; i++)
+            positions[i] = glm::vec3(coordinate(rng), 0.5f, coordinate(rng));
+
+        Clock::time_point start = Clock::now();
+        for(unsigned int i = 0; i < count; i++)
+            handles[i] = grid.Insert(positions[i], 0.5f, i);
+        Clock::time_point inserted = Clock::now();
+        for(unsigned int i = 0; i < count; i++)
+        {
+            positions[i] += glm::vec3(step(rng), 0.0f, step(rng));
+            grid.Move(handles[i], positions[i], 0.5f);
+        }
+        Clock::time_point moved = Clock::now();
+        vector<unsigned int> result;
+        grid.QueryFrustum(frustum, result);
+        Clock::time_point queried = Clock::now();
+
+        SphereBatch all;
+        for(unsigned int i = 0; i < count; i++)
+            all.Add(positions[i], 0.5f);
+        vector<unsigned char> visible;
+        Clock::time_point bruteStart = Clock::now();
+        unsigned int bruteVisible = CullSpheres(frustum, all, visible);
+        Clock::time_point bruteEnd = Clock::now();
+
+        typedef std::chrono::duration<double, std::milli> Ms;
+        std::cout << "SpatialGrid " << count << " objects: insert " << Ms(inserted - start).count()
+                  << " ms, move " << Ms(moved - inserted).count()
+                  << " ms, frustum query " << Ms(queried - moved).count() << " ms (" << result.size() << " visible, "
+                  << grid.GetStats().objectsTested << " tested), brute force " << Ms(bruteEnd - bruteStart).count()
+                  << " ms (" << bruteVisible << " visible)" << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,388 @@
+#ifndef SPECULAR_IBL_H
+#define SPECULAR_IBL_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <learnopengl/spherical_harmonics.h>
+#include <learnopengl/bake_cache.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// texture units of the split-sum lookups, in the gap below the lightmaps
+#define BRDF_LUT_UNIT 4
+#define PREFILTERED_SKY_UNIT 5
+
+// The two precomputed halves of the split-sum approximation of image based specular light (Karis, "Real Shading in
+// Unreal Engine 4"): a 2D table of the GGX BRDF integrated over the hemisphere as scale and bias of F0, by NdotV and
+// roughness, and the sky cube map prefiltered with the GGX lobe, one roughness per mip level. A fragment then gets
+// its specular sky light from one trilinear cube fetch and one table fetch.
+// Both are baked on the CPU at load time, on all cores, and cached on disk like the PVS: only baked again when the
+// sky or the parameters change.
+class SpecularIbl
+{
+public:
+    unsigned int lutTexture = 0;
+    unsigned int skyTexture = 0;
+
+    SpecularIbl(unsigned int lutSize = 128, unsigned int skySize = 128, unsigned int skyLevels = 6, unsigned int samples = 256)
+        : lutSize(lutSize), skySize(skySize), skyLevels(skyLevels), samples(samples)
+    {
+    }
+
+    ~SpecularIbl()
+    {
+        glDeleteTextures(1, &lutTexture);
+        glDeleteTextures(1, &skyTexture);
+    }
+
+    // identifies what a bake was made from: sizes, sample count and the sky's pixels
+    uint64_t Signature(const CubemapPixels &pixels) const
+    {
+        uint64_t hash = BAKE_SIGNATURE_SEED;
+        unsigned int parameters[5] = {lutSize, skySize, skyLevels, samples, (unsigned int)pixels.size};
+        hash = BakeSignature(hash, parameters, sizeof(parameters));
+        for(unsigned int face = 0; face < 6; face++)
+            if(!pixels.faces[face].empty())
+                hash = BakeSignature(hash, &pixels.faces[face][0], pixels.faces[face].size());
+        return hash;
+    }
+
+    // bakes the BRDF table and every level of the prefiltered sky, a row at a time per thread
+    void Bake(const CubemapPixels &pixels, unsigned int threadCount = 0)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if(threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        buildSource(pixels);
+        allocate();
+
+        // a job is a row of the table or a row of one face of one level
+        vector<unsigned int> jobLevel, jobFace, jobRow;
+        for(unsigned int y = 0; y < lutSize; y++)
+        {
+            jobLevel.push_back(0); jobFace.push_back(6); jobRow.push_back(y);
+        }
+        for(unsigned int level = 0; level < skyLevels; level++)
+            for(unsigned int face = 0; face < 6; face++)
+                for(unsigned int y = 0; y < levelSize(level); y++)
+                {
+                    jobLevel.push_back(level); jobFace.push_back(face); jobRow.push_back(y);
+                }
+        std::atomic<int> nextJob(0);
+        vector<std::thread> workers;
+        for(unsigned int t = 0; t < threadCount; t++)
+        {
+            workers.push_back(std::thread([&]() {
+                for(int job = nextJob++; job < (int)jobRow.size(); job = nextJob++)
+                {
+                    if(jobFace[job] == 6)
+                        lutRow(jobRow[job]);
+                    else
+                        skyRow(jobLevel[job], jobFace[job], jobRow[job]);
+                }
+            }));
+        }
+        for(unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+        source.clear();
+        bakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    bool Load(const string &path, uint64_t signature)
+    {
+        std::ifstream in;
+        if(!OpenBakeCache(in, path, "IBL1", signature))
+            return false;
+        allocate();
+        in.read((char*)&lut[0], lut.size() * sizeof(glm::vec2));
+        for(unsigned int level = 0; level < skyLevels; level++)
+            for(unsigned int face = 0; face < 6; face++)
+                in.read((char*)&sky[level][face][0], sky[level][face].size() * sizeof(glm::vec3));
+        if(!in)
+        {
+            lut.clear();
+            sky.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void Save(const string &path, uint64_t signature) const
+    {
+        std::ofstream out;
+        if(!CreateBakeCache(out, path, "IBL1", signature))
+            return;
+        out.write((const char*)&lut[0], lut.size() * sizeof(glm::vec2));
+        for(unsigned int level = 0; level < skyLevels; level++)
+            for(unsigned int face = 0; face < 6; face++)
+                out.write((const char*)&sky[level][face][0], sky[level][face].size() * sizeof(glm::vec3));
+    }
+
+    // creates the textures from a bake or a load, the CPU copies are dropped afterwards
+    void Upload()
+    {
+        if(lutTexture == 0)
+            glGenTextures(1, &lutTexture);
+        glBindTexture(GL_TEXTURE_2D, lutTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, lutSize, lutSize, 0, GL_RG, GL_FLOAT, &lut[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if(skyTexture == 0)
+            glGenTextures(1, &skyTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, skyTexture);
+        for(unsigned int level = 0; level < skyLevels; level++)
+            for(unsigned int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, levelSize(level), levelSize(level), 0, GL_RGB, GL_FLOAT,
+                             &sky[level][face][0]);
+        // the shader picks the level from the roughness, trilinear between them; seamless filtering is enabled globally
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, skyLevels - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        vector<glm::vec2>().swap(lut);
+        sky.clear();
+    }
+
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE0 + BRDF_LUT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, lutTexture);
+        glActiveTexture(GL_TEXTURE0 + PREFILTERED_SKY_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, skyTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the shader has to be in use
+    void SetUniforms(Shader &shader) const
+    {
+        shader.setInt("brdfLut", BRDF_LUT_UNIT);
+        shader.setInt("prefilteredSky", PREFILTERED_SKY_UNIT);
+        shader.setFloat("prefilteredSkyLevels", (float)skyLevels);
+    }
+
+    float BakeMilliseconds() const { return bakeMs; }
+
+    // i-th of n points of the Hammersley set, well spread over the unit square
+    static glm::vec2 Hammersley(unsigned int i, unsigned int n)
+    {
+        uint32_t bits = i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return glm::vec2((float)i / n, bits * 2.3283064365386963e-10f);
+    }
+
+    // a half vector around n, distributed like the GGX normal distribution of this roughness
+    static glm::vec3 ImportanceSampleGgx(const glm::vec2 &xi, const glm::vec3 &n, float roughness)
+    {
+        float a = roughness * roughness;
+        float phi = 2.0f * 3.141593f * xi.x;
+        float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        glm::vec3 up = std::fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+        glm::vec3 bitangent = glm::cross(n, tangent);
+        return glm::normalize(tangent * (std::cos(phi) * sinTheta) + bitangent * (std::sin(phi) * sinTheta) + n * cosTheta);
+    }
+
+    // scale and bias of F0 of the specular BRDF integrated over the hemisphere, the geometry term with the k of IBL
+    static glm::vec2 IntegrateBrdf(float NdotV, float roughness, unsigned int samples)
+    {
+        glm::vec3 V(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+        glm::vec3 N(0.0f, 0.0f, 1.0f);
+        float k = roughness * roughness / 2.0f;
+        float scale = 0.0f, bias = 0.0f;
+        for(unsigned int i = 0; i < samples; i++)
+        {
+            glm::vec3 H = ImportanceSampleGgx(Hammersley(i, samples), N, roughness);
+            glm::vec3 L = 2.0f * glm::dot(V, H) * H - V;
+            float NdotL = std::max(L.z, 0.0f);
+            if(NdotL <= 0.0f)
+                continue;
+            float NdotH = std::max(H.z, 0.0f);
+            float VdotH = std::max(glm::dot(V, H), 0.0f);
+            float G = NdotV / (NdotV * (1.0f - k) + k) * NdotL / (NdotL * (1.0f - k) + k);
+            float visibility = G * VdotH / (NdotH * NdotV);
+            float fresnel = std::pow(1.0f - VdotH, 5.0f);
+            scale += (1.0f - fresnel) * visibility;
+            bias += fresnel * visibility;
+        }
+        return glm::vec2(scale, bias) / (float)samples;
+    }
+
+private:
+    unsigned int lutSize, skySize, skyLevels, samples;
+    float bakeMs = 0.0f;
+    vector<glm::vec2> lut;
+    // sky[level][face], rows as GL stores them
+    vector<vector<vector<glm::vec3> > > sky;
+    // the linear sky as a pyramid, source[level][face], for the bake only
+    vector<vector<vector<glm::vec3> > > source;
+    unsigned int sourceSize = 0;
+
+    unsigned int levelSize(unsigned int level) const { return std::max(1u, skySize >> level); }
+
+    void allocate()
+    {
+        lut.assign(lutSize * lutSize, glm::vec2(0.0f));
+        sky.assign(skyLevels, vector<vector<glm::vec3> >());
+        for(unsigned int level = 0; level < skyLevels; level++)
+        {
+            sky[level].resize(6);
+            for(unsigned int face = 0; face < 6; face++)
+                sky[level][face].assign(levelSize(level) * levelSize(level), glm::vec3(0.0f));
+        }
+    }
+
+    // linear radiance, box filtered down to at most twice the output size (more detail would only be averaged away)
+    // and from there halved down to 1x1, so a sample can read the level that matches its solid angle
+    void buildSource(const CubemapPixels &pixels)
+    {
+        float linear[256];
+        for(unsigned int i = 0; i < 256; i++)
+            linear[i] = std::pow(i / 255.0f, 2.2f);
+        int step = 1;
+        while(pixels.size / step > 2 * (int)skySize && (pixels.size / step) % 2 == 0)
+            step *= 2;
+        sourceSize = std::max(1, pixels.size / step);
+        source.clear();
+        source.resize(1);
+        source[0].resize(6);
+        for(unsigned int face = 0; face < 6; face++)
+        {
+            vector<glm::vec3> &base = source[0][face];
+            base.assign(sourceSize * sourceSize, glm::vec3(0.0f));
+            if(pixels.faces[face].empty())
+                continue;
+            for(unsigned int y = 0; y < sourceSize * step; y++)
+                for(unsigned int x = 0; x < sourceSize * step; x++)
+                {
+                    const unsigned char *p = &pixels.faces[face][3 * (y * pixels.size + x)];
+                    base[(y / step) * sourceSize + x / step] += glm::vec3(linear[p[0]], linear[p[1]], linear[p[2]]);
+                }
+            for(unsigned int i = 0; i < base.size(); i++)
+                base[i] /= (float)(step * step);
+        }
+        for(unsigned int size = sourceSize / 2; size >= 1; size /= 2)
+        {
+            const vector<vector<glm::vec3> > &finer = source.back();
+            vector<vector<glm::vec3> > coarser(6);
+            for(unsigned int face = 0; face < 6; face++)
+            {
+                coarser[face].resize(size * size);
+                for(unsigned int y = 0; y < size; y++)
+                    for(unsigned int x = 0; x < size; x++)
+                    {
+                        const unsigned int f = 2 * size;
+                        coarser[face][y * size + x] = 0.25f * (finer[face][2 * y * f + 2 * x] + finer[face][2 * y * f + 2 * x + 1] +
+                                                               finer[face][(2 * y + 1) * f + 2 * x] + finer[face][(2 * y + 1) * f + 2 * x + 1]);
+                    }
+            }
+            source.push_back(coarser);
+        }
+    }
+
+    // nearest texel of a source level in a direction
+    glm::vec3 fetch(const glm::vec3 &direction, unsigned int level) const
+    {
+        glm::vec3 a = glm::abs(direction);
+        unsigned int face;
+        float ma;
+        if(a.x >= a.y && a.x >= a.z) { face = direction.x > 0.0f ? 0 : 1; ma = a.x; }
+        else if(a.y >= a.z)          { face = direction.y > 0.0f ? 2 : 3; ma = a.y; }
+        else                         { face = direction.z > 0.0f ? 4 : 5; ma = a.z; }
+        glm::vec3 S, T, N;
+        CubeFaceAxes(face, S, T, N);
+        int size = std::max(1u, sourceSize >> level);
+        int x = std::min(size - 1, std::max(0, (int)((glm::dot(direction, S) / ma + 1.0f) * 0.5f * size)));
+        int y = std::min(size - 1, std::max(0, (int)((glm::dot(direction, T) / ma + 1.0f) * 0.5f * size)));
+        return source[level][face][y * size + x];
+    }
+
+    // the source between its two nearest levels
+    glm::vec3 sample(const glm::vec3 &direction, float lod) const
+    {
+        lod = std::min(std::max(lod, 0.0f), (float)(source.size() - 1));
+        unsigned int lower = (unsigned int)lod;
+        unsigned int upper = std::min(lower + 1, (unsigned int)source.size() - 1);
+        float t = lod - lower;
+        return fetch(direction, lower) * (1.0f - t) + fetch(direction, upper) * t;
+    }
+
+    void lutRow(unsigned int y)
+    {
+        float roughness = (y + 0.5f) / lutSize;
+        for(unsigned int x = 0; x < lutSize; x++)
+            lut[y * lutSize + x] = IntegrateBrdf((x + 0.5f) / lutSize, roughness, samples);
+    }
+
+    // level 0 is the sky itself (roughness 0), the others convolve it with the GGX lobe of level / (levels - 1),
+    // assuming N = V = R as the split sum does
+    void skyRow(unsigned int level, unsigned int face, unsigned int y)
+    {
+        glm::vec3 S, T, F;
+        CubeFaceAxes(face, S, T, F);
+        const unsigned int size = levelSize(level);
+        const float texel = 2.0f / size;
+        const float roughness = skyLevels > 1 ? (float)level / (skyLevels - 1) : 0.0f;
+        // solid angle of a texel of the finest source level, at the cube's center
+        const float sourceTexel = 4.0f * 3.141593f / (6.0f * sourceSize * sourceSize);
+        const float outputLod = std::log(std::max(1.0f, (float)sourceSize / size)) / std::log(2.0f);
+        float t = (y + 0.5f) * texel - 1.0f;
+        for(unsigned int x = 0; x < size; x++)
+        {
+            float s = (x + 0.5f) * texel - 1.0f;
+            glm::vec3 N = glm::normalize(s * S + t * T + F);
+            if(level == 0)
+            {
+                sky[level][face][y * size + x] = sample(N, outputLod);
+                continue;
+            }
+            glm::vec3 sum(0.0f);
+            float weight = 0.0f;
+            for(unsigned int i = 0; i < samples; i++)
+            {
+                glm::vec3 H = ImportanceSampleGgx(Hammersley(i, samples), N, roughness);
+                glm::vec3 L = 2.0f * glm::dot(N, H) * H - N;
+                float NdotL = glm::dot(N, L);
+                if(NdotL <= 0.0f)
+                    continue;
+                // a sample stands for 1 / (samples * pdf) of the sphere: it reads the level with texels that large,
+                // which keeps bright spots of the sky from turning into noise (GPU Gems 3, ch. 20)
+                float NdotH = std::max(glm::dot(N, H), 0.0f);
+                float a2 = roughness * roughness * roughness * roughness;
+                float d = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+                float D = a2 / (3.141593f * d * d);
+                float pdf = D / 4.0f + 0.0001f;
+                float sampleAngle = 1.0f / (samples * pdf);
+                float lod = std::max(outputLod, 0.5f * std::log(sampleAngle / sourceTexel) / std::log(2.0f) + 1.0f);
+                sum += sample(L, lod) * NdotL;
+                weight += NdotL;
+            }
+            sky[level][face][y * size + x] = weight > 0.0f ? sum / weight : glm::vec3(0.0f);
+        }
+    }
+};
+#endif
@@ -0,0 +1,280 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SH_SSE 1
+#endif
+using namespace std;
+
+#define SH_COEFFICIENTS 9
+
+// L2 spherical harmonics (9 RGB coefficients) of an irradiance function over the sphere of normals: the light
+// arriving from every direction is already convolved with the cosine lobe, so evaluating at a normal gives what
+// a diffuse surface facing that way receives. Basis order and constants are the usual real ones, the shaders
+// evaluating the coefficients (ShIrradiance) use the same.
+struct SphericalHarmonics
+{
+    glm::vec3 c[SH_COEFFICIENTS];
+
+    SphericalHarmonics()
+    {
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            c[i] = glm::vec3(0.0f);
+    }
+
+    static void Basis(const glm::vec3 &d, float *y)
+    {
+        y[0] = 0.282095f;
+        y[1] = 0.488603f * d.y;
+        y[2] = 0.488603f * d.z;
+        y[3] = 0.488603f * d.x;
+        y[4] = 1.092548f * d.x * d.y;
+        y[5] = 1.092548f * d.y * d.z;
+        y[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+        y[7] = 1.092548f * d.x * d.z;
+        y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+    }
+
+    // light of this intensity from one direction (normalized), as max(dot(n, direction), 0) * intensity
+    void AddDirectional(const glm::vec3 &direction, const glm::vec3 &intensity)
+    {
+        // cosine lobe convolution per band: pi, 2pi/3, pi/4
+        const float band[SH_COEFFICIENTS] = {3.141593f, 2.094395f, 2.094395f, 2.094395f,
+                                             0.785398f, 0.785398f, 0.785398f, 0.785398f, 0.785398f};
+        float y[SH_COEFFICIENTS];
+        Basis(direction, y);
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            c[i] += intensity * band[i] * y[i];
+    }
+
+    // the same irradiance whichever way the surface faces
+    void AddConstant(const glm::vec3 &irradiance)
+    {
+        c[0] += irradiance / 0.282095f;
+    }
+
+    glm::vec3 Evaluate(const glm::vec3 &normal) const
+    {
+        float y[SH_COEFFICIENTS];
+        Basis(normal, y);
+        glm::vec3 sum(0.0f);
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            sum += c[i] * y[i];
+        return glm::max(sum, glm::vec3(0.0f));
+    }
+
+    void Scale(float factor)
+    {
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            c[i] *= factor;
+    }
+
+    // irradiance averaged over all normals
+    glm::vec3 Average() const
+    {
+        return c[0] * 0.282095f;
+    }
+};
+
+// direction of face texel (s, t) in [-1, 1] is s * S + t * T + N, unnormalized (the GL cube map convention)
+inline void CubeFaceAxes(unsigned int face, glm::vec3 &S, glm::vec3 &T, glm::vec3 &N)
+{
+    const float axes[6][9] = {
+        { 0, 0,-1,   0,-1, 0,   1, 0, 0},
+        { 0, 0, 1,   0,-1, 0,  -1, 0, 0},
+        { 1, 0, 0,   0, 0, 1,   0, 1, 0},
+        { 1, 0, 0,   0, 0,-1,   0,-1, 0},
+        { 1, 0, 0,   0,-1, 0,   0, 0, 1},
+        {-1, 0, 0,   0,-1, 0,   0, 0,-1},
+    };
+    S = glm::vec3(axes[face][0], axes[face][1], axes[face][2]);
+    T = glm::vec3(axes[face][3], axes[face][4], axes[face][5]);
+    N = glm::vec3(axes[face][6], axes[face][7], axes[face][8]);
+}
+
+// the six faces of a cube map as RGB8, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, rows as GL stores them
+struct CubemapPixels
+{
+    int size = 0;
+    vector<unsigned char> faces[6];
+
+    // reads level 0 of a cube map texture back
+    static CubemapPixels Read(unsigned int cubemap)
+    {
+        CubemapPixels pixels;
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &pixels.size);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for(unsigned int i = 0; i < 6 && pixels.size > 0; i++)
+        {
+            pixels.faces[i].resize(3 * pixels.size * pixels.size);
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, GL_UNSIGNED_BYTE, &pixels.faces[i][0]);
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return pixels;
+    }
+};
+
+// Projects a cube map of (display encoded) radiance into the irradiance spherical harmonics it lights a surface
+// with. Every texel is weighted by the solid angle it covers; the SSE path takes four texels of a row at a time,
+// the scalar one is kept for the tail, for builds without SSE and as the reference of the benchmark.
+class CubemapProjection
+{
+public:
+    static SphericalHarmonics Project(const CubemapPixels &pixels, bool simd = true)
+    {
+        float linear[256];
+        for(unsigned int i = 0; i < 256; i++)
+            linear[i] = std::pow(i / 255.0f, 2.2f);
+        float sums[3 * SH_COEFFICIENTS] = {0.0f};
+        float totalWeight = 0.0f;
+        for(unsigned int face = 0; face < 6 && pixels.size > 0; face++)
+            totalWeight += projectFace(pixels, face, linear, sums, simd);
+
+        // the texel weights only approximate the sphere, they are made to add up to 4 pi exactly
+        SphericalHarmonics radiance;
+        float normalize = totalWeight > 0.0f ? 4.0f * 3.141593f / totalWeight : 0.0f;
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            radiance.c[i] = glm::vec3(sums[3 * i], sums[3 * i + 1], sums[3 * i + 2]) * normalize;
+        // radiance to irradiance: the cosine lobe per band
+        const float band[SH_COEFFICIENTS] = {3.141593f, 2.094395f, 2.094395f, 2.094395f,
+                                             0.785398f, 0.785398f, 0.785398f, 0.785398f, 0.785398f};
+        for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+            radiance.c[i] *= band[i];
+        return radiance;
+    }
+
+private:
+    // adds one face into sums (coefficient-major, rgb), returns the solid angle it covered
+    static float projectFace(const CubemapPixels &pixels, unsigned int face, const float *linear, float *sums, bool simd)
+    {
+        glm::vec3 S, T, N;
+        CubeFaceAxes(face, S, T, N);
+        const int size = pixels.size;
+        const unsigned char *data = &pixels.faces[face][0];
+        const float texel = 2.0f / size;
+        const float area = texel * texel;
+        float totalWeight = 0.0f;
+        for(int y = 0; y < size; y++)
+        {
+            float t = (y + 0.5f) * texel - 1.0f;
+            int x = 0;
+#ifdef SH_SSE
+            if(simd)
+            {
+                __m128 acc[3 * SH_COEFFICIENTS];
+                for(unsigned int i = 0; i < 3 * SH_COEFFICIENTS; i++)
+                    acc[i] = _mm_setzero_ps();
+                __m128 weights = _mm_setzero_ps();
+                __m128 one = _mm_set1_ps(1.0f);
+                __m128 tt = _mm_set1_ps(t);
+                for(; x + 4 <= size; x += 4)
+                {
+                    __m128 ss = _mm_setr_ps((x + 0.5f) * texel - 1.0f, (x + 1.5f) * texel - 1.0f, (x + 2.5f) * texel - 1.0f, (x + 3.5f) * texel - 1.0f);
+                    __m128 dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ss, _mm_set1_ps(S.x)), _mm_mul_ps(tt, _mm_set1_ps(T.x))), _mm_set1_ps(N.x));
+                    __m128 dy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ss, _mm_set1_ps(S.y)), _mm_mul_ps(tt, _mm_set1_ps(T.y))), _mm_set1_ps(N.y));
+                    __m128 dz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ss, _mm_set1_ps(S.z)), _mm_mul_ps(tt, _mm_set1_ps(T.z))), _mm_set1_ps(N.z));
+                    // |direction| = sqrt(1 + s^2 + t^2), the texel's solid angle is area / |direction|^3
+                    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(ss, ss)), _mm_mul_ps(tt, tt))));
+                    __m128 weight = _mm_mul_ps(_mm_set1_ps(area), _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+                    weights = _mm_add_ps(weights, weight);
+                    dx = _mm_mul_ps(dx, inverseLength);
+                    dy = _mm_mul_ps(dy, inverseLength);
+                    dz = _mm_mul_ps(dz, inverseLength);
+
+                    __m128 basis[SH_COEFFICIENTS];
+                    basis[0] = _mm_set1_ps(0.282095f);
+                    basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), dy);
+                    basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), dz);
+                    basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), dx);
+                    basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dy));
+                    basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dy, dz));
+                    basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one));
+                    basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dz));
+                    basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+                    const unsigned char *p = data + 3 * (y * size + x);
+                    __m128 r = _mm_mul_ps(_mm_setr_ps(linear[p[0]], linear[p[3]], linear[p[6]], linear[p[9]]), weight);
+                    __m128 g = _mm_mul_ps(_mm_setr_ps(linear[p[1]], linear[p[4]], linear[p[7]], linear[p[10]]), weight);
+                    __m128 b = _mm_mul_ps(_mm_setr_ps(linear[p[2]], linear[p[5]], linear[p[8]], linear[p[11]]), weight);
+                    for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+                    {
+                        acc[3 * i] = _mm_add_ps(acc[3 * i], _mm_mul_ps(r, basis[i]));
+                        acc[3 * i + 1] = _mm_add_ps(acc[3 * i + 1], _mm_mul_ps(g, basis[i]));
+                        acc[3 * i + 2] = _mm_add_ps(acc[3 * i + 2], _mm_mul_ps(b, basis[i]));
+                    }
+                }
+                // one horizontal sum per row keeps the float error of the lanes small
+                float lanes[4];
+                for(unsigned int i = 0; i < 3 * SH_COEFFICIENTS; i++)
+                {
+                    _mm_storeu_ps(lanes, acc[i]);
+                    sums[i] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                }
+                _mm_storeu_ps(lanes, weights);
+                totalWeight += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            }
+#endif
+            // scalar tail (and the whole row without SSE)
+            for(; x < size; x++)
+            {
+                float s = (x + 0.5f) * texel - 1.0f;
+                float inverseLength = 1.0f / std::sqrt(1.0f + s * s + t * t);
+                float weight = area * inverseLength * inverseLength * inverseLength;
+                totalWeight += weight;
+                float basis[SH_COEFFICIENTS];
+                SphericalHarmonics::Basis((s * S + t * T + N) * inverseLength, basis);
+                const unsigned char *p = data + 3 * (y * size + x);
+                for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+                {
+                    sums[3 * i] += linear[p[0]] * weight * basis[i];
+                    sums[3 * i + 1] += linear[p[1]] * weight * basis[i];
+                    sums[3 * i + 2] += linear[p[2]] * weight * basis[i];
+                }
+            }
+        }
+        return totalWeight;
+    }
+};
+
+// Projects the cube map with the SSE and the scalar path a few times each and prints the timings and how far
+// apart the results are.
+inline void BenchmarkCubemapProjection(const CubemapPixels &pixels)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    typedef std::chrono::duration<double, std::milli> Ms;
+    const unsigned int runs = 5;
+    SphericalHarmonics results[2];
+    double ms[2];
+    for(unsigned int simd = 0; simd < 2; simd++)
+    {
+        Clock::time_point start = Clock::now();
+        for(unsigned int r = 0; r < runs; r++)
+            results[simd] = CubemapProjection::Project(pixels, simd == 1);
+        ms[simd] = Ms(Clock::now() - start).count() / runs;
+    }
+    float difference = 0.0f;
+    for(unsigned int i = 0; i < SH_COEFFICIENTS; i++)
+    {
+        glm::vec3 d = glm::abs(results[0].c[i] - results[1].c[i]);
+        difference = std::max(difference, std::max(d.x, std::max(d.y, d.z)));
+    }
+    std::cout << "Cube map SH projection, 6 x " << pixels.size << "x" << pixels.size << ": scalar " << ms[0] << " ms, ";
+#ifdef SH_SSE
+    std::cout << "SSE " << ms[1] << " ms (" << ms[0] / ms[1] << "x), largest coefficient difference " << difference << std::endl;
+#else
+    std::cout << "no SSE in this build" << std::endl;
+#endif
+}
+#endif
@@ -0,0 +1,266 @@
+#ifndef SSAO_H
+#define SSAO_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <functional>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+#define SSAO_KERNEL_SIZE 16
+// frames a timer query gets before its result is read, so reading it never waits on the GPU
+#define SSAO_TIMER_FRAMES 4
+
+// Screen-space ambient occlusion at a fraction of the screen resolution (half or quarter), from the depth the HDR
+// pass left. Four stages, each a full screen triangle at the reduced size:
+//   depth:     the closest depth of each block of screen texels, as linear view depth (R32F)
+//   occlusion: a hemisphere of samples around the normal rebuilt from that depth (RG16F: occlusion, view depth)
+//   blur:      separable, weighted down across depth edges so the noise is averaged only within a surface
+//   composite: done by the caller's final pass, which upsamples with depth-aware weights (see final_screen.fs)
+// The view depth rides along in the occlusion texture, so blur and upsample read one texel for both.
+// Every stage is timed with GPU timer queries, read back a few frames later.
+class ScreenSpaceAo
+{
+public:
+    struct Stats {
+        unsigned int width = 0, height = 0;
+        float depthMs = 0.0f;
+        float occlusionMs = 0.0f;
+        float blurMs = 0.0f;        // both directions
+        float compositeMs = 0.0f;   // the caller's final pass including the upsample
+    };
+
+    // the result, rg = (ambient visibility, view depth)
+    unsigned int texture = 0;
+
+    // view space reach of the samples, and how much nearer than the surface an occluder has to be
+    float radius = 0.5f;
+    float bias = 0.025f;
+    // occlusion curve exponent, and how strongly the blur and the upsample stop at depth edges
+    float power = 1.5f;
+    float sharpness = 40.0f;
+
+    ScreenSpaceAo(unsigned int screenWidth, unsigned int screenHeight, unsigned int scale = 2)
+        : screenWidth(screenWidth), screenHeight(screenHeight)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &emptyVAO);
+        glGenQueries(SSAO_STAGES * SSAO_TIMER_FRAMES, &timers[0][0]);
+        // a fixed set of samples in the unit hemisphere around +z, more of them close to the center
+        uint32_t state = 2463534242u;
+        for(unsigned int i = 0; i < SSAO_KERNEL_SIZE; i++)
+        {
+            glm::vec3 sample(random(state) * 2.0f - 1.0f, random(state) * 2.0f - 1.0f, random(state));
+            sample = glm::normalize(sample) * random(state);
+            float t = (float)i / SSAO_KERNEL_SIZE;
+            kernel[i] = sample * (0.1f + 0.9f * t * t);
+        }
+        SetScale(scale);
+    }
+
+    ~ScreenSpaceAo()
+    {
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &texture);
+        glDeleteTextures(1, &blurTexture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteQueries(SSAO_STAGES * SSAO_TIMER_FRAMES, &timers[0][0]);
+    }
+
+    // 2 for half, 4 for quarter resolution; the targets are made again when it changes
+    void SetScale(unsigned int newScale)
+    {
+        newScale = std::max(1u, newScale);
+        if(newScale == scale && texture != 0)
+            return;
+        scale = newScale;
+        width = std::max(1u, (screenWidth + scale - 1) / scale);
+        height = std::max(1u, (screenHeight + scale - 1) / scale);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &texture);
+        glDeleteTextures(1, &blurTexture);
+        depthTexture = createTarget(GL_R32F, GL_RED);
+        texture = createTarget(GL_RG16F, GL_RG);
+        blurTexture = createTarget(GL_RG16F, GL_RG);
+        stats.width = width;
+        stats.height = height;
+    }
+
+    unsigned int Scale() const { return scale; }
+
+    // runs the depth, occlusion and blur stages on sceneDepth (the HDR pass' depth texture) rendered with projection
+    // (a glm::perspective one). Leaves the framebuffer unbound (0) and restores the viewport, the caller rebinds its own.
+    void Render(unsigned int sceneDepth, const glm::mat4 &projection, Shader &depthShader, Shader &occlusionShader, Shader &blurShader)
+    {
+        frame = (frame + 1) % SSAO_TIMER_FRAMES;
+        collectTimers();
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glBindVertexArray(emptyVAO);
+        glViewport(0, 0, width, height);
+        glActiveTexture(GL_TEXTURE0);
+        // view depth from window depth: D = P[3][2] / (ndc z + P[2][2])
+        glm::vec2 depthParams(projection[2][2], projection[3][2]);
+
+        beginTimer(STAGE_DEPTH);
+        target(depthTexture);
+        depthShader.use();
+        depthShader.setInt("depthMap", 0);
+        depthShader.setInt("scale", scale);
+        depthShader.setVec2("depthParams", depthParams);
+        glBindTexture(GL_TEXTURE_2D, sceneDepth);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        endTimer(STAGE_DEPTH);
+
+        beginTimer(STAGE_OCCLUSION);
+        target(texture);
+        occlusionShader.use();
+        occlusionShader.setInt("viewDepth", 0);
+        occlusionShader.setMat4("projection", projection);
+        // view space extent of the image plane at depth 1
+        occlusionShader.setVec2("tanHalfFov", glm::vec2(1.0f / projection[0][0], 1.0f / projection[1][1]));
+        occlusionShader.setFloat("farPlane", depthParams.y / (1.0f + depthParams.x));
+        occlusionShader.setFloat("radius", radius);
+        occlusionShader.setFloat("bias", bias);
+        occlusionShader.setFloat("power", power);
+        glUniform3fv(glGetUniformLocation(occlusionShader.ID, "kernel"), SSAO_KERNEL_SIZE, &kernel[0].x);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        endTimer(STAGE_OCCLUSION);
+
+        beginTimer(STAGE_BLUR);
+        blurShader.use();
+        blurShader.setInt("occlusion", 0);
+        blurShader.setFloat("sharpness", sharpness);
+        target(blurTexture);
+        glUniform2i(glGetUniformLocation(blurShader.ID, "direction"), 1, 0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        target(texture);
+        glUniform2i(glGetUniformLocation(blurShader.ID, "direction"), 0, 1);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        endTimer(STAGE_BLUR);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_DEPTH_TEST);
+        if(blend)
+            glEnable(GL_BLEND);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // the shader has to be in use; the result and the full resolution depth go to these units
+    void SetCompositeUniforms(Shader &shader, unsigned int occlusionUnit, unsigned int depthUnit, const glm::mat4 &projection) const
+    {
+        shader.setInt("ssaoTexture", occlusionUnit);
+        shader.setInt("depthMap", depthUnit);
+        shader.setVec2("depthParams", glm::vec2(projection[2][2], projection[3][2]));
+        shader.setFloat("ssaoSharpness", sharpness);
+    }
+
+    // the caller's composite pass, timed as the last stage
+    void Composite(const std::function<void()> &draw)
+    {
+        beginTimer(STAGE_COMPOSITE);
+        draw();
+        endTimer(STAGE_COMPOSITE);
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    enum Stage {
+        STAGE_DEPTH,
+        STAGE_OCCLUSION,
+        STAGE_BLUR,
+        STAGE_COMPOSITE,
+        SSAO_STAGES
+    };
+
+    unsigned int screenWidth, screenHeight;
+    unsigned int scale = 0;
+    unsigned int width = 0, height = 0;
+    unsigned int depthTexture = 0;
+    unsigned int blurTexture = 0;
+    unsigned int FBO = 0;
+    unsigned int emptyVAO = 0;
+    glm::vec3 kernel[SSAO_KERNEL_SIZE];
+    unsigned int timers[SSAO_STAGES][SSAO_TIMER_FRAMES];
+    bool issued[SSAO_STAGES][SSAO_TIMER_FRAMES] = {};
+    unsigned int frame = 0;
+    Stats stats;
+
+    // nearest: the shaders mostly read texel for texel, and the occlusion samples must not mix depths across edges
+    unsigned int createTarget(GLenum internalFormat, GLenum format) const
+    {
+        unsigned int target;
+        glGenTextures(1, &target);
+        glBindTexture(GL_TEXTURE_2D, target);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return target;
+    }
+
+    void target(unsigned int texture)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    }
+
+    void beginTimer(Stage stage)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, timers[stage][frame]);
+    }
+
+    void endTimer(Stage stage)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[stage][frame] = true;
+    }
+
+    // the queries of this frame's slot were issued SSAO_TIMER_FRAMES frames ago; a result that is still not there
+    // is dropped and the last one kept
+    void collectTimers()
+    {
+        float *ms[SSAO_STAGES] = {&stats.depthMs, &stats.occlusionMs, &stats.blurMs, &stats.compositeMs};
+        for(unsigned int stage = 0; stage < SSAO_STAGES; stage++)
+        {
+            if(!issued[stage][frame])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(timers[stage][frame], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(available)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(timers[stage][frame], GL_QUERY_RESULT, &nanoseconds);
+                *ms[stage] = nanoseconds / 1e6f;
+            }
+            issued[stage][frame] = false;
+        }
+    }
+
+    // xorshift, the kernel is the same every run
+    static float random(uint32_t &state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state & 0xFFFFFF) / 16777216.0f;
+    }
+};
+#endif
@@ -0,0 +1,265 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <learnopengl/lightmap.h>
+
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// Bakes the world transforms of objects that never move into merged vertex/index buffers at load time.
+// Geometry is grouped by material and split into square chunks of the ground (xz) plane, so each chunk
+// is drawn with a single glDrawElements and can still be culled on its own.
+class StaticBatcher
+{
+public:
+    struct Chunk {
+        unsigned int materialId;
+        Mesh *material; // one of the meshes that went into the chunk, its textures are bound for the draw
+        const Model *model; // the model all of the chunk's meshes come from, NULL when models sharing a material mixed
+        unsigned int firstIndex;
+        unsigned int indexCount;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        int cellX, cellZ; // the ground cell its instances have their origin in
+    };
+
+    unsigned int VAO = 0;
+
+    StaticBatcher(float chunkSize = 16.0f) : chunkSize(chunkSize)
+    {
+    }
+
+    // bakes one copy of the model per transform; an instance goes into the chunk its origin is in, whole.
+    // With a lightmap every mesh of every instance gets a tile of it (see Lightmap::AddSurface) and the batch
+    // carries the coordinates into it at LIGHTMAP_ATTRIB_LOCATION
+    void Add(Model &model, const vector<glm::mat4> &transforms, Lightmap *lightmap = NULL)
+    {
+        for(unsigned int t = 0; t < transforms.size(); t++)
+        {
+            const glm::mat4 &transform = transforms[t];
+            glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(transform)));
+            glm::mat3 tangentMatrix = glm::mat3(transform);
+            int cellX = (int)std::floor(transform[3].x / chunkSize);
+            int cellZ = (int)std::floor(transform[3].z / chunkSize);
+
+            for(unsigned int m = 0; m < model.meshes.size(); m++)
+            {
+                Mesh &mesh = model.meshes[m];
+                Batch &batch = batchFor(model, mesh, cellX, cellZ);
+                unsigned int base = batch.vertices.size();
+                unsigned int firstIndex = batch.indices.size();
+                for(unsigned int i = 0; i < mesh.vertices.size(); i++)
+                {
+                    Vertex vertex = mesh.vertices[i];
+                    vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+                    vertex.Normal = glm::normalize(normalMatrix * vertex.Normal);
+                    vertex.Tangent = tangentMatrix * vertex.Tangent;
+                    vertex.Bitangent = tangentMatrix * vertex.Bitangent;
+                    batch.boundsMin = glm::min(batch.boundsMin, vertex.Position);
+                    batch.boundsMax = glm::max(batch.boundsMax, vertex.Position);
+                    batch.vertices.push_back(vertex);
+                }
+                for(unsigned int i = 0; i < mesh.indices.size(); i++)
+                    batch.indices.push_back(base + mesh.indices[i]);
+                if(lightmap)
+                    addToLightmap(*lightmap, batch, base, firstIndex);
+                else
+                    batch.lightmapCoords.resize(batch.vertices.size(), glm::vec2(0.0f));
+            }
+        }
+    }
+
+    // uploads every batch into one vertex and one index buffer and drops the CPU copies
+    void Build()
+    {
+        vector<Vertex> vertices;
+        vector<glm::vec2> lightmapCoords;
+        vector<unsigned int> indices;
+        chunks.clear();
+        for(unsigned int b = 0; b < batches.size(); b++)
+        {
+            Batch &batch = batches[b];
+            if(batch.indices.empty())
+                continue;
+            unsigned int base = vertices.size();
+            Chunk chunk;
+            chunk.materialId = batch.materialId;
+            chunk.material = batch.material;
+            chunk.model = batch.model;
+            chunk.firstIndex = indices.size();
+            chunk.indexCount = batch.indices.size();
+            chunk.boundsMin = batch.boundsMin;
+            chunk.boundsMax = batch.boundsMax;
+            chunk.cellX = batch.cellX;
+            chunk.cellZ = batch.cellZ;
+            chunks.push_back(chunk);
+
+            vertices.insert(vertices.end(), batch.vertices.begin(), batch.vertices.end());
+            lightmapCoords.insert(lightmapCoords.end(), batch.lightmapCoords.begin(), batch.lightmapCoords.end());
+            // indices are rebased, so a chunk is a plain glDrawElements without baseVertex
+            for(unsigned int i = 0; i < batch.indices.size(); i++)
+                indices.push_back(base + batch.indices[i]);
+        }
+        // draws of the same material follow each other
+        std::stable_sort(chunks.begin(), chunks.end(), [](const Chunk &a, const Chunk &b) {
+            return a.materialId < b.materialId;
+        });
+        batches.clear();
+        batchIndex.clear();
+        vertexCount = vertices.size();
+        triangleCount = indices.size() / 3;
+        if(vertices.empty())
+            return;
+
+        if(VAO == 0)
+        {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+        }
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+        // same attribute layout as Mesh::setupMesh
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // the lightmap coordinates in a buffer of their own, Vertex stays the layout every mesh shares
+        if(lightmapped)
+        {
+            if(lightmapVBO == 0)
+                glGenBuffers(1, &lightmapVBO);
+            glBindBuffer(GL_ARRAY_BUFFER, lightmapVBO);
+            glBufferData(GL_ARRAY_BUFFER, lightmapCoords.size() * sizeof(glm::vec2), &lightmapCoords[0], GL_STATIC_DRAW);
+            glEnableVertexAttribArray(LIGHTMAP_ATTRIB_LOCATION);
+            glVertexAttribPointer(LIGHTMAP_ATTRIB_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        }
+        else
+        {
+            glDisableVertexAttribArray(LIGHTMAP_ATTRIB_LOCATION);
+            glVertexAttrib2f(LIGHTMAP_ATTRIB_LOCATION, 0.0f, 0.0f);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "StaticBatcher: " << chunks.size() << " chunks, " << vertexCount << " vertices, "
+                  << triangleCount << " triangles" << std::endl;
+    }
+
+    // binds the chunk's textures; the shader has to be in use
+    void BindMaterial(Shader &shader, unsigned int chunk)
+    {
+        chunks[chunk].material->BindTextures(shader);
+    }
+
+    // expects VAO bound
+    void DrawChunk(unsigned int chunk)
+    {
+        const Chunk &c = chunks[chunk];
+        glDrawElements(GL_TRIANGLES, c.indexCount, GL_UNSIGNED_INT, (void*)((size_t)c.firstIndex * sizeof(unsigned int)));
+    }
+
+    const vector<Chunk> &Chunks() const { return chunks; }
+    glm::vec3 ChunkCenter(unsigned int chunk) const { return 0.5f * (chunks[chunk].boundsMin + chunks[chunk].boundsMax); }
+    unsigned int VertexCount() const { return vertexCount; }
+    unsigned int TriangleCount() const { return triangleCount; }
+    bool Lightmapped() const { return lightmapped; }
+
+private:
+    struct Batch {
+        unsigned int materialId;
+        Mesh *material;
+        const Model *model;
+        vector<Vertex> vertices;
+        vector<glm::vec2> lightmapCoords; // one per vertex, (0, 0) for meshes without a lightmap
+        vector<unsigned int> indices;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        int cellX, cellZ;
+    };
+
+    float chunkSize;
+    unsigned int VBO = 0, EBO = 0, lightmapVBO = 0;
+    bool lightmapped = false;
+    vector<Batch> batches;
+    // (material, chunk x, chunk z) -> index into batches
+    map<pair<unsigned int, pair<int, int> >, unsigned int> batchIndex;
+    // meshes that bind exactly the same textures share a material
+    map<vector<unsigned int>, unsigned int> materialIds;
+    vector<Chunk> chunks;
+    unsigned int vertexCount = 0;
+    unsigned int triangleCount = 0;
+
+    // the vertices from base on (and indices from firstIndex on) are one mesh just added to the batch, in world space
+    void addToLightmap(Lightmap &lightmap, Batch &batch, unsigned int base, unsigned int firstIndex)
+    {
+        vector<glm::vec3> positions, normals;
+        vector<glm::vec2> texCoords;
+        vector<unsigned int> indices;
+        for(unsigned int i = base; i < batch.vertices.size(); i++)
+        {
+            positions.push_back(batch.vertices[i].Position);
+            normals.push_back(batch.vertices[i].Normal);
+            texCoords.push_back(batch.vertices[i].TexCoords);
+        }
+        for(unsigned int i = firstIndex; i < batch.indices.size(); i++)
+            indices.push_back(batch.indices[i] - base);
+        vector<glm::vec2> coords = lightmap.AddSurface(positions, normals, texCoords, indices);
+        batch.lightmapCoords.insert(batch.lightmapCoords.end(), coords.begin(), coords.end());
+        lightmapped = true;
+    }
+
+    Batch &batchFor(const Model &model, Mesh &mesh, int cellX, int cellZ)
+    {
+        vector<unsigned int> textureIds;
+        for(unsigned int i = 0; i < mesh.textures.size(); i++)
+            textureIds.push_back(mesh.textures[i].id);
+        map<vector<unsigned int>, unsigned int>::iterator material = materialIds.find(textureIds);
+        if(material == materialIds.end())
+            material = materialIds.insert(make_pair(textureIds, (unsigned int)materialIds.size())).first;
+
+        pair<unsigned int, pair<int, int> > key(material->second, make_pair(cellX, cellZ));
+        map<pair<unsigned int, pair<int, int> >, unsigned int>::iterator it = batchIndex.find(key);
+        if(it != batchIndex.end())
+        {
+            Batch &batch = batches[it->second];
+            if(batch.model != &model)
+                batch.model = NULL;
+            return batch;
+        }
+
+        Batch batch;
+        batch.materialId = material->second;
+        batch.material = &mesh;
+        batch.model = &model;
+        batch.boundsMin = glm::vec3(1e30f);
+        batch.boundsMax = glm::vec3(-1e30f);
+        batch.cellX = cellX;
+        batch.cellZ = cellZ;
+        batchIndex[key] = batches.size();
+        batches.push_back(batch);
+        return batches.back();
+    }
+};
+#endif
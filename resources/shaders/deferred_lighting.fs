@@ -0,0 +1,150 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+// surface kinds written by the geometry pass into the alpha of gNormal, 0 where nothing was drawn
+#define SURFACE_LIT 1
+#define SURFACE_GROUND 2
+#define SURFACE_UNLIT 3
+
+#include "lighting_common.glsl"
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec3 viewPos;
+// the ground has its own set of lamps, so it is lit in a second pass of its own
+uniform bool groundPass;
+
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+
+uniform bool blinn_phong;
+uniform bool sl;
+
+struct Surface {
+    vec3 albedo;
+    float specular;
+    float shininess;
+};
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, Surface surface);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, Surface surface);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, Surface surface);
+float SpotIntensity(SpotLight light, vec3 lightDir);
+
+void main()
+{
+    vec4 normalData = texture(gNormal, TexCoords);
+    int kind = int(normalData.w + 0.5);
+    if(kind == 0 || (kind == SURFACE_GROUND) != groundPass)
+        discard;
+    const float gamma = 2.2;
+    vec4 albedoSpec = texture(gAlbedoSpec, TexCoords);
+    float depth = texture(gDepth, TexCoords).r;
+    vec4 worldPos = inverseViewProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    // the octahedrons aren't lit, only darkened outside the spotlight cone when it is on
+    if(kind == SURFACE_UNLIT) {
+        vec3 color = albedoSpec.rgb;
+        if(sl)
+            color *= SpotIntensity(spotLight, normalize(spotLight.position - fragPos));
+        FragColor = vec4(color, 1.0);
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    Surface surface;
+    surface.albedo = albedoSpec.rgb;
+    surface.specular = albedoSpec.a;
+    surface.shininess = normalData.z;
+    vec3 norm = UnpackNormal(normalData.xy);
+    vec3 viewDir = normalize(viewPos - fragPos);
+    // the ground's normal is in its tangent space, as snow.fs lights it (tangent -x, bitangent +z)
+    vec3 worldNormal = kind == SURFACE_GROUND ? normalize(vec3(-norm.x, norm.z, norm.y)) : norm;
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, surface) * ShadowFactor(fragPos, worldNormal);
+
+    if(sl) {
+        result = CalcSpotLight(spotLight, norm, fragPos, viewDir, surface);
+    }
+    else {
+        uvec2 cluster = ClusterLights(gl_FragCoord.xy, depth);
+        for(uint i = 0u; i < cluster.y; i++) {
+            int lightIndex = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+            // in the ground pass the index is one of the ground's copies of the lights, which have no shadows of their
+            // own: as in snow.fs they take the scene light's with the same index, cast from that light's position
+            result += CalcPointLight(FetchPointLight(cluster.x + i), norm, fragPos, viewDir, surface) * PointShadow(lightIndex, fragPos, worldNormal);
+        }
+    }
+    if(!sl)
+        result += SkyAmbient(worldNormal) * surface.albedo;
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    if(brightness > 1.0)
+        BrightColor = vec4(result, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+
+    // same gamma correction as the forward shaders apply to the ground and objects
+    result = pow(result, vec3(1.0 / gamma));
+    FragColor = vec4(result, 1.0);
+}
+
+float Specular(vec3 normal, vec3 lightDir, vec3 viewDir, float shininess)
+{
+    if(blinn_phong) {
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        return pow(max(dot(normal, halfwayDir), 0.0), 4*shininess);
+    }
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+}
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, Surface surface)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = Specular(normal, lightDir, viewDir, surface.shininess);
+
+    float distance = length(light.position - fragPos);
+    float correctedDistance = distance * distance;
+    float attenuation = RangeFade(distance, light.range) / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (diffuse + specular) * attenuation;
+}
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, Surface surface)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = Specular(normal, lightDir, viewDir, surface.shininess);
+
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (diffuse + specular);
+}
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, Surface surface)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = Specular(normal, lightDir, viewDir, surface.shininess);
+
+    float distance = length(light.position - fragPos);
+    float correctedDistance = distance * distance;
+    float attenuation = 1.0 / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+    float intensity = SpotIntensity(light, lightDir);
+
+    vec3 ambient = light.ambient * surface.albedo;
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + diffuse + specular * attenuation) * intensity;
+}
+float SpotIntensity(SpotLight light, vec3 lightDir)
+{
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    return clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth pre-pass and occlusion query proxies, color writes are masked off
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#version 330 core
+out vec2 MinMaxDepth;
+
+// the depth texture for the first level, the previous pyramid level (as its only visible level) after that
+uniform sampler2D source;
+uniform bool firstLevel;
+uniform int sourceWidth;
+uniform int sourceHeight;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    if(firstLevel)
+    {
+        float depth = texelFetch(source, texel, 0).r;
+        MinMaxDepth = vec2(depth);
+        return;
+    }
+
+    // 2x2 footprint; the last row/column of an odd sized level also covers the source texel left over
+    ivec2 size = ivec2(max(sourceWidth / 2, 1), max(sourceHeight / 2, 1));
+    ivec2 end = min(texel * 2 + 2, ivec2(sourceWidth, sourceHeight));
+    if(texel.x == size.x - 1)
+        end.x = sourceWidth;
+    if(texel.y == size.y - 1)
+        end.y = sourceHeight;
+
+    vec2 minMax = vec2(1.0, 0.0);
+    for(int y = texel.y * 2; y < end.y; y++)
+    {
+        for(int x = texel.x * 2; x < end.x; x++)
+        {
+            vec2 s = texelFetch(source, ivec2(x, y), 0).rg;
+            minMax = vec2(min(minMax.x, s.x), max(minMax.y, s.y));
+        }
+    }
+    MinMaxDepth = minMax;
+}
\ No newline at end of file
@@ -7,15 +7,48 @@ uniform sampler2D hdrColorBuffer;
 uniform sampler2D blurColorBuffer;
 uniform bool bloom;
 uniform float exposure;
+// ambient occlusion at a reduced resolution (rg: visibility, view depth), upsampled against the full depth
+uniform bool ssao;
+uniform sampler2D ssaoTexture;
+uniform sampler2D depthMap;
+uniform vec2 depthParams;
+uniform float ssaoSharpness;
+
+float AmbientOcclusion();
 
 void main()
 {
     vec3 hdrColor = texture(hdrColorBuffer, TexCoords).rgb;
     vec3 bloomColor = texture(blurColorBuffer, TexCoords).rgb;
+    if(ssao)
+        hdrColor *= AmbientOcclusion();
     if(bloom)
         hdrColor += bloomColor;
 
     // HDR -> LDR (tone mapping)
     vec3 result = vec3(1.0) - exp(-hdrColor * exposure);
     FragColor = vec4(result, 1.0);
+}
+// depth-aware upsample: the 4 low resolution texels around the fragment, their bilinear weights scaled down by how
+// far their depth is from the fragment's, so occlusion does not bleed across silhouettes
+float AmbientOcclusion()
+{
+    float depth = texture(depthMap, TexCoords).r;
+    if(depth >= 1.0)
+        return 1.0;
+    float viewDepth = depthParams.y / (depth * 2.0 - 1.0 + depthParams.x);
+    ivec2 size = textureSize(ssaoTexture, 0);
+    vec2 position = TexCoords * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    float bilinear[4] = float[4]((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+    float sum = 0.0;
+    float weights = 0.0;
+    for(int i = 0; i < 4; i++) {
+        vec2 s = texelFetch(ssaoTexture, clamp(base + ivec2(i & 1, i >> 1), ivec2(0), size - 1), 0).rg;
+        float w = bilinear[i] * exp(-ssaoSharpness * abs(s.g - viewDepth) / viewDepth) + 1e-5;
+        sum += s.r * w;
+        weights += w;
+    }
+    return sum / weights;
 }
\ No newline at end of file
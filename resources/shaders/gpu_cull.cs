@@ -0,0 +1,100 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+// same layout as DrawData in multi_draw.h
+struct DrawData {
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+// same layout as DrawElementsIndirectCommand
+struct Command {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 1) readonly buffer InstanceBuffer {
+    mat4 transforms[];
+};
+layout (std430, binding = 0) writeonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+layout (std430, binding = 2) buffer CommandBuffer {
+    Command commands[];
+};
+
+uniform int instanceCount;
+uniform int commandCount;
+// local bounding sphere of the model: center, radius
+uniform vec4 boundingSphere;
+uniform vec4 frustumPlanes[6];
+
+// depth pyramid of an earlier frame, (min, max) depth per texel
+uniform bool useHiZ;
+uniform sampler2D depthPyramid;
+uniform mat4 hiZViewProjection;
+uniform vec2 hiZSize;
+uniform int hiZLevels;
+
+// same test as DepthPyramid::Occluded, on the GPU copy: the box has to be behind the farthest depth of the
+// (at most 2x2) texels its screen rect covers at the level where it is about one texel big
+bool occluded(vec3 boxMin, vec3 boxMax)
+{
+    vec2 rectMin = vec2(1.0);
+    vec2 rectMax = vec2(-1.0);
+    float nearest = 1.0;
+    for(int corner = 0; corner < 8; corner++)
+    {
+        vec3 p = vec3((corner & 1) != 0 ? boxMax.x : boxMin.x, (corner & 2) != 0 ? boxMax.y : boxMin.y, (corner & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = hiZViewProjection * vec4(p, 1.0);
+        if(clip.w <= 1e-4)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc.xy);
+        rectMax = max(rectMax, ndc.xy);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    if(nearest <= 0.0 || any(lessThan(rectMax, vec2(-1.0))) || any(greaterThan(rectMin, vec2(1.0))))
+        return false;
+    vec2 pixelMin = (clamp(rectMin, -1.0, 1.0) * 0.5 + 0.5) * hiZSize;
+    vec2 pixelMax = (clamp(rectMax, -1.0, 1.0) * 0.5 + 0.5) * hiZSize;
+    vec2 extent = pixelMax - pixelMin;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiZLevels - 1);
+
+    ivec2 size = textureSize(depthPyramid, level);
+    ivec2 texelMin = min(ivec2(pixelMin / exp2(level)), size - 1);
+    ivec2 texelMax = min(ivec2(pixelMax / exp2(level)), size - 1);
+    float farthest = 0.0;
+    for(int y = texelMin.y; y <= texelMax.y; y++)
+        for(int x = texelMin.x; x <= texelMax.x; x++)
+            farthest = max(farthest, texelFetch(depthPyramid, ivec2(x, y), level).g);
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if(index >= uint(instanceCount))
+        return;
+    mat4 model = transforms[index];
+
+    // bounding sphere in world space, scaled by the largest axis scale
+    vec3 center = vec3(model * vec4(boundingSphere.xyz, 1.0));
+    float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+    float radius = boundingSphere.w * scale;
+    for(int i = 0; i < 6; i++)
+        if(dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+            return;
+    if(useHiZ && occluded(center - vec3(radius), center + vec3(radius)))
+        return;
+
+    // compaction: every mesh command draws the same instances, the first command's count hands out the slots
+    uint slot = atomicAdd(commands[0].instanceCount, 1u);
+    for(int i = 1; i < commandCount; i++)
+        atomicAdd(commands[i].instanceCount, 1u);
+    draws[slot].model = model;
+    draws[slot].normalMatrix = mat4(transpose(inverse(mat3(model))));
+}
\ No newline at end of file
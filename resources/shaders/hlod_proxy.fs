@@ -0,0 +1,84 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+#define SURFACE_LIT 1
+
+#include "lighting_common.glsl"
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec3 Color;
+
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+// or, when objectLightCount >= 0, the lights of this draw's own list (ClusteredLights::ObjectLights)
+#define MAX_OBJECT_LIGHTS 16
+uniform int objectLightCount;
+uniform int objectLights[MAX_OBJECT_LIGHTS];
+
+uniform bool sl;
+// deferred geometry pass: the two outputs carry the G-buffer instead (see GBuffer)
+uniform bool gBufferPass;
+
+// only diffuse, a proxy is never close enough for highlights to matter
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 albedo)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(light.position - fragPos);
+    float correctedDistance = distance * distance;
+    float attenuation = RangeFade(distance, light.range) / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+    return light.diffuse * diff * albedo * attenuation;
+}
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 albedo)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    return light.diffuse * diff * albedo;
+}
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 albedo)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    return (light.ambient + light.diffuse * diff) * albedo * intensity;
+}
+
+void main()
+{
+    const float gamma = 2.2;
+    vec3 norm = normalize(Normal);
+    if(gBufferPass) {
+        FragColor = vec4(Color, 0.0);
+        BrightColor = vec4(PackNormal(norm), 8.0, SURFACE_LIT);
+        return;
+    }
+    vec3 result = CalcDirLight(dirLight, norm, Color);
+    if(sl) {
+        result = CalcSpotLight(spotLight, norm, FragPos, Color);
+    }
+    else if(objectLightCount >= 0) {
+        for(int i = 0; i < objectLightCount; i++) {
+            result += CalcPointLight(FetchLight(objectLights[i]), norm, FragPos, Color);
+        }
+    }
+    else {
+        uvec2 cluster = ClusterLights(gl_FragCoord.xy, gl_FragCoord.z);
+        for(uint i = 0u; i < cluster.y; i++) {
+            result += CalcPointLight(FetchPointLight(cluster.x + i), norm, FragPos, Color);
+        }
+    }
+    if(!sl)
+        result += SkyAmbient(norm) * Color;
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    if(brightness > 1.0)
+        BrightColor = vec4(result, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+
+    result = pow(result, vec3(1.0 / gamma));
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+// the diffuse texture baked into the vertex, see HlodBuilder
+layout (location = 2) in vec3 aColor;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// proxies are built in world space, like the static batches
+void main()
+{
+    FragPos = aPos;
+    Normal = aNormal;
+    Color = aColor;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+#define SURFACE_LIT 1
+
+#include "lighting_common.glsl"
+
+in vec2 AtlasCoords;
+in vec3 QuadPos;
+flat in vec3 FrameDirection;
+flat in float Yaw;
+flat in float Radius;
+flat in float Weight;
+
+uniform sampler2D albedoAtlas;
+uniform sampler2D normalDepthAtlas;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+
+uniform bool sl;
+// deferred geometry pass: the two outputs carry the G-buffer instead (see GBuffer)
+uniform bool gBufferPass;
+
+// same 4x4 ordered dither as model_lighting.fs, the two keep complementary pixels while an instance fades
+float ditherThreshold()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+    return (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+}
+
+// only diffuse: there is no specular map in the atlas, and far away highlights are mostly lost anyway
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 albedo)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(light.position - fragPos);
+    float correctedDistance = distance * distance;
+    float attenuation = RangeFade(distance, light.range) / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+    return light.diffuse * diff * albedo * attenuation;
+}
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 albedo)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    return light.diffuse * diff * albedo;
+}
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 albedo)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    return (light.ambient + light.diffuse * diff) * albedo * intensity;
+}
+
+void main()
+{
+    vec4 albedo = texture(albedoAtlas, AtlasCoords);
+    if(albedo.a < 0.5 || ditherThreshold() < 1.0 - Weight)
+        discard;
+
+    // the baked normal is in the upright space of the model, turn it by the instance's yaw like the mesh would be
+    vec4 normalDepth = texture(normalDepthAtlas, AtlasCoords);
+    float c = cos(Yaw);
+    float s = sin(Yaw);
+    vec3 norm = normalize(mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c) * normalDepth.xyz);
+    // and the baked depth puts the fragment back about where the surface was, so impostors intersect properly
+    vec3 fragPos = QuadPos + FrameDirection * normalDepth.w * Radius;
+    vec4 clipPos = projection * view * vec4(fragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+    if(gBufferPass) {
+        FragColor = vec4(albedo.rgb, 0.0);
+        BrightColor = vec4(PackNormal(norm), 8.0, SURFACE_LIT);
+        return;
+    }
+
+    const float gamma = 2.2;
+    vec3 result = CalcDirLight(dirLight, norm, albedo.rgb);
+    if(sl) {
+        result = CalcSpotLight(spotLight, norm, fragPos, albedo.rgb);
+    }
+    else {
+        uvec2 cluster = ClusterLights(gl_FragCoord.xy, gl_FragDepth);
+        for(uint i = 0u; i < cluster.y; i++) {
+            result += CalcPointLight(FetchPointLight(cluster.x + i), norm, fragPos, albedo.rgb);
+        }
+    }
+    if(!sl)
+        result += SkyAmbient(norm) * albedo.rgb;
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    if(brightness > 1.0)
+        BrightColor = vec4(result, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+
+    result = pow(result, vec3(1.0 / gamma));
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
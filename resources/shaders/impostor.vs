@@ -0,0 +1,59 @@
+#version 330 core
+// corner of the quad in [-1, 1]
+layout (location = 0) in vec2 aCorner;
+// per-instance attributes, see ImpostorAtlas::Instance
+layout (location = 5) in vec4 aPositionScale;
+layout (location = 6) in vec2 aYawFade;
+
+out vec2 AtlasCoords;
+out vec3 QuadPos;
+flat out vec3 FrameDirection;
+flat out float Yaw;
+flat out float Radius;
+flat out float Weight;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+
+// bounding sphere of the upright model and the frame grid of its atlas
+uniform vec3 boundsCenter;
+uniform float boundsRadius;
+uniform int frames;
+
+mat3 rotationY(float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    return mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+}
+
+void main()
+{
+    mat3 rotation = rotationY(aYawFade.x);
+    float scale = aPositionScale.w;
+    vec3 center = aPositionScale.xyz + rotation * boundsCenter * scale;
+    Radius = boundsRadius * scale;
+    Yaw = aYawFade.x;
+    Weight = aYawFade.y;
+
+    // direction to the camera in the upright space of the model, from below it is seen as from the horizon
+    vec3 direction = transpose(rotation) * normalize(viewPos - center);
+    direction.y = max(direction.y, 0.0);
+    // hemi-octahedral mapping to the frame it falls in (ImpostorAtlas::frameDirection goes the other way)
+    vec2 p = direction.xz / (abs(direction.x) + direction.y + abs(direction.z) + 1e-5);
+    vec2 e = vec2(p.x + p.y, p.x - p.y);
+    vec2 frame = clamp(floor((e * 0.5 + 0.5) * float(frames)), 0.0, float(frames - 1));
+    vec2 f = (frame + 0.5) / float(frames) * 2.0 - 1.0;
+    vec2 q = vec2(f.x + f.y, f.x - f.y) * 0.5;
+    vec3 frameDirection = normalize(vec3(q.x, 1.0 - abs(q.x) - abs(q.y), q.y));
+
+    // the quad faces the frame's direction, with the same basis glm::lookAt gave that frame in the bake
+    vec3 right = normalize(cross(vec3(0.0, 1.0, 0.0), frameDirection));
+    vec3 up = cross(frameDirection, right);
+    FrameDirection = rotation * frameDirection;
+    QuadPos = center + rotation * (right * aCorner.x + up * aCorner.y) * Radius;
+    AtlasCoords = (frame + aCorner * 0.5 + 0.5) / float(frames);
+
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+}
\ No newline at end of file
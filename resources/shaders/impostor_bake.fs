@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) out vec4 Albedo;
+layout (location = 1) out vec4 NormalDepth;
+
+struct Material {
+    sampler2D texture_diffuse1;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+
+// the frame being rendered: its direction and the bounding sphere it is centered on
+uniform vec3 bakeDirection;
+uniform vec3 bakeCenter;
+uniform float bakeRadius;
+
+void main()
+{
+    Albedo = vec4(texture(material.texture_diffuse1, TexCoords).rgb, 1.0);
+    // depth is stored as the distance in front of the plane through the center, in radii
+    NormalDepth = vec4(normalize(Normal), dot(FragPos - bakeCenter, bakeDirection) / bakeRadius);
+}
\ No newline at end of file
@@ -7,6 +7,7 @@ out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 
+// model only turns the mesh upright, see ImpostorAtlas
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
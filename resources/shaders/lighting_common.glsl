@@ -0,0 +1,177 @@
+// Lights, light lookups and shadows shared by the lit fragment shaders, spliced in by the Shader loader where
+// they #include it. Uniforms a shader never reads are dropped by the compiler, so the ones without shadows or a sky
+// pay nothing for them.
+
+struct PointLight {
+    vec3 position;
+    float range;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// point lights come from the cluster grid, see ClusteredLights
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterData;
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterGrid;
+uniform vec2 clusterScreenSize;
+uniform vec2 clusterNearFar;
+uniform vec2 clusterSliceParams;
+
+// ambient light of the sky box as irradiance spherical harmonics (see CubemapProjection), added once per fragment
+uniform vec3 skyAmbient[9];
+// shadows of dirLight: a map of the static scene and one of the penguins, see DirectionalShadows
+uniform bool shadows;
+uniform sampler2DShadow staticShadowMap;
+uniform sampler2DShadow dynamicShadowMap;
+uniform mat4 staticLightSpace;
+uniform mat4 dynamicLightSpace;
+// and of the point lights, two texels per light from PointShadowAtlas
+uniform bool pointShadows;
+uniform sampler2DShadow pointShadowAtlas;
+uniform samplerBuffer pointShadowData;
+uniform float pointShadowNear;
+
+// (offset, count) of the light list of the cluster a fragment is in, depth is its window depth
+uvec2 ClusterLights(vec2 fragCoord, float depth)
+{
+    float nearPlane = clusterNearFar.x;
+    float farPlane = clusterNearFar.y;
+    float viewDepth = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - (depth * 2.0 - 1.0) * (farPlane - nearPlane));
+    int slice = clamp(int(log(viewDepth) * clusterSliceParams.x - clusterSliceParams.y), 0, clusterGrid.z - 1);
+    ivec2 tile = clamp(ivec2(fragCoord / clusterScreenSize * vec2(clusterGrid.xy)), ivec2(0), clusterGrid.xy - 1);
+    return texelFetch(clusterData, (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x).xy;
+}
+PointLight FetchLight(int lightIndex)
+{
+    int index = 4 * lightIndex;
+    vec4 a = texelFetch(lightData, index);
+    vec4 b = texelFetch(lightData, index + 1);
+    vec4 c = texelFetch(lightData, index + 2);
+    vec4 d = texelFetch(lightData, index + 3);
+    PointLight light;
+    light.position = a.xyz;
+    light.range = a.w;
+    light.ambient = b.xyz;
+    light.constant = b.w;
+    light.diffuse = c.xyz;
+    light.linear = c.w;
+    light.specular = d.xyz;
+    light.quadratic = d.w;
+    return light;
+}
+// the light at position listIndex of the cluster light lists
+PointLight FetchPointLight(uint listIndex)
+{
+    return FetchLight(int(texelFetch(lightIndices, int(listIndex)).r));
+}
+// the sky box's light from the spherical harmonics, for normal n
+vec3 SkyAmbient(vec3 n)
+{
+    vec3 result = skyAmbient[0] * 0.282095
+                + (skyAmbient[1] * n.y + skyAmbient[2] * n.z + skyAmbient[3] * n.x) * 0.488603
+                + (skyAmbient[4] * n.x * n.y + skyAmbient[5] * n.y * n.z + skyAmbient[7] * n.x * n.z) * 1.092548
+                + skyAmbient[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) + skyAmbient[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+    return max(result, vec3(0.0));
+}
+// fades a light out towards its range, so the cut there leaves no edge
+float RangeFade(float distance, float range)
+{
+    float x = clamp(1.0 - pow(distance / range, 4.0), 0.0, 1.0);
+    return x * x;
+}
+// octahedral packing of a unit normal into two components, for the G-buffer
+vec2 PackNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.xy;
+}
+// and its inverse, for the deferred pass reading it back
+vec3 UnpackNormal(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+// 4 taps of the hardware's 2x2 PCF, half a texel apart
+float ShadowLookup(sampler2DShadow map, mat4 lightSpace, vec3 position)
+{
+    vec3 coords = (lightSpace * vec4(position, 1.0)).xyz * 0.5 + 0.5;
+    // beyond the far plane nothing was drawn
+    if(coords.z > 1.0)
+        return 1.0;
+    vec2 texel = 0.5 / vec2(textureSize(map, 0));
+    float lit = texture(map, vec3(coords.xy + vec2(-texel.x, -texel.y), coords.z))
+              + texture(map, vec3(coords.xy + vec2(texel.x, -texel.y), coords.z))
+              + texture(map, vec3(coords.xy + vec2(-texel.x, texel.y), coords.z))
+              + texture(map, vec3(coords.xy + vec2(texel.x, texel.y), coords.z));
+    return lit * 0.25;
+}
+// visibility of dirLight, the darker of the two maps. The position is pushed out along the normal first: with the
+// sun this low the maps' depth is too coarse for the surfaces it grazes.
+float ShadowFactor(vec3 position, vec3 normal)
+{
+    if(!shadows)
+        return 1.0;
+    position += normal * 0.03;
+    return min(ShadowLookup(staticShadowMap, staticLightSpace, position), ShadowLookup(dynamicShadowMap, dynamicLightSpace, position));
+}
+// visibility of point light lightIndex, from the cube face of its atlas block the position is in; the face axes are
+// the ones PointShadowAtlas::FaceView looks along (forward, right, up)
+float PointShadow(int lightIndex, vec3 position, vec3 normal)
+{
+    if(!pointShadows)
+        return 1.0;
+    vec4 tile = texelFetch(pointShadowData, 2 * lightIndex + 1);
+    if(tile.z <= 0.0)
+        return 1.0;
+    const vec3 faceForward[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+    const vec3 faceRight[6] = vec3[6](vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(-1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0));
+    const vec3 faceUp[6] = vec3[6](vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0));
+    vec4 light = texelFetch(pointShadowData, 2 * lightIndex);
+    vec3 l = position + normal * 0.02 - light.xyz;
+    vec3 a = abs(l);
+    int face = a.x >= a.y && a.x >= a.z ? (l.x > 0.0 ? 0 : 1) : (a.y >= a.z ? (l.y > 0.0 ? 2 : 3) : (l.z > 0.0 ? 4 : 5));
+    float major = dot(faceForward[face], l);
+    float nearPlane = pointShadowNear;
+    float farPlane = light.w;
+    if(major >= farPlane)
+        return 1.0;
+    vec2 uv = vec2(dot(faceRight[face], l), dot(faceUp[face], l)) / major * 0.5 + 0.5;
+    float depth = ((farPlane + nearPlane) / (farPlane - nearPlane) - 2.0 * farPlane * nearPlane / ((farPlane - nearPlane) * major)) * 0.5 + 0.5;
+    // the filter footprint is kept inside the face's tile
+    float halfTexel = 0.5 / float(textureSize(pointShadowAtlas, 0).x);
+    vec2 atlasUv = tile.xy + vec2(face % 3, face / 3) * tile.z + clamp(uv * tile.z, vec2(halfTexel), vec2(tile.z - halfTexel));
+    return texture(pointShadowAtlas, vec3(atlasUv, depth));
+}
\ No newline at end of file
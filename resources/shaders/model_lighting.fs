@@ -2,82 +2,122 @@
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
 
+#define SURFACE_LIT 1
+
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
+    // glTF materials: roughness in g, metalness in b
+    sampler2D texture_metallicRoughness1;
+    bool hasMetallicRoughness;
     float shininess;
 };
 
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-#define NR_POINT_LIGHTS 10
+#include "lighting_common.glsl"
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+in float Coverage;
+in vec2 LightmapCoords;
 
 uniform vec3 viewPos;
 
 uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
+// or, when objectLightCount >= 0, the lights of this draw's own list (ClusteredLights::ObjectLights)
+#define MAX_OBJECT_LIGHTS 16
+uniform int objectLightCount;
+uniform int objectLights[MAX_OBJECT_LIGHTS];
+// the first bakedLightCount point lights are in the lightmap (diffuse only, see Lightmap), the loops skip them
+uniform sampler2D lightmap;
+uniform int bakedLightCount;
+// draws without a lightmap (lightmapped false) take them from the probe grid instead, see LightProbeGrid
+uniform bool lightmapped;
+uniform sampler3D lightProbes;
+uniform vec3 lightProbeMin;
+uniform float lightProbeSpacing;
+uniform ivec3 lightProbeCount;
 
 uniform Material material;
 
+// materials with a metallic/roughness map are shaded physically based (Cook-Torrance, GGX) when pbrShading is on,
+// the sky's specular light from the split-sum lookups of SpecularIbl; everything else keeps the cheaper Phong
+uniform bool pbrShading;
+uniform sampler2D brdfLut;
+uniform samplerCube prefilteredSky;
+uniform float prefilteredSkyLevels;
+// the sky's radiance at the brightness of skyAmbient
+uniform float skyRadianceScale;
 uniform bool blinn_phong;
 uniform bool sl;
+// deferred geometry pass: the two outputs carry the G-buffer instead (see GBuffer)
+uniform bool gBufferPass;
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor);
+vec3 ShIrradiance(vec3 position, vec3 normal);
+vec3 CookTorrance(vec3 normal, vec3 lightDir, vec3 viewDir, vec3 albedo, vec3 diffuseColor, vec3 specularColor);
+vec3 SkyPbr(vec3 normal, vec3 viewDir, vec3 albedo);
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+const float PI = 3.14159265;
+// the fragment's material, read once in main
+bool pbr;
+float metallic;
+float roughness;
+
+// 4x4 ordered dither, impostor.fs uses the same one so the mesh and its impostor keep complementary pixels
+float ditherThreshold()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+    return (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+}
 
 void main()
 {
+    if(Coverage < 1.0 && ditherThreshold() >= Coverage)
+        discard;
     const float gamma = 2.2;
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    // the textures are read once here, not once per light
+    vec3 albedo = texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 specularColor = texture(material.texture_specular1, TexCoords).rgb;
+    if(gBufferPass) {
+        FragColor = vec4(albedo, dot(specularColor, vec3(1.0 / 3.0)));
+        BrightColor = vec4(PackNormal(norm), material.shininess, SURFACE_LIT);
+        return;
+    }
+    pbr = pbrShading && material.hasMetallicRoughness;
+    vec2 metallicRoughness = pbr ? texture(material.texture_metallicRoughness1, TexCoords).bg : vec2(0.0, 1.0);
+    metallic = metallicRoughness.x;
+    roughness = max(metallicRoughness.y, 0.04);
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, albedo, specularColor) * ShadowFactor(FragPos, norm);
 
     if(sl) {
-        result = CalcSpotLight(spotLight, norm, FragPos, viewDir);
+        result = CalcSpotLight(spotLight, norm, FragPos, viewDir, albedo, specularColor);
+    }
+    else if(objectLightCount >= 0) {
+        for(int i = 0; i < objectLightCount; i++) {
+            if(objectLights[i] >= bakedLightCount)
+                result += CalcPointLight(FetchLight(objectLights[i]), norm, FragPos, viewDir, albedo, specularColor) * PointShadow(objectLights[i], FragPos, norm);
+        }
     }
     else {
-        for(int i = 0; i < NR_POINT_LIGHTS; i++) {
-            result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+        uvec2 cluster = ClusterLights(gl_FragCoord.xy, gl_FragCoord.z);
+        for(uint i = 0u; i < cluster.y; i++) {
+            int lightIndex = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+            if(lightIndex >= bakedLightCount)
+                result += CalcPointLight(FetchLight(lightIndex), norm, FragPos, viewDir, albedo, specularColor) * PointShadow(lightIndex, FragPos, norm);
         }
     }
+    // metals have no diffuse part, the baked lights are diffuse only
+    if(!sl && bakedLightCount > 0)
+        result += (lightmapped ? texture(lightmap, LightmapCoords).rgb : ShIrradiance(FragPos, norm)) * albedo * (1.0 - metallic);
+    if(!sl)
+        result += pbr ? SkyPbr(norm, viewDir, albedo) : SkyAmbient(norm) * albedo;
     float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
     if(brightness > 1.0)
         BrightColor = vec4(result, 1.0);
@@ -89,9 +129,14 @@ void main()
     FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
 {
     vec3 lightDir = normalize(light.position - fragPos);
+    float distance = length(light.position - fragPos);
+    float correctedDistance = distance * distance;
+    float attenuation = RangeFade(distance, light.range) / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+    if(pbr)
+        return CookTorrance(normal, lightDir, viewDir, albedo, light.diffuse, light.specular) * attenuation;
 
     float diff = max(dot(normal, lightDir), 0.0);
     float spec = 0.0f;
@@ -103,25 +148,20 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
         spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     }
 
-    float distance = length(light.position - fragPos);
-    float correctedDistance = distance * distance;
-    float attenuation = 1.0 / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
-
-    vec3 ambient = light.ambient * texture(material.texture_diffuse1, TexCoords).rgb;
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
-    vec3 specular = light.specular * spec * texture(material.texture_specular1, TexCoords).rgb;
-    ambient *= attenuation;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
     diffuse *= attenuation;
     specular *= attenuation;
-    return (ambient + diffuse + specular);
+    return (diffuse + specular);
 }
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor)
 {
     vec3 lightDir = normalize(-light.direction);
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
+    if(pbr)
+        return CookTorrance(normal, lightDir, viewDir, albedo, light.diffuse, light.specular);
 
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
+    vec3 diffuse = light.diffuse * diff * albedo;
 
     float spec = 0.0f;
 
@@ -133,10 +173,10 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
         spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     }
 
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 specular = light.specular * spec * specularColor;
+    return (diffuse + specular);
 }
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -159,12 +199,65 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float theta = dot(lightDir, normalize(-light.direction));
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    if(pbr)
+        return (light.ambient * albedo + CookTorrance(normal, lightDir, viewDir, albedo, light.diffuse, light.specular * attenuation)) * intensity;
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= intensity;
     diffuse *= intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
+}
+// irradiance of the baked lights from the probe grid, one trilinear fetch per coefficient: coefficient i of every
+// probe is the i-th slab of layers along y, y is kept on the slab's texel centers so filtering never crosses slabs
+vec3 ShIrradiance(vec3 position, vec3 normal)
+{
+    vec3 grid = (position - lightProbeMin) / lightProbeSpacing;
+    vec3 size = vec3(lightProbeCount.x, 9 * lightProbeCount.y, lightProbeCount.z);
+    vec2 xz = (grid.xz + 0.5) / size.xz;
+    float y = clamp(grid.y, 0.0, float(lightProbeCount.y - 1)) + 0.5;
+    // the basis of SphericalHarmonics::Basis
+    float basis[9] = float[9](0.282095, 0.488603 * normal.y, 0.488603 * normal.z, 0.488603 * normal.x,
+                              1.092548 * normal.x * normal.y, 1.092548 * normal.y * normal.z, 0.315392 * (3.0 * normal.z * normal.z - 1.0),
+                              1.092548 * normal.x * normal.z, 0.546274 * (normal.x * normal.x - normal.y * normal.y));
+    vec3 sum = vec3(0.0);
+    for(int i = 0; i < 9; i++)
+        sum += texture(lightProbes, vec3(xz.x, (y + float(i * lightProbeCount.y)) / size.y, xz.y)).rgb * basis[i];
+    return max(sum, vec3(0.0));
+}
+// GGX distribution, Smith geometry (Schlick-GGX, the k of direct light) and Schlick's Fresnel. Light colors are
+// tuned for the Phong terms, which leave out the 1/pi of Lambert: the result is scaled by pi to match them.
+vec3 CookTorrance(vec3 normal, vec3 lightDir, vec3 viewDir, vec3 albedo, vec3 diffuseColor, vec3 specularColor)
+{
+    float NdotL = max(dot(normal, lightDir), 0.0);
+    if(NdotL <= 0.0)
+        return vec3(0.0);
+    float NdotV = max(dot(normal, viewDir), 0.0001);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float NdotH = max(dot(normal, halfwayDir), 0.0);
+    float a2 = roughness * roughness * roughness * roughness;
+    float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+    float D = a2 / (PI * d * d);
+    float k = (roughness + 1.0) * (roughness + 1.0) / 8.0;
+    float G = NdotV / (NdotV * (1.0 - k) + k) * NdotL / (NdotL * (1.0 - k) + k);
+    vec3 F0 = mix(vec3(0.04), albedo, metallic);
+    vec3 F = F0 + (1.0 - F0) * pow(1.0 - max(dot(halfwayDir, viewDir), 0.0), 5.0);
+    vec3 kD = (1.0 - F) * (1.0 - metallic);
+    vec3 specular = D * G * F / (4.0 * NdotV * NdotL);
+    return (kD * albedo * diffuseColor + specular * PI * specularColor) * NdotL;
+}
+// the sky's light on a physically based material: diffuse from the spherical harmonics, specular as the split sum,
+// the prefiltered sky at the roughness' level times the BRDF's scale and bias of F0
+vec3 SkyPbr(vec3 normal, vec3 viewDir, vec3 albedo)
+{
+    float NdotV = max(dot(normal, viewDir), 0.0);
+    vec3 F0 = mix(vec3(0.04), albedo, metallic);
+    // Fresnel with roughness: rough surfaces reflect less of the sky at grazing angles
+    vec3 F = F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - NdotV, 5.0);
+    vec3 kD = (1.0 - F) * (1.0 - metallic);
+    vec3 radiance = textureLod(prefilteredSky, reflect(-viewDir, normal), roughness * (prefilteredSkyLevels - 1.0)).rgb * skyRadianceScale;
+    vec2 brdf = texture(brdfLut, vec2(NdotV, roughness)).rg;
+    return kD * SkyAmbient(normal) * albedo + radiance * (F0 * brdf.x + brdf.y);
 }
\ No newline at end of file
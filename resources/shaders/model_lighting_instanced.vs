@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per-instance attributes, see DrawData in multi_draw.h
+layout (location = 5) in mat4 aModel;
+layout (location = 9) in mat3 aNormalMatrix;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+// how much of the mesh is left while it cross-fades to its impostor, see ImpostorAtlas
+out float Coverage;
+// no lightmap, only the static batches have one
+out vec2 LightmapCoords;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+// distance band over which instances fade out to their impostors, (0, 0) when there are none
+uniform vec2 impostorFade;
+
+void main()
+{
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+    // normal matrix is precomputed on the CPU, so no inverse() per vertex
+    Normal = aNormalMatrix * aNormal;
+    TexCoords = aTexCoords;
+    float distance = length(viewPos - vec3(aModel[3]));
+    Coverage = impostorFade.y > impostorFade.x ? 1.0 - clamp((distance - impostorFade.x) / (impostorFade.y - impostorFade.x), 0.0, 1.0) : 1.0;
+    LightmapCoords = vec2(0.0);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
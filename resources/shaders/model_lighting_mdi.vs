@@ -0,0 +1,42 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// baseInstance + gl_InstanceID, see MultiDrawRenderer::resizeDrawIds
+layout (location = 12) in uint aDrawId;
+
+struct DrawData {
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout (std430, binding = 0) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+// how much of the mesh is left while it cross-fades to its impostor, see ImpostorAtlas
+out float Coverage;
+// no lightmap, only the static batches have one
+out vec2 LightmapCoords;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+// distance band over which instances fade out to their impostors, (0, 0) when there are none
+uniform vec2 impostorFade;
+
+void main()
+{
+    DrawData draw = draws[aDrawId];
+    FragPos = vec3(draw.model * vec4(aPos, 1.0));
+    Normal = mat3(draw.normalMatrix) * aNormal;
+    TexCoords = aTexCoords;
+    float distance = length(viewPos - vec3(draw.model[3]));
+    Coverage = impostorFade.y > impostorFade.x ? 1.0 - clamp((distance - impostorFade.x) / (impostorFade.y - impostorFade.x), 0.0, 1.0) : 1.0;
+    LightmapCoords = vec2(0.0);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
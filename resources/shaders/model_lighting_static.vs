@@ -0,0 +1,31 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// LIGHTMAP_ATTRIB_LOCATION
+layout (location = 13) in vec2 aLightmapCoords;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+// never fades to an impostor
+out float Coverage;
+out vec2 LightmapCoords;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// the depth pre-pass uses this shader too, both passes have to produce exactly the same depth
+invariant gl_Position;
+
+// static batches are already in world space (see StaticBatcher), no model matrix
+void main()
+{
+    FragPos = aPos;
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    Coverage = 1.0;
+    LightmapCoords = aLightmapCoords;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
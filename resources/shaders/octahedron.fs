@@ -1,7 +1,10 @@
 #version 330 core
 
+#define SURFACE_UNLIT 3
+
 in vec3 FragPos;
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 GBufferNormal;
 
 struct SpotLight {
     vec3 position;
@@ -23,8 +26,16 @@ uniform SpotLight spotLight;
 uniform vec3 myColor;
 // added spotlight here for exactly the same reason as with the icicles
 
+// deferred geometry pass: only the color and the surface kind, the spotlight cone is applied by the lighting pass
+uniform bool gBufferPass;
+
 void main()
 {
+    if(gBufferPass) {
+        FragColor = vec4(myColor, 0.0);
+        GBufferNormal = vec4(0.0, 0.0, 0.0, SURFACE_UNLIT);
+        return;
+    }
     vec3 finalColor = myColor;
     if(sl) {
         vec3 lightDir = normalize(spotLight.position - FragPos);
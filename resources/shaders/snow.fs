@@ -2,41 +2,9 @@
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
 
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-#define NR_POINT_LIGHTS 10
+#define SURFACE_GROUND 2
+
+#include "lighting_common.glsl"
 
 in vec3 FragPos;
 in vec2 TexCoords;
@@ -44,21 +12,26 @@ in vec3 TangentViewPos;
 in vec3 TangentFragPos;
 
 uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
-
+// the first bakedLightCount point lights are in the lightmap (diffuse only, see Lightmap), the loop skips them;
+// the ground is one tile of it, lightmapTransform maps TexCoords into that tile (scale, offset)
+uniform sampler2D lightmap;
+uniform int bakedLightCount;
+uniform vec4 lightmapTransform;
 
 uniform bool blinn_phong;
 uniform bool sl;
+// deferred geometry pass: the two outputs carry the G-buffer instead (see GBuffer)
+uniform bool gBufferPass;
 uniform float heightScale;
 
 uniform sampler2D diffuseMap;
 uniform sampler2D normalMap;
 uniform sampler2D depthMap;
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords);
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec2 texCoords);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo);
 
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 {
@@ -115,16 +88,37 @@ void main()
     if(texCoords.x > 1.0 || texCoords.y > 1.0 || texCoords.x < 0.0 || texCoords.y < 0.0)
         discard;
 
-    vec3 result = CalcDirLight(dirLight, normal, viewDir, texCoords);
+    // the diffuse map is read once here, not once per light
+    vec3 albedo = texture(diffuseMap, texCoords).rgb;
+    if(gBufferPass) {
+        // the normal is kept as the lighting below uses it; full specular, and shininess 8 gives the same
+        // exponents (8, or 32 for Blinn-Phong) as the ones hardcoded here
+        FragColor = vec4(albedo, 1.0);
+        BrightColor = vec4(PackNormal(normal), 8.0, SURFACE_GROUND);
+        return;
+    }
+    // the ground is flat, its geometric normal is good enough to offset the shadow lookup along
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, albedo) * ShadowFactor(FragPos, vec3(0.0, 1.0, 0.0));
 
     if(sl) {
-        result = CalcSpotLight(spotLight, normal, FragPos, viewDir, texCoords);
+        result = CalcSpotLight(spotLight, normal, FragPos, viewDir, albedo);
     }
     else {
-        for(int i = 0; i < NR_POINT_LIGHTS; i++) {
-            result += CalcPointLight(pointLights[i], normal, FragPos, viewDir, texCoords);
+        uvec2 cluster = ClusterLights(gl_FragCoord.xy, gl_FragCoord.z);
+        for(uint i = 0u; i < cluster.y; i++) {
+            int lightIndex = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+            if(lightIndex >= bakedLightCount)
+                // approximation: the ground's copies sit a little off the scene's lights (villageLights lists both in
+                // the same order), and there is no cube map of their own. PointShadow reads the scene light with the
+                // same index, from that light's position, so the snow gets the shadows of the lamp about 1 m away.
+                result += CalcPointLight(FetchLight(lightIndex), normal, FragPos, viewDir, albedo) * PointShadow(lightIndex, FragPos, vec3(0.0, 1.0, 0.0));
         }
     }
+    if(!sl && bakedLightCount > 0)
+        result += texture(lightmap, TexCoords * lightmapTransform.xy + lightmapTransform.zw).rgb * albedo;
+    // the sky needs the normal in world space: along the quad's uvs the tangent is -x, the bitangent +z
+    if(!sl)
+        result += SkyAmbient(normalize(vec3(-normal.x, normal.z, normal.y))) * albedo;
     float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
     if(brightness > 1.0)
         BrightColor = vec4(result, 1.0);
@@ -136,7 +130,7 @@ void main()
     FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo)
 {
     vec3 lightDir = normalize(light.position - fragPos);
 
@@ -152,26 +146,22 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
 
     float distance = length(light.position - fragPos);
     float correctedDistance = distance * distance;
-    float attenuation = 1.0 / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
+    float attenuation = RangeFade(distance, light.range) / (light.constant + light.linear * correctedDistance + light.quadratic * correctedDistance * correctedDistance);
 
-
-    vec3 ambient = light.ambient * texture(diffuseMap, texCoords).rgb;
-    vec3 diffuse = light.diffuse * diff * texture(diffuseMap, texCoords).rgb;
+    vec3 diffuse = light.diffuse * diff * albedo;
     vec3 specular = light.specular * spec;
 
-    ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
 
-    return (ambient + diffuse + specular);
+    return (diffuse + specular);
 }
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec2 texCoords)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo)
 {
     vec3 lightDir = normalize(-light.direction);
-    vec3 ambient = light.ambient * vec3(texture(diffuseMap, texCoords));
 
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, texCoords));
+    vec3 diffuse = light.diffuse * diff * albedo;
 
     float spec = 0.0f;
 
@@ -184,9 +174,9 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec2 texCoords)
     }
 
     vec3 specular = light.specular * spec;
-    return (ambient + diffuse + specular);
+    return (diffuse + specular);
 }
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -211,8 +201,8 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(diffuseMap, texCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, texCoords));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
     vec3 specular = light.specular * spec;
     ambient *= intensity;
     diffuse *= intensity;
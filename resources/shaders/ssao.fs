@@ -0,0 +1,68 @@
+#version 330 core
+out vec2 Occlusion;
+
+#define KERNEL_SIZE 16
+
+// linear view depth at the reduced resolution, see ssao_depth.fs
+uniform sampler2D viewDepth;
+uniform mat4 projection;
+// view space half extent of the image plane at depth 1
+uniform vec2 tanHalfFov;
+uniform float farPlane;
+// samples in the unit hemisphere around +z, see ScreenSpaceAo
+uniform vec3 kernel[KERNEL_SIZE];
+uniform float radius;
+uniform float bias;
+uniform float power;
+
+vec3 ViewPosition(ivec2 texel);
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(viewDepth, texel, 0).r;
+    // the sky is not occluded
+    if(depth >= farPlane * 0.999) {
+        Occlusion = vec2(1.0, depth);
+        return;
+    }
+    vec3 position = ViewPosition(texel);
+    // the normal from the neighbors, per axis the one closer in depth so silhouettes do not bend it
+    vec3 left = ViewPosition(texel - ivec2(1, 0));
+    vec3 right = ViewPosition(texel + ivec2(1, 0));
+    vec3 down = ViewPosition(texel - ivec2(0, 1));
+    vec3 up = ViewPosition(texel + ivec2(0, 1));
+    vec3 dx = abs(right.z - position.z) < abs(position.z - left.z) ? right - position : position - left;
+    vec3 dy = abs(up.z - position.z) < abs(position.z - down.z) ? up - position : position - down;
+    vec3 normal = normalize(cross(dx, dy));
+
+    // the kernel turned around the normal by a per pixel angle (interleaved gradient noise), the blur removes the pattern
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    vec3 randomVector = vec3(cos(angle), sin(angle), 0.0);
+    vec3 tangent = normalize(randomVector - normal * dot(randomVector, normal));
+    mat3 TBN = mat3(tangent, cross(normal, tangent), normal);
+
+    float occlusion = 0.0;
+    for(int i = 0; i < KERNEL_SIZE; i++) {
+        vec3 samplePosition = position + TBN * kernel[i] * radius;
+        vec4 clip = projection * vec4(samplePosition, 1.0);
+        vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+        if(any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+            continue;
+        float sceneDepth = texture(viewDepth, uv).r;
+        // occluded when the scene is in front of the sample; occluders far in front of the surface fade out
+        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(depth - sceneDepth));
+        occlusion += (sceneDepth <= -samplePosition.z - bias ? 1.0 : 0.0) * rangeCheck;
+    }
+    Occlusion = vec2(pow(1.0 - occlusion / float(KERNEL_SIZE), power), depth);
+}
+
+// view space position of a texel from its linear depth
+vec3 ViewPosition(ivec2 texel)
+{
+    ivec2 size = textureSize(viewDepth, 0);
+    texel = clamp(texel, ivec2(0), size - 1);
+    float depth = texelFetch(viewDepth, texel, 0).r;
+    vec2 ndc = (vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0;
+    return vec3(ndc * tanHalfFov * depth, -depth);
+}
\ No newline at end of file
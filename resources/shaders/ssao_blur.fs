@@ -0,0 +1,28 @@
+#version 330 core
+out vec2 Occlusion;
+
+// rg: ambient visibility, view depth
+uniform sampler2D occlusion;
+// (1, 0) for the horizontal pass, (0, 1) for the vertical one
+uniform ivec2 direction;
+uniform float sharpness;
+
+void main()
+{
+    const float weight[5] = float[5](0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 last = textureSize(occlusion, 0) - 1;
+    vec2 center = texelFetch(occlusion, texel, 0).rg;
+    float sum = center.r * weight[0];
+    float weights = weight[0];
+    for(int i = 1; i < 5; i++) {
+        for(int side = -1; side <= 1; side += 2) {
+            vec2 s = texelFetch(occlusion, clamp(texel + direction * i * side, ivec2(0), last), 0).rg;
+            // bilateral: the Gaussian weight falls off with the relative depth difference
+            float w = weight[i] * exp(-sharpness * abs(s.g - center.g) / center.g);
+            sum += s.r * w;
+            weights += w;
+        }
+    }
+    Occlusion = vec2(sum / weights, center.g);
+}
\ No newline at end of file
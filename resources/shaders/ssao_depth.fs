@@ -0,0 +1,22 @@
+#version 330 core
+out float LinearDepth;
+
+// the HDR pass' depth, reduced by scale in each direction
+uniform sampler2D depthMap;
+uniform int scale;
+// P[2][2] and P[3][2] of the projection, view depth = depthParams.y / (ndc z + depthParams.x)
+uniform vec2 depthParams;
+
+void main()
+{
+    // the closest depth of the block, so thin things in front (a penguin's feet) are not lost
+    ivec2 base = ivec2(gl_FragCoord.xy) * scale;
+    ivec2 last = textureSize(depthMap, 0) - 1;
+    float depth = 1.0;
+    for(int y = 0; y < scale; y++)
+    {
+        for(int x = 0; x < scale; x++)
+            depth = min(depth, texelFetch(depthMap, min(base + ivec2(x, y), last), 0).r);
+    }
+    LinearDepth = depthParams.y / (depth * 2.0 - 1.0 + depthParams.x);
+}
\ No newline at end of file
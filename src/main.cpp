@@ -13,6 +13,29 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/geometry_buffer.h>
+#include <learnopengl/multi_draw.h>
+#include <learnopengl/render_queue.h>
+#include <learnopengl/static_batch.h>
+#include <learnopengl/frustum.h>
+#include <learnopengl/spatial_grid.h>
+#include <learnopengl/occlusion.h>
+#include <learnopengl/occlusion_queries.h>
+#include <learnopengl/depth_pyramid.h>
+#include <learnopengl/gpu_culling.h>
+#include <learnopengl/impostor.h>
+#include <learnopengl/hlod.h>
+#include <learnopengl/pvs.h>
+#include <learnopengl/clustered_lights.h>
+#include <learnopengl/gbuffer.h>
+#include <learnopengl/lightmap.h>
+#include <learnopengl/light_probes.h>
+#include <learnopengl/spherical_harmonics.h>
+#include <learnopengl/shadow_map.h>
+#include <learnopengl/point_shadows.h>
+#include <learnopengl/specular_ibl.h>
+#include <learnopengl/ssao.h>
 
 #include <iostream>
 
@@ -29,7 +52,11 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 unsigned int loadTexture(const char *path, bool gammaCorrection);
 unsigned int loadCubemap(vector<std::string> faces);
 void setSpotLight(Shader& shader);
+void updateSpotLight(Shader& shader);
 void renderSnowGround();
+vector<ClusteredLights::Light> villageLights(const glm::vec3 *iglooPositions, const glm::vec3 &doorOffset, const glm::vec3 &lampOffset,
+                                             const glm::vec3 &diffuse, int lanterns);
+void setObjectLights(Shader &shader, const ClusteredLights::ObjectLightList &list);
 void renderQuad();
 
 // settings
@@ -53,10 +80,126 @@ bool spotlight = false;
 bool spotlightKeyPressed = false;
 float exposure = 0.8;
 bool bloom = false;
+bool frustumCulling = true;
+bool runGridBenchmark = false;
+bool runSkyProjectionBenchmark = false;
+// dynamic models drawn meshlet by meshlet, without the back-facing and off-screen ones
+bool meshletCulling = false;
+// penguins culled by a compute shader and drawn from GPU-written indirect commands (GL 4.3 only)
+bool gpuCulling = false;
+// far penguins and igloos drawn as baked billboards, dithered over from the mesh between the two distances
+bool impostors = true;
+float impostorFadeStart = 30.0f;
+float impostorFadeEnd = 40.0f;
+// static clusters smaller than this part of half the screen height are drawn as one simplified proxy each
+bool hlodProxies = true;
+float hlodScreenSize = 0.3f;
+// static chunks the camera's view cell can't see (baked at load) are skipped before any culling
+bool pvsCulling = true;
+// extra lanterns scattered around the village on top of the 10 igloo lamps, the clustered lights keep them affordable
+int lanternCount = 0;
+// opaque scene written to a G-buffer and lit once per pixel afterwards, instead of shading every fragment drawn
+bool deferredShading = false;
+// forward draws lit only by the lights reaching their bounds (a list per draw) instead of their clusters' lights
+bool objectLightLists = false;
+// the igloo lamps read from lightmaps baked (or loaded from the cache) on the static props and the ground the first
+// time they are read, instead of lit per fragment.
+// Lightmaps have no shadows, so they are only read while the point shadows are off (and never by the deferred pass)
+bool lightmaps = true;
+// and the penguins read them from a grid of spherical harmonics probes baked with them
+bool lightProbes = true;
+// the sun casts shadows: the static scene's map is rendered once, the penguins' small one every frame they move
+bool shadows = true;
+// and the point lights lit per fragment, from cube faces in an atlas of which at most this many are rendered per frame
+bool pointShadows = true;
+int pointShadowFaceBudget = 12;
+// the glTF props (metallic/roughness maps) are shaded physically based with the sky's specular light, or with Phong
+bool pbrShading = true;
+// contact shading from screen-space ambient occlusion, computed at 1/2 or 1/4 of the resolution
+bool ambientOcclusion = true;
+int ambientOcclusionScale = 2;
+// occlusion culling on the CPU (software rasterizer), on the GPU (occlusion queries) or against last frame's depth (Hi-Z)
+enum OcclusionMode {
+    OCCLUSION_OFF,
+    OCCLUSION_CPU,
+    OCCLUSION_GPU,
+    OCCLUSION_HIZ
+};
+int occlusionMode = OCCLUSION_CPU;
 bool bloomKeyPressed = false;
 bool waddle = false;
 bool waddleKeyPressed = false;
 
+struct RenderStats {
+    // everything the multi-draw renderer issued, shadow passes included
+    unsigned int modelDrawCalls = 0;
+    unsigned int queuePackets = 0;
+    unsigned int queueStateChanges = 0;
+    unsigned int retainedPackets = 0;
+    unsigned int staticChunks = 0;
+    unsigned int staticTriangles = 0;
+    unsigned int visibleObjects = 0;
+    unsigned int culledObjects = 0;
+    float gridUpdateMs = 0.0f;
+    float gridQueryMs = 0.0f;
+    unsigned int gridCellsVisited = 0;
+    unsigned int gridObjectsTested = 0;
+    unsigned int occludedObjects = 0;
+    float occlusionMs = 0.0f;
+    unsigned int queriesIssued = 0;
+    unsigned int queriesInFlight = 0;
+    unsigned int queriesSkipped = 0;
+    unsigned int secondChanceObjects = 0;
+    unsigned int hizAge = 0;
+    unsigned int gpuCulledInstances = 0;
+    unsigned int meshletsTested = 0;
+    unsigned int meshletsCulled = 0;
+    unsigned int meshletTriangles = 0;
+    unsigned int meshletTrianglesTotal = 0;
+    unsigned int impostorInstances = 0;
+    unsigned int impostorChunks = 0;
+    unsigned int hlodProxies = 0;
+    unsigned int hlodChunksReplaced = 0;
+    unsigned int hlodTriangles = 0;
+    int pvsCell = -1;
+    unsigned int pvsCulled = 0;
+    unsigned int lights = 0;
+    unsigned int visibleLights = 0;
+    unsigned int lightAssignments = 0;
+    unsigned int maxLightsPerCluster = 0;
+    float lightClusteringMs = 0.0f;
+    unsigned int objectListDraws = 0;
+    unsigned int objectListLights = 0;
+    unsigned int objectListFallbacks = 0;
+    unsigned int bakedLights = 0;
+    unsigned int lightmapSurfaces = 0;
+    unsigned int lightmapTexels = 0;
+    float lightmapBakeMs = 0.0f;
+    bool lightmapsCached = false;
+    unsigned int lightProbes = 0;
+    float lightProbeBakeMs = 0.0f;
+    bool lightProbesCached = false;
+    float skyProjectionMs = 0.0f;
+    float iblBakeMs = 0.0f;
+    bool iblCached = false;
+    unsigned int shadowStaticRenders = 0;
+    unsigned int shadowCasters = 0;
+    float shadowStaticMs = 0.0f;
+    float shadowDynamicMs = 0.0f;
+    unsigned int pointShadowLights = 0;
+    unsigned int pointShadowFaces = 0;
+    unsigned int pointShadowFacesPending = 0;
+    float pointShadowAtlasUsage = 0.0f;
+    float pointShadowMs = 0.0f;
+    unsigned int ssaoWidth = 0;
+    unsigned int ssaoHeight = 0;
+    float ssaoDepthMs = 0.0f;
+    float ssaoOcclusionMs = 0.0f;
+    float ssaoBlurMs = 0.0f;
+    float ssaoCompositeMs = 0.0f;
+};
+RenderStats renderStats;
+
 struct ProgramState {
     glm::vec3 clearColor = glm::vec3(0.1);
     bool ImGuiEnabled = false;
@@ -94,7 +237,8 @@ int main() {
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // ask for 4.3 first (multi-draw indirect + SSBOs), the renderer falls back to a 3.3 path if we don't get it
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -105,6 +249,11 @@ int main() {
     // glfw window creation
     // --------------------
     GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Arctic", NULL, NULL);
+    if (window == NULL) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Arctic", NULL, NULL);
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -124,6 +273,9 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    loadGLExtensions((GLADloadproc) glfwGetProcAddress);
+    std::cout << "OpenGL " << GLVersion.major << "." << GLVersion.minor
+              << (glExtensions.multiDrawIndirect ? ", using multi-draw indirect" : ", using the 3.3 fallback path") << std::endl;
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
@@ -155,6 +307,9 @@ int main() {
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
 
+    // the prefiltered sky's coarse levels are only a few texels wide, filtering across the face edges hides them
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
     // translation vectors for each of the igloo houses
     glm::vec3 iglooPositions[] = {
             glm::vec3(-3.0f, 0.1f, 5.5f),
@@ -201,13 +356,28 @@ int main() {
 
     // build and compile shaders
     // -------------------------
-    Shader modelShader("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs");
+    Shader modelShader(glExtensions.multiDrawIndirect ? "resources/shaders/model_lighting_mdi.vs" : "resources/shaders/model_lighting_instanced.vs",
+                       "resources/shaders/model_lighting.fs");
+    Shader staticBatchShader("resources/shaders/model_lighting_static.vs", "resources/shaders/model_lighting.fs");
+    Shader staticDepthShader("resources/shaders/model_lighting_static.vs", "resources/shaders/depth_only.fs");
+    Shader boundingBoxShader("resources/shaders/bounding_box.vs", "resources/shaders/depth_only.fs");
+    Shader depthPyramidShader("resources/shaders/depth_pyramid.vs", "resources/shaders/depth_pyramid.fs");
+    // the multi-draw models' instances into the shadow maps
+    Shader modelDepthShader(glExtensions.multiDrawIndirect ? "resources/shaders/model_lighting_mdi.vs" : "resources/shaders/model_lighting_instanced.vs",
+                            "resources/shaders/depth_only.fs");
+    Shader impostorBakeShader("resources/shaders/impostor_bake.vs", "resources/shaders/impostor_bake.fs");
+    Shader impostorShader("resources/shaders/impostor.vs", "resources/shaders/impostor.fs");
+    Shader hlodShader("resources/shaders/hlod_proxy.vs", "resources/shaders/hlod_proxy.fs");
     Shader octahedronShader("resources/shaders/octahedron.vs", "resources/shaders/octahedron.fs");
     Shader blendingShader("resources/shaders/blending.vs", "resources/shaders/blending.fs");
     Shader skyBoxShader("resources/shaders/sky_box.vs", "resources/shaders/sky_box.fs");
     Shader snowShader("resources/shaders/snow.vs", "resources/shaders/snow.fs");
     Shader blurShader("resources/shaders/blur.vs", "resources/shaders/blur.fs");
     Shader finalScreenShader("resources/shaders/final_screen.vs", "resources/shaders/final_screen.fs");
+    Shader ssaoDepthShader("resources/shaders/depth_pyramid.vs", "resources/shaders/ssao_depth.fs");
+    Shader ssaoShader("resources/shaders/depth_pyramid.vs", "resources/shaders/ssao.fs");
+    Shader ssaoBlurShader("resources/shaders/depth_pyramid.vs", "resources/shaders/ssao_blur.fs");
+    Shader deferredLightingShader("resources/shaders/deferred_lighting.vs", "resources/shaders/deferred_lighting.fs");
     // load models
     // -----------
     Model penguinModel("resources/objects/pingvin/pingvin.obj");
@@ -219,6 +389,171 @@ int main() {
     iceBlockModel.SetShaderTextureNamePrefix("material.");
     Model stoneModel("resources/objects/stone/scene.gltf");
     stoneModel.SetShaderTextureNamePrefix("material.");
+
+    // igloos, stones and ice blocks never move, so their transforms are built once and baked into static batches
+    vector<glm::mat4> iglooTransforms;
+    vector<glm::mat4> stoneTransforms;
+    vector<glm::mat4> iceBlockTransforms;
+    vector<glm::mat4> penguinTransforms;
+    float penguinAngles[15];
+    {
+        glm::mat4 model;
+        unsigned int sign = -1;
+        // 5 igloo houses
+        for(int i = 0; i < 5; i++) {
+            sign *= -1;
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, iglooPositions[i] + glm::vec3(10.0f, 0.0f, 3.0f));
+            model = glm::rotate(model, (float)glm::radians(-45.0f + sign * (3 * i + 15)), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            iglooTransforms.push_back(model);
+        }
+        // 5 more igloo houses
+        for(int i = 0; i < 5; i++) {
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, iglooPositions[i]);
+            model = glm::rotate(model, (float)glm::radians(-25.0f + 4 * i), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(1.2f));
+            iglooTransforms.push_back(model);
+        }
+        // penguins can waddle, so only their resting orientation is precomputed here
+        for(int i = 0; i < 15; i++) {
+            sign *= -1;
+            penguinAngles[i] = (float)glm::radians(25.0f + sign * 2 * i);
+        }
+        // 6 stones
+        for(int i = 0; i < 6; i++) {
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, stonePositions[i]);
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(0.0007f));
+            stoneTransforms.push_back(model);
+        }
+        // 5 ice blocks
+        for(int i = 0; i < 5; i++) {
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, iceBlockPositions[i]);
+            model = glm::rotate(model, (float)glm::radians(225.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(0.5f));
+            iceBlockTransforms.push_back(model);
+        }
+    }
+
+    // immovable props are pre-transformed into merged buffers, one draw per material and 16x16 chunk
+    // the igloo lamps never move, so their light on these props is baked into a lightmap; the lanterns are placed
+    // at runtime and stay dynamic. villageLights lists the lamps first, the lit shaders skip that many lights.
+    vector<ClusteredLights::Light> bakedLights = villageLights(iglooPositions, glm::vec3(0.0f, 0.2f, 0.0f), glm::vec3(10.0f, 0.2f, 3.0f),
+                                                               glm::vec3(18.0f, 18.0f, 0.0f), 0);
+    Lightmap staticLightmap(1024, 1024, 16.0f);
+    StaticBatcher staticBatches(16.0f);
+    staticBatches.Add(iglooModel, iglooTransforms, &staticLightmap);
+    staticBatches.Add(stoneModel, stoneTransforms, &staticLightmap);
+    staticBatches.Add(iceBlockModel, iceBlockTransforms, &staticLightmap);
+    staticBatches.Build();
+    // what moves through that light gets it from probes a meter apart, over the lamps' reach up to penguin height
+    glm::vec3 probeMin, probeMax;
+    LightProbeGrid::LightBounds(bakedLights, 0.0f, 2.0f, probeMin, probeMax);
+    LightProbeGrid probeGrid(probeMin, probeMax, 1.0f);
+    renderStats.lightProbes = probeGrid.ProbeCount();
+    renderStats.staticChunks = staticBatches.Chunks().size();
+    renderStats.staticTriangles = staticBatches.TriangleCount();
+    // the same instances, clustered by the same cells, merged and simplified into one proxy per cluster
+    HlodBuilder hlod(16.0f);
+    hlod.Add(iglooModel, iglooTransforms);
+    hlod.Add(stoneModel, stoneTransforms);
+    hlod.Add(iceBlockModel, iceBlockTransforms);
+    hlod.Build();
+
+    // bounds for frustum culling: the chunk boxes are already in world space and never change
+    BoxBatch chunkBoxes;
+    for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++)
+        chunkBoxes.Add(staticBatches.Chunks()[i].boundsMin, staticBatches.Chunks()[i].boundsMax);
+    vector<unsigned char> chunkVisible;
+    vector<unsigned char> penguinVisible;
+    // moving objects are found through a loose grid over the ground, so culling doesn't test every one of them
+    SpatialGrid objectGrid(glm::vec2(-60.0f), glm::vec2(60.0f), 4.0f);
+    vector<unsigned int> penguinHandles;
+    for(int i = 0; i < 15; i++)
+        penguinHandles.push_back(objectGrid.Insert(penguinPositions[i], penguinModel.bounds.Radius, i));
+    vector<unsigned int> visibleIds;
+
+    // igloo domes hide a lot behind them, their proxies are rasterized on the CPU for occlusion culling
+    OccluderBox iglooOccluder = BuildOccluderBox(iglooModel);
+    vector<glm::vec3> occluderTriangles;
+    for(unsigned int i = 0; i < iglooTransforms.size(); i++)
+        AppendOccluderTriangles(iglooOccluder, iglooTransforms[i], occluderTriangles);
+    OcclusionCuller occlusionCuller;
+    occlusionCuller.SetOccluders(occluderTriangles);
+    // the same occluders, used offline: which chunks can be seen at all from each 2x2 cell of the area around the
+    // village. The bake is cached next to the other resources and redone only when the scene changes.
+    vector<glm::vec3> pvsTargetMin, pvsTargetMax;
+    glm::vec3 sceneMin(1e30f), sceneMax(-1e30f);
+    for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++) {
+        pvsTargetMin.push_back(staticBatches.Chunks()[i].boundsMin);
+        pvsTargetMax.push_back(staticBatches.Chunks()[i].boundsMax);
+        sceneMin = glm::min(sceneMin, staticBatches.Chunks()[i].boundsMin);
+        sceneMax = glm::max(sceneMax, staticBatches.Chunks()[i].boundsMax);
+    }
+    PotentiallyVisibleSet pvs(glm::vec3(sceneMin.x - 16.0f, 0.0f, sceneMin.z - 16.0f), glm::vec3(sceneMax.x + 16.0f, 6.0f, sceneMax.z + 16.0f), 2.0f);
+    uint64_t pvsSignature = pvs.Signature(occluderTriangles, pvsTargetMin, pvsTargetMax, 64);
+    if(!pvs.Load("resources/pvs.bin", pvsSignature)) {
+        pvs.Bake(occluderTriangles, pvsTargetMin, pvsTargetMax, 64);
+        pvs.Save("resources/pvs.bin", pvsSignature);
+        std::cout << "PVS: baked " << pvs.CellCount() << " cells x " << pvs.TargetCount() << " chunks in "
+                  << pvs.BakeMilliseconds() << " ms" << std::endl;
+    }
+    // the sun's shadows, fitted to the static chunks and the penguins, deep enough to reach the ground under them
+    DirectionalShadows sunShadows;
+    sunShadows.SetDirection(glm::vec3(-4.0f, -0.5f, -1.5f));
+    const glm::vec3 groundMin(-60.0f, 0.0f, -60.0f), groundMax(60.0f, 0.1f, 60.0f);
+    vector<glm::mat4> shadowedPenguins;
+    BoxBatch occludees;
+    vector<unsigned int> occludeePenguins;
+    vector<unsigned int> occludeeChunks;
+    // GPU alternative: one query slot per static chunk, followed by one per penguin
+    OcclusionQueries gpuOcclusion;
+    gpuOcclusion.Resize(staticBatches.Chunks().size() + 15);
+    const unsigned int firstPenguinQuery = staticBatches.Chunks().size();
+    // Hi-Z: objects are tested against the depth pyramid of an earlier frame, what it culls gets a second chance
+    // (an occlusion query against this frame's depth, same slots as above) after the opaque pass
+    DepthPyramid depthPyramid(SCR_WIDTH, SCR_HEIGHT);
+    OcclusionQueries secondChance;
+    secondChance.Resize(staticBatches.Chunks().size() + 15);
+    vector<unsigned int> secondChanceChunks;
+    vector<unsigned int> secondChancePenguins;
+    vector<glm::mat4> visiblePenguins;
+
+    // the animated models go into one shared vertex/index buffer behind a single VAO
+    GeometryBuffer sceneGeometry(1 << 16, 1 << 17);
+    MultiDrawRenderer sceneRenderer(sceneGeometry, glExtensions.multiDrawIndirect);
+    sceneRenderer.AddModel(penguinModel);
+    // every surviving meshlet range is its own command: one multi-draw on 4.3, but a draw call each on 3.3
+    meshletCulling = glExtensions.multiDrawIndirect;
+    // with compute shaders the penguins can instead be culled and compacted on the GPU, out of the same geometry
+    ComputeShader *gpuCullShader = NULL;
+    GpuInstanceCuller *gpuPenguins = NULL;
+    if(glExtensions.computeShaders) {
+        gpuCullShader = new ComputeShader("resources/shaders/gpu_cull.cs");
+        gpuPenguins = new GpuInstanceCuller(sceneGeometry, sceneRenderer, penguinModel);
+    }
+    // far away penguins and igloos become billboards, both models are baked into their atlases once here
+    // (the igloo turned upright first, its instances only add a rotation about y on top of that)
+    ImpostorAtlas penguinImpostors(penguinModel, sceneGeometry, impostorBakeShader);
+    glm::mat4 iglooUpright = glm::rotate(glm::mat4(1.0f), (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    iglooUpright = glm::rotate(iglooUpright, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    ImpostorAtlas iglooImpostors(iglooModel, sceneGeometry, impostorBakeShader, iglooUpright);
+    // igloos are baked into the static chunks, so a chunk of igloo meshes is swapped out only once all of it is past the fade
+    vector<unsigned char> iglooChunk;
+    for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++)
+        iglooChunk.push_back(staticBatches.Chunks()[i].model == &iglooModel);
+
+    RenderQueue renderQueue;
     // vertices for octahedron that have only one attribute (position attribute) and since many of the vertices are repeated I used EBO.
     float vertices[] = {
             0.0f, 0.5f, 0.0f, // 0
@@ -349,6 +684,80 @@ int main() {
     unsigned int normalMap  = loadTexture("resources/textures/snow01_normal_4k.jpg", false);
     unsigned int heightMap  = loadTexture("resources/textures/snow01_height_4k.jpg", false);
 
+    // the ground's own copies of the lamps, baked into one tile over the whole quad of renderSnowGround. snow.fs
+    // lights it with the normal map's values as they are, so the bake reads them back too (a small mip is enough
+    // at a lightmap texel per 23 cm)
+    Lightmap groundLightmap(512, 512, 16.0f, 16, 512);
+    {
+        vector<glm::vec3> positions = {glm::vec3(60.0f, 0.08f, 60.0f), glm::vec3(60.0f, 0.08f, -60.0f),
+                                       glm::vec3(-60.0f, 0.08f, -60.0f), glm::vec3(-60.0f, 0.08f, 60.0f)};
+        vector<glm::vec3> normals(4, glm::vec3(0.0f, 1.0f, 0.0f));
+        vector<glm::vec2> uvs = {glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 0.0f), glm::vec2(1.0f, 1.0f)};
+        vector<unsigned int> indices = {0, 1, 2, 0, 2, 3};
+        groundLightmap.AddSurface(positions, normals, uvs, indices);
+    }
+    vector<ClusteredLights::Light> groundBakedLights = villageLights(iglooPositions, glm::vec3(0.0f, 0.2f, 1.0f), glm::vec3(10.0f, 0.2f, 4.0f),
+                                                                     glm::vec3(0.8f, 0.8f, 0.0f), 0);
+    renderStats.bakedLights = bakedLights.size();
+    renderStats.lightmapSurfaces = staticLightmap.SurfaceCount() + groundLightmap.SurfaceCount();
+    // nothing reads the lightmaps or the probes while the lamps are lit per fragment (with point shadows, the default,
+    // or deferred shading), so they are loaded from their caches, or baked and cached, only the first frame that does
+    auto loadLightmaps = [&]() {
+        uint64_t staticSignature = staticLightmap.Signature(bakedLights);
+        bool staticCached = staticLightmap.Load("resources/lightmap.bin", staticSignature);
+        if(!staticCached) {
+            staticLightmap.Bake(bakedLights);
+            staticLightmap.Save("resources/lightmap.bin", staticSignature);
+        }
+        staticLightmap.Upload();
+
+        int mapWidth = 0, mapHeight = 0;
+        vector<unsigned char> normalTexels;
+        glBindTexture(GL_TEXTURE_2D, normalMap);
+        for(int level = 3; level >= 0; level--) {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &mapWidth);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &mapHeight);
+            if(mapWidth > 0 && mapHeight > 0) {
+                normalTexels.resize(4 * mapWidth * mapHeight);
+                glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, &normalTexels[0]);
+                break;
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        Lightmap::ShadingNormal shadingNormal;
+        uint64_t groundSignature = groundLightmap.Signature(groundBakedLights);
+        if(!normalTexels.empty()) {
+            shadingNormal = [&normalTexels, mapWidth, mapHeight](const glm::vec2 &uv, const glm::vec3 &) {
+                int x = glm::clamp((int)(uv.x * mapWidth), 0, mapWidth - 1);
+                int y = glm::clamp((int)(uv.y * mapHeight), 0, mapHeight - 1);
+                const unsigned char *texel = &normalTexels[4 * (y * mapWidth + x)];
+                return glm::normalize(glm::vec3(texel[0], texel[1], texel[2]) / 255.0f * 2.0f - 1.0f);
+            };
+            groundSignature = BakeSignature(groundSignature, &normalTexels[0], normalTexels.size());
+        }
+        bool groundCached = groundLightmap.Load("resources/ground_lightmap.bin", groundSignature);
+        if(!groundCached) {
+            groundLightmap.Bake(groundBakedLights, 0, shadingNormal);
+            groundLightmap.Save("resources/ground_lightmap.bin", groundSignature);
+        }
+        groundLightmap.Upload();
+
+        renderStats.lightmapsCached = staticCached && groundCached;
+        renderStats.lightmapTexels = staticLightmap.CoveredTexels() + groundLightmap.CoveredTexels();
+        renderStats.lightmapBakeMs = (staticCached ? 0.0f : staticLightmap.BakeMilliseconds()) + (groundCached ? 0.0f : groundLightmap.BakeMilliseconds());
+    };
+    auto loadLightProbes = [&]() {
+        uint64_t probeSignature = probeGrid.Signature(bakedLights);
+        renderStats.lightProbesCached = probeGrid.Load("resources/light_probes.bin", probeSignature);
+        if(!renderStats.lightProbesCached) {
+            probeGrid.Bake(bakedLights);
+            probeGrid.Save("resources/light_probes.bin", probeSignature);
+            renderStats.lightProbeBakeMs = probeGrid.BakeMilliseconds();
+        }
+        probeGrid.Upload();
+    };
+
     stbi_set_flip_vertically_on_load(false);
 
     vector<std::string> faces
@@ -362,6 +771,27 @@ int main() {
     };
 
     unsigned int cubeMap = loadCubemap(faces);
+    // the ambient light is the sky's, projected into spherical harmonics once: it keeps the sky's colors and
+    // directions, at the brightness the constant ambient of the lights had
+    std::chrono::high_resolution_clock::time_point skyStart = std::chrono::high_resolution_clock::now();
+    CubemapPixels skyPixels = CubemapPixels::Read(cubeMap);
+    SphericalHarmonics skyAmbient = CubemapProjection::Project(skyPixels);
+    float skyLuminance = glm::dot(skyAmbient.Average(), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    float skyScale = skyLuminance > 0.0f ? 0.05f / skyLuminance : 1.0f;
+    skyAmbient.Scale(skyScale);
+    renderStats.skyProjectionMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - skyStart).count();
+    // and its specular light for the physically based materials, baked once and cached like the PVS
+    SpecularIbl ibl;
+    uint64_t iblSignature = ibl.Signature(skyPixels);
+    renderStats.iblCached = ibl.Load("resources/specular_ibl.bin", iblSignature);
+    if(!renderStats.iblCached) {
+        ibl.Bake(skyPixels);
+        ibl.Save("resources/specular_ibl.bin", iblSignature);
+        renderStats.iblBakeMs = ibl.BakeMilliseconds();
+        std::cout << "Specular IBL: baked BRDF table and prefiltered sky in " << ibl.BakeMilliseconds() << " ms" << std::endl;
+    }
+    ibl.Upload();
+    skyPixels = CubemapPixels();
     skyBoxShader.use();
     skyBoxShader.setInt("skybox", 0);
 
@@ -388,12 +818,16 @@ int main() {
         // attach texture to framebuffer
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
     }
-    // for depth buffer we'll use renderbuffer instead of texture
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    // depth is a texture (not a renderbuffer) so the depth pyramid can be built from it
+    unsigned int depthTexture;
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
     // tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
     unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
     glDrawBuffers(2, attachments);
@@ -401,6 +835,8 @@ int main() {
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the deferred path draws the opaque scene here first, its lighting pass then writes into the same color buffers
+    GBuffer gBuffer(SCR_WIDTH, SCR_HEIGHT, depthTexture, colorBuffers);
 
     // ping-pong-framebuffer for blurring
     unsigned int pingpongFBO[2];
@@ -427,6 +863,162 @@ int main() {
     finalScreenShader.use();
     finalScreenShader.setInt("hdrColorBuffer", 0);
     finalScreenShader.setInt("blurColorBuffer", 1);
+    // ambient occlusion from the HDR pass' depth, upsampled in the final pass
+    ScreenSpaceAo ssao(SCR_WIDTH, SCR_HEIGHT, ambientOcclusionScale);
+
+    // the point lights are clustered: every frame each froxel of the view gets the list of lights reaching it.
+    // The snow has always had its own, dimmer copies of the igloo lamps a little further out, so it gets its own set.
+    ClusteredLights sceneLights(SCR_WIDTH, SCR_HEIGHT, 0.1f, 100.0f);
+    ClusteredLights groundLights(SCR_WIDTH, SCR_HEIGHT, 0.1f, 100.0f);
+    int placedLanterns = -1;
+    // per-object light lists: the static chunks and HLOD clusters keep theirs until the lights change,
+    // the penguins get one union list for their instanced draws every frame (and one for their Hi-Z second chance)
+    vector<ClusteredLights::ObjectLightList> chunkLights, hlodLights;
+    ClusteredLights::ObjectLightList penguinLights, secondChanceLights;
+    vector<glm::vec3> penguinBoxMin, penguinBoxMax;
+    // their shadows: the blocks are sized and placed every frame, faces only rendered again when a penguin moved
+    // through them (the scene's set; the ground's copies of the lights read the same shadows by index)
+    PointShadowAtlas lightShadows;
+    vector<PointShadowAtlas::Caster> movingCasters;
+    vector<glm::mat4> lightShadowPenguins;
+
+    // uniforms that never change are set once, the render loop only updates camera dependent ones
+    Shader *litShaders[] = {&modelShader, &staticBatchShader, &impostorShader, &hlodShader, &deferredLightingShader};
+    for(Shader *litShader : litShaders) {
+        Shader &shader = *litShader;
+        shader.use();
+        shader.setFloat("material.shininess", 8.0);
+        shader.setVec3("dirLight.direction", -4.0f, -0.5f, -1.5f);
+        shader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
+        shader.setVec3("dirLight.diffuse", 0.01f, 0.01f, 0.01f);
+        shader.setVec3("dirLight.specular", 0.4f, 0.4f, 0.4f);
+        setSpotLight(shader);
+        sceneLights.SetUniforms(shader);
+        glUniform3fv(glGetUniformLocation(shader.ID, "skyAmbient"), SH_COEFFICIENTS, &skyAmbient.c[0].x);
+    }
+
+    staticBatchShader.use();
+    staticBatchShader.setInt("lightmap", LIGHTMAP_UNIT);
+    staticBatchShader.setBool("lightmapped", true);
+    // never read here, but left on unit 0 the probes' sampler3D would share it with the diffuse map's sampler2D
+    staticBatchShader.setInt("lightProbes", LIGHT_PROBE_UNIT);
+    modelShader.use();
+    probeGrid.SetUniforms(modelShader);
+    // the skyAmbient irradiance treats albedo as Lambert without 1/pi, the sky's radiance gets pi of the same scale
+    Shader *pbrShaders[] = {&modelShader, &staticBatchShader};
+    for(Shader *pbrShader : pbrShaders) {
+        pbrShader->use();
+        ibl.SetUniforms(*pbrShader);
+        pbrShader->setFloat("skyRadianceScale", 3.141593f * skyScale);
+    }
+    // the far away impostors and HLOD proxies go without
+    Shader *shadowedShaders[] = {&modelShader, &staticBatchShader, &snowShader, &deferredLightingShader};
+    for(Shader *shadowedShader : shadowedShaders) {
+        shadowedShader->use();
+        DirectionalShadows::SetSamplers(*shadowedShader);
+        PointShadowAtlas::SetUniforms(*shadowedShader);
+    }
+
+    octahedronShader.use();
+    setSpotLight(octahedronShader);
+
+    blendingShader.use();
+    blendingShader.setInt("texture1", 0);
+    setSpotLight(blendingShader);
+
+    snowShader.use();
+    setSpotLight(snowShader);
+    groundLights.SetUniforms(snowShader);
+    glUniform3fv(glGetUniformLocation(snowShader.ID, "skyAmbient"), SH_COEFFICIENTS, &skyAmbient.c[0].x);
+    snowShader.setVec3("dirLight.direction", -4.0f, -0.5f, -1.5f);
+    snowShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
+    snowShader.setVec3("dirLight.diffuse", 0.01f, 0.01f, 0.01f);
+    snowShader.setVec3("dirLight.specular", 0.4f, 0.4f, 0.4f);
+    snowShader.setMat4("model", glm::mat4(1.0f));
+    snowShader.setInt("lightmap", GROUND_LIGHTMAP_UNIT);
+    snowShader.setVec4("lightmapTransform", groundLightmap.TileTransform(0));
+
+    // everything except the penguins is static: it is recorded into a draw list once and
+    // replayed every frame, only the octahedron color (animated) is read through a reference
+    glm::vec3 colorStart(0.529f, 0.808f, 0.922f);
+    glm::vec3 colorEnd(0.2549f, 0.4118f, 0.8824f);
+    glm::vec3 octahedronColor = colorStart;
+    DrawList staticScene;
+    vector<unsigned int> chunkDraws;
+    for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++) {
+        chunkDraws.push_back(staticScene.Record(PASS_OPAQUE, staticBatches.ChunkCenter(i), staticBatchShader, staticBatches.VAO, staticBatches.Chunks()[i].materialId, false,
+                           [&staticBatches, &gpuOcclusion, &staticBatchShader, &chunkLights, i]() {
+            setObjectLights(staticBatchShader, chunkLights[i]);
+            if(occlusionMode == OCCLUSION_GPU)
+                gpuOcclusion.DrawConditional(i, [&staticBatches, i]() { staticBatches.DrawChunk(i); });
+            else
+                staticBatches.DrawChunk(i);
+        },
+                           [&staticBatches, &staticBatchShader, i]() { staticBatches.BindMaterial(staticBatchShader, i); }));
+    }
+    for(int i = 0; i < 5; i++) {
+        glm::vec3 position = iglooPositions[i] + glm::vec3(-1.0f, 0.08f, 1.8f);
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, position);
+        model = glm::rotate(model, (float) glm::radians(50.0), glm::vec3(0.7, 0.8, 0.2));
+        model = glm::scale(model, glm::vec3(0.2f));
+        staticScene.Record(PASS_OPAQUE, position, octahedronShader, VAO, 0, false,
+                           [&octahedronShader, &octahedronColor, model]() {
+            octahedronShader.setMat4("model", model);
+
+            octahedronShader.setVec3("myColor", octahedronColor);
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
+
+            octahedronShader.setVec3("myColor", glm::vec3(0.0f, 0.0f, 0.0f));
+            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
+
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        });
+    }
+
+    // the ground spans the whole view and lies under everything else, keyed as far away so the
+    // expensive parallax shader runs after the objects standing on it have filled the depth buffer
+    staticScene.RecordAtDepth(PASS_OPAQUE, renderQueue.farPlane, snowShader, 0, diffuseMap, true,
+                              [&groundLights, &sceneLights]() {
+        // the ground reads its own light set, everything after it the scene's again
+        groundLights.Bind();
+        renderSnowGround();
+        sceneLights.Bind();
+    },
+                              [diffuseMap, normalMap, heightMap]() {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, diffuseMap);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, normalMap);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, heightMap);
+    });
+
+    staticScene.RecordAtDepth(PASS_SKY, 0.0f, skyBoxShader, skyBoxVAO, cubeMap, false,
+                              []() { glDrawArrays(GL_TRIANGLES, 0, 36); },
+                              [cubeMap]() {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+    });
+
+    // icicles are blended, the queue draws them back to front after everything opaque
+    for (unsigned int i = 0; i < locationOfIcicles.size(); i++) {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, locationOfIcicles[i]);
+        model = glm::rotate(model, (float)glm::radians(-45.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(0.65f));
+        staticScene.Record(PASS_TRANSPARENT, locationOfIcicles[i], blendingShader, transparentVAO, transparentTexture, false,
+                           [&blendingShader, model]() {
+            blendingShader.setMat4("model", model);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        },
+                           [transparentTexture]() {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, transparentTexture);
+        });
+    }
 
     while (!glfwWindowShouldClose(window)) {
         // per-frame time logic
@@ -445,216 +1037,642 @@ int main() {
         glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        std::map<float, glm::vec3> sorted;
-        for (unsigned int i = 0; i < locationOfIcicles.size(); i++)
-        {
-            float distance = glm::length(programState->camera.Position - locationOfIcicles[i]);
-            sorted[distance] = locationOfIcicles[i];
-        }
-
-        modelShader.use();
         // view/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
                                                 (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = programState->camera.GetViewMatrix();
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-
-        modelShader.setVec3("viewPos", programState->camera.Position);
-        modelShader.setFloat("material.shininess", 8.0);
-
-        modelShader.setVec3("dirLight.direction", -4.0f, -0.5f, -1.5f);
-        modelShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-        modelShader.setVec3("dirLight.diffuse", 0.01f, 0.01f, 0.01f);
-        modelShader.setVec3("dirLight.specular", 0.4f, 0.4f, 0.4f);
-
-        modelShader.setBool("blinn_phong", blinn);
-        if(blinn)
-            std::cout << " The scene is currently lit by Blinn-Phong's lighting model" << std::endl;
-        else
-            std::cout << " The scene is currently lit by Phong's lighting model" << std::endl;
+        glm::vec3 viewPos = programState->camera.Position;
 
-        setSpotLight(modelShader);
+        // only the penguins move, so theirs are the only transforms sent every frame
         glm::mat4 model;
-        unsigned int sign = -1;
-        // drawing 5 igloo houses
-        for(int i = 0; i < 5; i++) {
-            modelShader.setVec3("pointLights[" + std::to_string(i+5) + "].position", iglooPositions[i] + glm::vec3(10.0f, 0.2f, 3.0f));
-            modelShader.setVec3("pointLights[" + std::to_string(i+5) + "].ambient", 0.05f, 0.05f, 0.05f);
-            modelShader.setVec3("pointLights[" + std::to_string(i+5) + "].diffuse", 18.0f, 18.0f, 0.0f);
-            modelShader.setVec3("pointLights[" + std::to_string(i+5) + "].specular", 0.8f, 0.8f, 0.8f);
-            modelShader.setFloat("pointLights[" + std::to_string(i+5) + "].constant", 1.0f);
-            modelShader.setFloat("pointLights[" + std::to_string(i+5) + "].linear", 0.22f);
-            modelShader.setFloat("pointLights[" + std::to_string(i+5) + "].quadratic", 0.20f);
-            sign *= -1;
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, iglooPositions[i] + glm::vec3(10.0f, 0.0f, 3.0f));
-            model = glm::rotate(model, (float)glm::radians(-45.0f + sign * (3 * i + 15)), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelShader.setMat4("model", model);
-            iglooModel.Draw(modelShader);
-        }
-        // drawing 5 more igloo houses
-        for(int i = 0; i < 5; i++) {
-            modelShader.setVec3("pointLights[" + std::to_string(i) + "].position", iglooPositions[i] + glm::vec3(0.0f, 0.2f, 0.0f));
-            modelShader.setVec3("pointLights[" + std::to_string(i) + "].ambient", 0.05f, 0.05f, 0.05f);
-            modelShader.setVec3("pointLights[" + std::to_string(i) + "].diffuse", 18.0f, 18.0f, 0.0f);
-            modelShader.setVec3("pointLights[" + std::to_string(i) + "].specular", 0.8f, 0.8f, 0.8f);
-            modelShader.setFloat("pointLights[" + std::to_string(i) + "].constant", 1.0f);
-            modelShader.setFloat("pointLights[" + std::to_string(i) + "].linear", 0.22f);
-            modelShader.setFloat("pointLights[" + std::to_string(i) + "].quadratic", 0.20f);
-
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, iglooPositions[i]);
-            model = glm::rotate(model, (float)glm::radians(-25.0f + 4 * i), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::scale(model, glm::vec3(1.2f));
-            modelShader.setMat4("model", model);
-            iglooModel.Draw(modelShader);
-        }
-
-        // drawing 15 pinguins
+        penguinTransforms.clear();
         for(int i = 0; i < 15; i++) {
-            sign *= -1;
             model = glm::mat4(1.0f);
             model = glm::translate(model, penguinPositions[i]);
             if(waddle)
                 model = glm::rotate(model, (float)(1.5*sin(glfwGetTime())), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::rotate(model, (float)glm::radians(25.0f + sign * 2 * i), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, penguinAngles[i], glm::vec3(0.0f, 1.0f, 0.0f));
             model = glm::scale(model, glm::vec3(0.4f));
-            modelShader.setMat4("model", model);
-            penguinModel.Draw(modelShader);
-        }
-        // drawing 6 stones
-        for(int i = 0; i < 6; i++) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, stonePositions[i]);
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::scale(model, glm::vec3(0.0007f));
-            modelShader.setMat4("model", model);
-            stoneModel.Draw(modelShader);
+            penguinTransforms.push_back(model);
         }
-        // drawing 5 ice blocks
-        for(int i = 0; i < 5; i++) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, iceBlockPositions[i]);
-            model = glm::rotate(model, (float)glm::radians(225.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::scale(model, glm::vec3(0.5f));
-            modelShader.setMat4("model", model);
-            iceBlockModel.Draw(modelShader);
-        };
 
-        octahedronShader.use();
-        octahedronShader.setMat4("view", view);
-        octahedronShader.setMat4("projection", projection);
-        setSpotLight(octahedronShader);
-        for(int i = 0; i < 5; i++) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, iglooPositions[i] + glm::vec3(-1.0f, 0.08f, 1.8f));
-            model = glm::rotate(model, (float) glm::radians(50.0), glm::vec3(0.7, 0.8, 0.2));
-            model = glm::scale(model, glm::vec3(0.2f));
-            octahedronShader.setMat4("model", model);
+        // frustum culling, before any GL work of the frame: penguins through the spatial grid, static chunks by box
+        Frustum frustum = Frustum::FromMatrix(projection * view);
+        bool cullOnGpu = gpuCulling && gpuPenguins != NULL;
+        if(runGridBenchmark) {
+            BenchmarkSpatialGrid(frustum);
+            runGridBenchmark = false;
+        }
+        if(runSkyProjectionBenchmark) {
+            BenchmarkCubemapProjection(CubemapPixels::Read(cubeMap));
+            runSkyProjectionBenchmark = false;
+        }
+        std::chrono::high_resolution_clock::time_point gridStart = std::chrono::high_resolution_clock::now();
+        objectGrid.ResetStats();
+        for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+            glm::vec3 center;
+            float radius;
+            TransformSphere(penguinModel.bounds, penguinTransforms[i], center, radius);
+            objectGrid.Move(penguinHandles[i], center, radius);
+        }
+        std::chrono::high_resolution_clock::time_point gridMoved = std::chrono::high_resolution_clock::now();
+        visibleIds.clear();
+        objectGrid.QueryFrustum(frustum, visibleIds);
+        std::chrono::high_resolution_clock::time_point gridQueried = std::chrono::high_resolution_clock::now();
+        renderStats.gridUpdateMs = std::chrono::duration<float, std::milli>(gridMoved - gridStart).count();
+        renderStats.gridQueryMs = std::chrono::duration<float, std::milli>(gridQueried - gridMoved).count();
+        renderStats.gridCellsVisited = objectGrid.GetStats().cellsVisited;
+        renderStats.gridObjectsTested = objectGrid.GetStats().objectsTested;
+
+        penguinVisible.assign(penguinTransforms.size(), 0);
+        for(unsigned int i = 0; i < visibleIds.size(); i++)
+            penguinVisible[visibleIds[i]] = 1;
+        renderStats.visibleObjects = visibleIds.size() + CullBoxes(frustum, chunkBoxes, chunkVisible);
+        if(!frustumCulling) {
+            std::fill(penguinVisible.begin(), penguinVisible.end(), 1);
+            std::fill(chunkVisible.begin(), chunkVisible.end(), 1);
+            renderStats.visibleObjects = penguinVisible.size() + chunkVisible.size();
+        }
+        // precomputed visibility: a chunk the camera's view cell can't see is out whatever the frustum says
+        renderStats.pvsCell = pvsCulling ? pvs.CellAt(viewPos) : -1;
+        renderStats.pvsCulled = 0;
+        for(unsigned int i = 0; i < chunkVisible.size() && renderStats.pvsCell >= 0; i++) {
+            if(chunkVisible[i] && !pvs.Visible(renderStats.pvsCell, i)) {
+                chunkVisible[i] = 0;
+                renderStats.pvsCulled++;
+                renderStats.visibleObjects--;
+            }
+        }
+        renderStats.culledObjects = penguinVisible.size() + chunkVisible.size() - renderStats.visibleObjects;
 
-            glBindVertexArray(VAO);
+        // chunks of a cluster drawn as its proxy are out before occlusion culling even looks at them
+        if(hlodProxies)
+            hlod.Update(viewPos, glm::radians(programState->camera.Zoom), hlodScreenSize);
+        else
+            hlod.UseInstances();
+        renderStats.hlodChunksReplaced = 0;
+        for(unsigned int i = 0; i < chunkVisible.size(); i++) {
+            const StaticBatcher::Chunk &chunk = staticBatches.Chunks()[i];
+            if(chunkVisible[i] && hlod.UsesProxy(hlod.ClusterOfCell(chunk.cellX, chunk.cellZ))) {
+                chunkVisible[i] = 0;
+                renderStats.hlodChunksReplaced++;
+            }
+        }
 
-            glm::vec3 colorStart(0.529f, 0.808f, 0.922f);
-            glm::vec3 colorEnd(0.2549f, 0.4118f, 0.8824f);
+        // whatever survived the frustum is tested against the igloo occluders on the worker threads,
+        // while this thread pushes the frame's uniforms
+        occludees.Clear();
+        occludeePenguins.clear();
+        occludeeChunks.clear();
+        if(occlusionMode == OCCLUSION_CPU) {
+            for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+                if(!penguinVisible[i])
+                    continue;
+                glm::vec3 center;
+                float radius;
+                TransformSphere(penguinModel.bounds, penguinTransforms[i], center, radius);
+                occludees.Add(center - glm::vec3(radius), center + glm::vec3(radius));
+                occludeePenguins.push_back(i);
+            }
+            for(unsigned int i = 0; i < chunkVisible.size(); i++) {
+                if(!chunkVisible[i])
+                    continue;
+                occludees.Add(staticBatches.Chunks()[i].boundsMin, staticBatches.Chunks()[i].boundsMax);
+                occludeeChunks.push_back(i);
+            }
+            occlusionCuller.Start(projection * view, occludees);
+        }
 
-            glm::vec3 colorByTime= glm::mix(colorStart, colorEnd, 0.5f * (1.0f + cos(glfwGetTime())));
+        // only what depends on the camera or on the settings is pushed every frame, the rest was set before the loop
+        modelShader.use();
+        modelShader.setMat4("projection", projection);
+        modelShader.setMat4("view", view);
+        modelShader.setVec3("viewPos", viewPos);
 
-            octahedronShader.setVec3("myColor", colorByTime);
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
+        modelShader.setBool("blinn_phong", blinn);
+        if(blinn)
+            std::cout << " The scene is currently lit by Blinn-Phong's lighting model" << std::endl;
+        else
+            std::cout << " The scene is currently lit by Phong's lighting model" << std::endl;
+        updateSpotLight(modelShader);
 
-            octahedronShader.setVec3("myColor", glm::vec3(0.0f, 0.0f, 0.0f));
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
+        staticBatchShader.use();
+        staticBatchShader.setMat4("projection", projection);
+        staticBatchShader.setMat4("view", view);
+        staticBatchShader.setVec3("viewPos", viewPos);
+        staticBatchShader.setBool("blinn_phong", blinn);
+        updateSpotLight(staticBatchShader);
 
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        // the GPU-culled penguins are never sorted by distance on the CPU, so they don't fade to impostors
+        bool penguinImpostorsOn = impostors && !cullOnGpu;
+        modelShader.use();
+        modelShader.setVec2("impostorFade", penguinImpostorsOn ? glm::vec2(impostorFadeStart, impostorFadeEnd) : glm::vec2(0.0f));
+        if(hlodProxies) {
+            hlodShader.use();
+            hlodShader.setMat4("projection", projection);
+            hlodShader.setMat4("view", view);
+            updateSpotLight(hlodShader);
+        }
+        if(impostors) {
+            impostorShader.use();
+            impostorShader.setMat4("projection", projection);
+            impostorShader.setMat4("view", view);
+            impostorShader.setVec3("viewPos", viewPos);
+            updateSpotLight(impostorShader);
         }
 
-        blendingShader.use();
-        blendingShader.setInt("texture1", 0);
-        glBindVertexArray(transparentVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, transparentTexture);
+        octahedronShader.use();
+        octahedronShader.setMat4("view", view);
+        octahedronShader.setMat4("projection", projection);
+        updateSpotLight(octahedronShader);
 
+        blendingShader.use();
         blendingShader.setMat4("view", view);
         blendingShader.setMat4("projection", projection);
-        setSpotLight(blendingShader);
-
-        for (std::map<float, glm::vec3>::reverse_iterator it = sorted.rbegin(); it != sorted.rend(); ++it)
-        {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, it->second);
-            model = glm::rotate(model, (float)glm::radians(-45.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-            model = glm::scale(model, glm::vec3(0.65f));
-            blendingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        };
+        updateSpotLight(blendingShader);
 
-        glEnable(GL_CULL_FACE);
         snowShader.use();
-        setSpotLight(snowShader);
-        snowShader.setBool("sl", spotlight);
         snowShader.setMat4("view", view);
         snowShader.setMat4("projection", projection);
-        for(int i = 0; i < 5; i++) {
-            snowShader.setVec3("pointLights[" + std::to_string(i+5) + "].position", iglooPositions[i] + glm::vec3(10.0f, 0.2f, 4.0f));
-            snowShader.setVec3("pointLights[" + std::to_string(i+5) + "].ambient", 0.05f, 0.05f, 0.05f);
-            snowShader.setVec3("pointLights[" + std::to_string(i+5) + "].diffuse", 0.8f, 0.8f, 0.0f);
-            snowShader.setVec3("pointLights[" + std::to_string(i+5) + "].specular", 0.8f, 0.8f, 0.8f);
-            snowShader.setFloat("pointLights[" + std::to_string(i+5) + "].constant", 1.0f);
-            snowShader.setFloat("pointLights[" + std::to_string(i+5) + "].linear", 0.22f);
-            snowShader.setFloat("pointLights[" + std::to_string(i+5) + "].quadratic", 0.20f);
-        }
-        for(int i = 0; i < 5; i++) {
-            snowShader.setVec3("pointLights[" + std::to_string(i) + "].position", iglooPositions[i] + glm::vec3(0.0f, 0.2f, 1.0f));
-            snowShader.setVec3("pointLights[" + std::to_string(i) + "].ambient", 0.05f, 0.05f, 0.05f);
-            snowShader.setVec3("pointLights[" + std::to_string(i) + "].diffuse", 0.8f, 0.8f, 0.0f);
-            snowShader.setVec3("pointLights[" + std::to_string(i) + "].specular", 0.8f, 0.8f, 0.8f);
-            snowShader.setFloat("pointLights[" + std::to_string(i) + "].constant", 1.0f);
-            snowShader.setFloat("pointLights[" + std::to_string(i) + "].linear", 0.22f);
-            snowShader.setFloat("pointLights[" + std::to_string(i) + "].quadratic", 0.20f);
-        }
-
-        snowShader.setVec3("viewPos", programState->camera.Position);
-
-        snowShader.setVec3("dirLight.direction", -4.0f, -0.5f, -1.5f);
-        snowShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-        snowShader.setVec3("dirLight.diffuse", 0.01f, 0.01f, 0.01f);
-        snowShader.setVec3("dirLight.specular", 0.4f, 0.4f, 0.4f);
+        snowShader.setVec3("viewPos", viewPos);
         snowShader.setBool("blinn_phong", blinn);
-
-        model = glm::mat4(1.0f);
-        snowShader.setMat4("model", model);
         snowShader.setFloat("height_scale", heightScale);
+        updateSpotLight(snowShader);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, normalMap);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, heightMap);
-
-        renderSnowGround();
-        glDisable(GL_CULL_FACE);
-
-        glDepthFunc(GL_LEQUAL);
         skyBoxShader.use();
-        skyBoxShader.setMat4("view", glm::mat4(glm::mat3(programState->camera.GetViewMatrix())));
+        skyBoxShader.setMat4("view", glm::mat4(glm::mat3(view)));
         skyBoxShader.setMat4("projection", projection);
-        glBindVertexArray(skyBoxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthFunc(GL_LESS);
+
+        octahedronColor = glm::mix(colorStart, colorEnd, 0.5f * (1.0f + cos(glfwGetTime())));
+
+        // GPU occlusion: depth pre-pass of the static chunks (the big occluders), then a query per bounding box.
+        // Chunks draw under conditional rendering, penguins (one multi-draw for all of them) use the last result.
+        renderQueue.opaqueDepthFunc = occlusionMode == OCCLUSION_GPU ? GL_LEQUAL : GL_LESS;
+        if(occlusionMode == OCCLUSION_GPU) {
+            gpuOcclusion.BeginFrame();
+
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            staticDepthShader.use();
+            staticDepthShader.setMat4("view", view);
+            staticDepthShader.setMat4("projection", projection);
+            glBindVertexArray(staticBatches.VAO);
+            for(unsigned int i = 0; i < chunkVisible.size(); i++)
+                if(chunkVisible[i])
+                    staticBatches.DrawChunk(i);
+            glBindVertexArray(0);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            boundingBoxShader.use();
+            boundingBoxShader.setMat4("view", view);
+            boundingBoxShader.setMat4("projection", projection);
+            gpuOcclusion.BeginQueries(boundingBoxShader);
+            for(unsigned int i = 0; i < chunkVisible.size(); i++)
+                if(chunkVisible[i])
+                    gpuOcclusion.Query(i, staticBatches.Chunks()[i].boundsMin, staticBatches.Chunks()[i].boundsMax, viewPos, 0.1f);
+            for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+                if(!penguinVisible[i]) {
+                    gpuOcclusion.Reset(firstPenguinQuery + i);
+                    continue;
+                }
+                glm::vec3 center;
+                float radius;
+                TransformSphere(penguinModel.bounds, penguinTransforms[i], center, radius);
+                gpuOcclusion.Query(firstPenguinQuery + i, center - glm::vec3(radius), center + glm::vec3(radius), viewPos, 0.1f);
+                penguinVisible[i] = gpuOcclusion.Visible(firstPenguinQuery + i);
+            }
+            gpuOcclusion.EndQueries();
+            renderStats.occludedObjects = gpuOcclusion.GetStats().occluded;
+            renderStats.queriesIssued = gpuOcclusion.GetStats().issued;
+            renderStats.queriesInFlight = gpuOcclusion.GetStats().inFlight;
+            renderStats.queriesSkipped = gpuOcclusion.GetStats().skipped;
+            renderStats.occlusionMs = 0.0f;
+        } else if(occlusionMode == OCCLUSION_HIZ) {
+            // culled here only means hidden in an older frame's depth: those objects are retested after the opaque pass
+            depthPyramid.BeginFrame();
+            secondChance.BeginFrame();
+            secondChanceChunks.clear();
+            secondChancePenguins.clear();
+            for(unsigned int i = 0; i < chunkVisible.size(); i++) {
+                if(chunkVisible[i] && depthPyramid.Occluded(staticBatches.Chunks()[i].boundsMin, staticBatches.Chunks()[i].boundsMax)) {
+                    chunkVisible[i] = 0;
+                    secondChanceChunks.push_back(i);
+                }
+            }
+            for(unsigned int i = 0; i < penguinTransforms.size() && !cullOnGpu; i++) {
+                if(!penguinVisible[i])
+                    continue;
+                glm::vec3 center;
+                float radius;
+                TransformSphere(penguinModel.bounds, penguinTransforms[i], center, radius);
+                if(depthPyramid.Occluded(center - glm::vec3(radius), center + glm::vec3(radius))) {
+                    penguinVisible[i] = 0;
+                    secondChancePenguins.push_back(i);
+                }
+            }
+            renderStats.occludedObjects = depthPyramid.GetStats().occluded;
+            renderStats.hizAge = depthPyramid.GetStats().age;
+            renderStats.occlusionMs = 0.0f;
+        } else if(occlusionMode == OCCLUSION_CPU) {
+            const vector<unsigned char> &unoccluded = occlusionCuller.Finish();
+            for(unsigned int i = 0; i < occludeePenguins.size(); i++)
+                penguinVisible[occludeePenguins[i]] = unoccluded[i];
+            for(unsigned int i = 0; i < occludeeChunks.size(); i++)
+                chunkVisible[occludeeChunks[i]] = unoccluded[occludeePenguins.size() + i];
+            renderStats.occludedObjects = occlusionCuller.GetStats().occluded;
+            renderStats.occlusionMs = occlusionCuller.GetStats().milliseconds;
+        } else {
+            renderStats.occludedObjects = 0;
+            renderStats.occlusionMs = 0.0f;
+        }
+        // penguins in the fade band are drawn both ways (the mesh and its impostor keep complementary pixels),
+        // past it only the impostor is left
+        penguinImpostors.fadeStart = iglooImpostors.fadeStart = impostorFadeStart;
+        penguinImpostors.fadeEnd = iglooImpostors.fadeEnd = impostorFadeEnd;
+        penguinImpostors.Clear();
+        iglooImpostors.Clear();
+        visiblePenguins.clear();
+        for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+            if(!penguinVisible[i])
+                continue;
+            if(penguinImpostorsOn) {
+                float weight = penguinImpostors.Weight(glm::length(viewPos - glm::vec3(penguinTransforms[i][3])));
+                if(weight > 0.0f)
+                    penguinImpostors.Add(penguinTransforms[i], weight);
+                if(weight >= 1.0f)
+                    continue;
+            }
+            visiblePenguins.push_back(penguinTransforms[i]);
+        }
+        // the static igloo meshes can't dither out per instance: their impostors fade in over them, and the chunk
+        // goes once its nearest point is past the band (every igloo in it is then a full impostor)
+        renderStats.impostorChunks = 0;
+        for(unsigned int i = 0; i < chunkDraws.size(); i++) {
+            bool enabled = chunkVisible[i];
+            if(enabled && impostors && iglooChunk[i]) {
+                const StaticBatcher::Chunk &chunk = staticBatches.Chunks()[i];
+                glm::vec3 outside = glm::max(glm::max(chunk.boundsMin - viewPos, viewPos - chunk.boundsMax), glm::vec3(0.0f));
+                if(glm::length(outside) >= impostorFadeEnd) {
+                    enabled = false;
+                    renderStats.impostorChunks++;
+                }
+            }
+            staticScene.SetEnabled(chunkDraws[i], enabled);
+        }
+        if(impostors) {
+            for(unsigned int i = 0; i < iglooTransforms.size(); i++) {
+                glm::vec3 center;
+                float radius;
+                TransformSphere(iglooModel.bounds, iglooTransforms[i], center, radius);
+                if(frustumCulling && TestBox(frustum, center - glm::vec3(radius), center + glm::vec3(radius)) == FRUSTUM_OUTSIDE)
+                    continue;
+                if(hlod.UsesProxy(hlod.ClusterAt(glm::vec3(iglooTransforms[i][3]))))
+                    continue;
+                float weight = iglooImpostors.Weight(glm::length(viewPos - glm::vec3(iglooTransforms[i][3])));
+                if(weight > 0.0f)
+                    iglooImpostors.Add(iglooTransforms[i], weight);
+            }
+        }
+        renderStats.impostorInstances = penguinImpostors.InstanceCount() + iglooImpostors.InstanceCount();
+
+        sceneRenderer.BeginFrame();
+        if(cullOnGpu) {
+            // all transforms go up, the compute shader decides what is drawn (Hi-Z only while that mode builds the pyramid)
+            gpuPenguins->SetInstances(penguinTransforms);
+            gpuPenguins->Cull(*gpuCullShader, frustum, occlusionMode == OCCLUSION_HIZ ? &depthPyramid : NULL);
+            renderStats.gpuCulledInstances = gpuPenguins->InstanceCount();
+        } else {
+            sceneRenderer.AddInstances(penguinModel, visiblePenguins);
+        }
+        // all of them cast shadows, whether the camera sees them or not
+        sceneRenderer.AddUnculledInstances(penguinModel, penguinTransforms);
+        sceneRenderer.meshletCulling = meshletCulling;
+        sceneRenderer.Prepare(viewPos, frustumCulling ? &frustum : NULL);
+        renderStats.meshletsTested = sceneRenderer.GetMeshletStats().tested;
+        renderStats.meshletsCulled = sceneRenderer.GetMeshletStats().backFacing + sceneRenderer.GetMeshletStats().outside;
+        renderStats.meshletTriangles = sceneRenderer.GetMeshletStats().trianglesDrawn;
+        renderStats.meshletTrianglesTotal = sceneRenderer.GetMeshletStats().trianglesTotal;
+
+        // light lists of this frame's clusters; the lanterns are only placed again when their count changes
+        if(lanternCount != placedLanterns) {
+            sceneLights.SetLights(villageLights(iglooPositions, glm::vec3(0.0f, 0.2f, 0.0f), glm::vec3(10.0f, 0.2f, 3.0f),
+                                                glm::vec3(18.0f, 18.0f, 0.0f), lanternCount));
+            groundLights.SetLights(villageLights(iglooPositions, glm::vec3(0.0f, 0.2f, 1.0f), glm::vec3(10.0f, 0.2f, 4.0f),
+                                                 glm::vec3(0.8f, 0.8f, 0.0f), lanternCount));
+            placedLanterns = lanternCount;
+            lightShadows.SetLights(sceneLights.Lights());
+            chunkLights.clear();
+            for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++)
+                chunkLights.push_back(sceneLights.ObjectLights(staticBatches.Chunks()[i].boundsMin, staticBatches.Chunks()[i].boundsMax));
+            hlodLights.clear();
+            for(unsigned int i = 0; i < hlod.Clusters().size(); i++)
+                hlodLights.push_back(sceneLights.ObjectLights(hlod.Clusters()[i].boundsMin, hlod.Clusters()[i].boundsMax));
+        }
+        if(objectLightLists) {
+            penguinBoxMin.clear();
+            penguinBoxMax.clear();
+            const vector<glm::mat4> &drawnPenguins = cullOnGpu ? penguinTransforms : visiblePenguins;
+            for(unsigned int i = 0; i < drawnPenguins.size(); i++) {
+                glm::vec3 center;
+                float radius;
+                TransformSphere(penguinModel.bounds, drawnPenguins[i], center, radius);
+                penguinBoxMin.push_back(center - glm::vec3(radius));
+                penguinBoxMax.push_back(center + glm::vec3(radius));
+            }
+            penguinLights = sceneLights.ObjectLights(penguinBoxMin, penguinBoxMax);
+        }
+        // sun shadows: the static map only when it is out of date, the penguins' map only when they moved
+        bool shadowMapsChanged = false;
+        if(shadows) {
+            shadowMapsChanged = sunShadows.RenderStatic(sceneMin, sceneMax, groundMin, groundMax, [&staticDepthShader, &staticBatches](const glm::mat4 &lightSpace) {
+                staticDepthShader.use();
+                staticDepthShader.setMat4("view", glm::mat4(1.0f));
+                staticDepthShader.setMat4("projection", lightSpace);
+                glBindVertexArray(staticBatches.VAO);
+                for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++)
+                    staticBatches.DrawChunk(i);
+                glBindVertexArray(0);
+            });
+            if(penguinTransforms != shadowedPenguins) {
+                glm::vec3 casterMin(1e30f), casterMax(-1e30f);
+                for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+                    glm::vec3 center;
+                    float radius;
+                    TransformSphere(penguinModel.bounds, penguinTransforms[i], center, radius);
+                    casterMin = glm::min(casterMin, center - glm::vec3(radius));
+                    casterMax = glm::max(casterMax, center + glm::vec3(radius));
+                }
+                sunShadows.RenderDynamic(casterMin, casterMax, groundMin, groundMax, penguinTransforms.size(),
+                                         [&modelDepthShader, &sceneRenderer](const glm::mat4 &lightSpace) {
+                    modelDepthShader.use();
+                    modelDepthShader.setMat4("view", glm::mat4(1.0f));
+                    modelDepthShader.setMat4("projection", lightSpace);
+                    sceneRenderer.DrawUnculledDepth();
+                });
+                shadowedPenguins = penguinTransforms;
+                shadowMapsChanged = true;
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+        }
+        renderStats.shadowStaticRenders = sunShadows.GetStats().staticRenders;
+        renderStats.shadowCasters = sunShadows.GetStats().dynamicCasters;
+        renderStats.shadowStaticMs = sunShadows.GetStats().staticMs;
+        renderStats.shadowDynamicMs = sunShadows.GetStats().dynamicMs;
+
+        // the igloo lamps are either baked or lit per fragment, the same everywhere: every shader skips this many lights
+        // and the shadow atlas leaves out just those. Shadowed lamps have to be lit per fragment, and the deferred pass
+        // has no lightmaps to read them from.
+        unsigned int bakedLightCount = lightmaps && !pointShadows && !deferredShading ? bakedLights.size() : 0;
+        if(bakedLightCount > 0 && staticLightmap.texture == 0)
+            loadLightmaps();
+        if(bakedLightCount > 0 && lightProbes && probeGrid.texture == 0)
+            loadLightProbes();
+        // point light shadows: the penguins that moved since the last update invalidate the faces they were and are in
+        if(pointShadows) {
+            movingCasters.clear();
+            for(unsigned int i = 0; i < penguinTransforms.size(); i++) {
+                if(i < lightShadowPenguins.size() && penguinTransforms[i] == lightShadowPenguins[i])
+                    continue;
+                PointShadowAtlas::Caster caster;
+                TransformSphere(penguinModel.bounds, penguinTransforms[i], caster.center, caster.radius);
+                movingCasters.push_back(caster);
+                if(i < lightShadowPenguins.size()) {
+                    TransformSphere(penguinModel.bounds, lightShadowPenguins[i], caster.center, caster.radius);
+                    movingCasters.push_back(caster);
+                }
+            }
+            lightShadowPenguins = penguinTransforms;
+            lightShadows.faceBudget = pointShadowFaceBudget;
+            lightShadows.Update(projection * view, viewPos, glm::radians(programState->camera.Zoom), (float) SCR_HEIGHT, movingCasters,
+                                bakedLightCount);
+            lightShadows.Render([&staticDepthShader, &staticBatches, &modelDepthShader, &sceneRenderer]
+                                (const glm::mat4 &viewProjection, const glm::vec3 &position, float range) {
+                staticDepthShader.use();
+                staticDepthShader.setMat4("view", glm::mat4(1.0f));
+                staticDepthShader.setMat4("projection", viewProjection);
+                glBindVertexArray(staticBatches.VAO);
+                for(unsigned int i = 0; i < staticBatches.Chunks().size(); i++) {
+                    const StaticBatcher::Chunk &chunk = staticBatches.Chunks()[i];
+                    if(glm::length(glm::clamp(position, chunk.boundsMin, chunk.boundsMax) - position) < range)
+                        staticBatches.DrawChunk(i);
+                }
+                glBindVertexArray(0);
+                // the penguins within the light's reach, one multi-draw per face
+                modelDepthShader.use();
+                modelDepthShader.setMat4("view", glm::mat4(1.0f));
+                modelDepthShader.setMat4("projection", viewProjection);
+                sceneRenderer.DrawUnculledDepth([&position, range](const glm::vec3 &center, float radius) {
+                    return glm::length(center - position) < range + radius;
+                });
+            });
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            renderStats.pointShadowLights = lightShadows.GetStats().shadowedLights;
+            renderStats.pointShadowFaces = lightShadows.GetStats().facesRendered;
+            renderStats.pointShadowFacesPending = lightShadows.GetStats().facesPending;
+            renderStats.pointShadowAtlasUsage = lightShadows.GetStats().atlasUsage;
+            renderStats.pointShadowMs = lightShadows.GetStats().milliseconds;
+        }
+        renderStats.objectListDraws = 0;
+        renderStats.objectListLights = 0;
+        renderStats.objectListFallbacks = 0;
+        sceneLights.Update(view, glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT);
+        groundLights.Update(view, glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT);
+        sceneLights.Bind();
+        staticLightmap.Bind(LIGHTMAP_UNIT);
+        groundLightmap.Bind(GROUND_LIGHTMAP_UNIT);
+        staticBatchShader.use();
+        staticBatchShader.setInt("bakedLightCount", bakedLightCount);
+        snowShader.use();
+        snowShader.setInt("bakedLightCount", bakedLightCount);
+        probeGrid.Bind();
+        // without the probes the moving models light the baked lamps per fragment; that only happens with point shadows
+        // off, so they are unshadowed there like everywhere else
+        modelShader.use();
+        modelShader.setInt("bakedLightCount", lightProbes ? bakedLightCount : 0);
+        sunShadows.Bind();
+        lightShadows.Bind();
+        ibl.Bind();
+        for(Shader *pbrShader : pbrShaders) {
+            pbrShader->use();
+            pbrShader->setBool("pbrShading", pbrShading);
+        }
+        for(Shader *shadowedShader : shadowedShaders) {
+            shadowedShader->use();
+            shadowedShader->setBool("shadows", shadows);
+            shadowedShader->setBool("pointShadows", pointShadows);
+            if(shadowMapsChanged)
+                sunShadows.SetUniforms(*shadowedShader);
+        }
+        renderStats.lights = sceneLights.GetStats().lights;
+        renderStats.visibleLights = sceneLights.GetStats().visibleLights;
+        renderStats.lightAssignments = sceneLights.GetStats().assignments + groundLights.GetStats().assignments;
+        renderStats.maxLightsPerCluster = std::max(sceneLights.GetStats().maxPerCluster, groundLights.GetStats().maxPerCluster);
+        renderStats.lightClusteringMs = sceneLights.GetStats().milliseconds + groundLights.GetStats().milliseconds;
+
+        // collect the frame's draws, the queue sorts them by pass, depth and state
+        renderQueue.Clear();
+        // models: one packet per material bucket (one multi-draw, or one instanced draw per mesh on GL 3.3)
+        for(unsigned int i = 0; i < sceneRenderer.Buckets().size(); i++) {
+            const MultiDrawRenderer::Bucket &bucket = sceneRenderer.Buckets()[i];
+            renderQueue.Submit(PASS_OPAQUE, bucket.nearestDistance, modelShader, sceneGeometry.VAO, bucket.materialId, false,
+                               [&sceneRenderer, &modelShader, &penguinLights, i]() {
+                setObjectLights(modelShader, penguinLights);
+                sceneRenderer.DrawBucket(i);
+            },
+                               [&sceneRenderer, &modelShader, i]() { sceneRenderer.BindBucketMaterial(modelShader, i); });
+        }
+        if(cullOnGpu) {
+            // the visible count never comes back to the CPU, so these are keyed as near
+            for(unsigned int i = 0; i < gpuPenguins->Buckets().size(); i++) {
+                renderQueue.Submit(PASS_OPAQUE, 0.0f, modelShader, gpuPenguins->VAO(), gpuPenguins->Buckets()[i].materialId, false,
+                                   [gpuPenguins, &modelShader, &penguinLights, i]() {
+                    setObjectLights(modelShader, penguinLights);
+                    gpuPenguins->DrawBucket(i);
+                },
+                                   [gpuPenguins, &modelShader, i]() { gpuPenguins->BindBucketMaterial(modelShader, i); });
+            }
+        }
+        // impostors: one instanced draw per model, all of them at least fadeStart away
+        ImpostorAtlas *impostorAtlases[] = {&penguinImpostors, &iglooImpostors};
+        for(ImpostorAtlas *atlas : impostorAtlases) {
+            if(atlas->InstanceCount() == 0)
+                continue;
+            renderQueue.Submit(PASS_OPAQUE, atlas->fadeStart, impostorShader, atlas->GetVAO(), atlas->albedoTexture, false,
+                               [atlas]() { atlas->Draw(); },
+                               [atlas, &impostorShader]() { atlas->BindMaterial(impostorShader); });
+        }
+        // HLOD proxies: a single draw for all materials and instances of a cluster
+        renderStats.hlodProxies = 0;
+        renderStats.hlodTriangles = 0;
+        for(unsigned int i = 0; i < hlod.Clusters().size(); i++) {
+            const HlodBuilder::Cluster &cluster = hlod.Clusters()[i];
+            if(!cluster.useProxy || (frustumCulling && TestBox(frustum, cluster.boundsMin, cluster.boundsMax) == FRUSTUM_OUTSIDE))
+                continue;
+            renderStats.hlodProxies++;
+            renderStats.hlodTriangles += cluster.indexCount / 3;
+            renderQueue.Submit(PASS_OPAQUE, glm::length(viewPos - cluster.center), hlodShader, hlod.VAO, 0, false,
+                               [&hlod, &hlodShader, &hlodLights, i]() {
+                setObjectLights(hlodShader, hlodLights[i]);
+                hlod.DrawCluster(i);
+            });
+        }
+        renderQueue.Submit(staticScene, viewPos);
+
+        renderQueue.Sort();
+        // deferred: the same opaque pass, its shaders only write their surfaces to the G-buffer (no blending there,
+        // the alpha channels hold data)
+        Shader *geometryShaders[] = {&modelShader, &staticBatchShader, &impostorShader, &hlodShader, &snowShader, &octahedronShader};
+        for(Shader *geometryShader : geometryShaders) {
+            geometryShader->use();
+            geometryShader->setBool("gBufferPass", deferredShading);
+        }
+        if(deferredShading) {
+            gBuffer.Bind();
+            glDisable(GL_BLEND);
+        }
+        renderQueue.Execute(PASS_OPAQUE, PASS_OPAQUE);
+
+        if(occlusionMode == OCCLUSION_HIZ) {
+            // second chance: what the old pyramid culled is queried against this frame's opaque depth and drawn
+            // under conditional rendering, so objects that just came out from behind an igloo don't pop in late
+            boundingBoxShader.use();
+            boundingBoxShader.setMat4("view", view);
+            boundingBoxShader.setMat4("projection", projection);
+            secondChance.BeginQueries(boundingBoxShader);
+            for(unsigned int i = 0; i < secondChanceChunks.size(); i++) {
+                unsigned int chunk = secondChanceChunks[i];
+                secondChance.Reset(chunk);
+                secondChance.Query(chunk, staticBatches.Chunks()[chunk].boundsMin, staticBatches.Chunks()[chunk].boundsMax, viewPos, 0.1f);
+            }
+            for(unsigned int i = 0; i < secondChancePenguins.size(); i++) {
+                unsigned int penguin = secondChancePenguins[i];
+                glm::vec3 center;
+                float radius;
+                TransformSphere(penguinModel.bounds, penguinTransforms[penguin], center, radius);
+                secondChance.Reset(firstPenguinQuery + penguin);
+                secondChance.Query(firstPenguinQuery + penguin, center - glm::vec3(radius), center + glm::vec3(radius), viewPos, 0.1f);
+            }
+            secondChance.EndQueries();
+
+            staticBatchShader.use();
+            glBindVertexArray(staticBatches.VAO);
+            for(unsigned int i = 0; i < secondChanceChunks.size(); i++) {
+                unsigned int chunk = secondChanceChunks[i];
+                secondChance.DrawConditional(chunk, [&staticBatches, &staticBatchShader, &chunkLights, chunk]() {
+                    staticBatches.BindMaterial(staticBatchShader, chunk);
+                    setObjectLights(staticBatchShader, chunkLights[chunk]);
+                    staticBatches.DrawChunk(chunk);
+                });
+            }
+            glBindVertexArray(0);
+            // the penguins come out of the multi-draw's buffers like in the first pass: every material bound once,
+            // then per penguin one multi-draw of its meshes in that material under the penguin's conditional render
+            if(objectLightLists && !secondChancePenguins.empty()) {
+                penguinBoxMin.clear();
+                penguinBoxMax.clear();
+                for(unsigned int i = 0; i < secondChancePenguins.size(); i++) {
+                    glm::vec3 center;
+                    float radius;
+                    TransformSphere(penguinModel.bounds, penguinTransforms[secondChancePenguins[i]], center, radius);
+                    penguinBoxMin.push_back(center - glm::vec3(radius));
+                    penguinBoxMax.push_back(center + glm::vec3(radius));
+                }
+                secondChanceLights = sceneLights.ObjectLights(penguinBoxMin, penguinBoxMax);
+            }
+            modelShader.use();
+            // they weren't visible when the impostors were picked, so they are drawn whole
+            modelShader.setVec2("impostorFade", glm::vec2(0.0f));
+            setObjectLights(modelShader, secondChanceLights);
+            sceneRenderer.DrawUnculled(modelShader, penguinModel, secondChancePenguins,
+                                       [&secondChance, firstPenguinQuery](unsigned int penguin, const std::function<void()> &draw) {
+                secondChance.DrawConditional(firstPenguinQuery + penguin, draw);
+            });
+            renderStats.secondChanceObjects = secondChanceChunks.size() + secondChancePenguins.size();
+
+            // this frame's depth becomes the pyramid the next frames test against
+            depthPyramid.Build(depthTexture, depthPyramidShader, projection * view);
+            glBindFramebuffer(GL_FRAMEBUFFER, deferredShading ? gBuffer.FBO : hdrFBO);
+        }
+
+        if(deferredShading) {
+            // one full screen pass per light set: the scene's lamps for everything but the ground, then the ground's.
+            // The point lights come from the same cluster lists as in the forward path
+            glDisable(GL_DEPTH_TEST);
+            deferredLightingShader.use();
+            deferredLightingShader.setMat4("inverseViewProjection", glm::inverse(projection * view));
+            deferredLightingShader.setVec3("viewPos", viewPos);
+            deferredLightingShader.setBool("blinn_phong", blinn);
+            updateSpotLight(deferredLightingShader);
+            gBuffer.BeginLighting(deferredLightingShader);
+            deferredLightingShader.setBool("groundPass", false);
+            renderQuad();
+            groundLights.Bind();
+            deferredLightingShader.setBool("groundPass", true);
+            renderQuad();
+            sceneLights.Bind();
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_BLEND);
+            // sky and transparent objects are drawn forward on top, against the depth the G-buffer pass left
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+        }
+
+        // occlusion of the opaque surfaces only, before the sky and the transparent objects write their depth
+        if(ambientOcclusion) {
+            ssao.SetScale(ambientOcclusionScale);
+            ssao.Render(depthTexture, projection, ssaoDepthShader, ssaoShader, ssaoBlurShader);
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            renderStats.ssaoWidth = ssao.GetStats().width;
+            renderStats.ssaoHeight = ssao.GetStats().height;
+            renderStats.ssaoDepthMs = ssao.GetStats().depthMs;
+            renderStats.ssaoOcclusionMs = ssao.GetStats().occlusionMs;
+            renderStats.ssaoBlurMs = ssao.GetStats().blurMs;
+            renderStats.ssaoCompositeMs = ssao.GetStats().compositeMs;
+        }
+
+        renderQueue.Execute(PASS_SKY, PASS_TRANSPARENT);
+        renderStats.modelDrawCalls = sceneRenderer.DrawCalls() + (cullOnGpu ? gpuPenguins->Buckets().size() : 0);
+        renderStats.queuePackets = renderQueue.PacketCount();
+        renderStats.queueStateChanges = renderQueue.StateChanges();
+        renderStats.retainedPackets = renderQueue.RetainedPacketCount();
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         // blur bright fragments with two-pass Gaussian Blur
@@ -684,7 +1702,20 @@ int main() {
         glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
         finalScreenShader.setBool("bloom", bloom);
         finalScreenShader.setFloat("exposure", exposure);
-        renderQuad();
+        finalScreenShader.setBool("ssao", ambientOcclusion);
+        if(ambientOcclusion) {
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, ssao.texture);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glActiveTexture(GL_TEXTURE0);
+            ssao.SetCompositeUniforms(finalScreenShader, 2, 3, projection);
+            ssao.Composite([]() {
+                renderQuad();
+            });
+        } else {
+            renderQuad();
+        }
 
         std::cout << "bloom: " << (bloom ? "on" : "off") << std::endl;
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -698,6 +1729,8 @@ int main() {
 
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
+    delete gpuPenguins;
+    delete gpuCullShader;
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -831,6 +1864,127 @@ void DrawImGui(ProgramState *programState) {
         ImGui::End();
     }
 
+    {
+        ImGui::Begin("Renderer");
+        ImGui::Text("OpenGL %d.%d (%s)", GLVersion.major, GLVersion.minor, glExtensions.multiDrawIndirect ? "multi-draw indirect" : "3.3 fallback");
+        ImGui::Text("Model draw calls: %u", renderStats.modelDrawCalls);
+        ImGui::Text("Render queue: %u packets, %u state changes", renderStats.queuePackets, renderStats.queueStateChanges);
+        ImGui::Text("Retained packets: %u", renderStats.retainedPackets);
+        ImGui::Text("Static batches: %u chunks, %u triangles", renderStats.staticChunks, renderStats.staticTriangles);
+        ImGui::Checkbox("Frustum culling", &frustumCulling);
+        ImGui::Text("Visible: %u, culled: %u", renderStats.visibleObjects, renderStats.culledObjects);
+        ImGui::Text("Spatial grid: update %.3f ms, query %.3f ms", renderStats.gridUpdateMs, renderStats.gridQueryMs);
+        ImGui::Text("Spatial grid: %u cells visited, %u objects tested", renderStats.gridCellsVisited, renderStats.gridObjectsTested);
+        if(ImGui::Button("Benchmark spatial grid (1k/10k/100k)"))
+            runGridBenchmark = true;
+        ImGui::Text("Sky ambient: projected in %.2f ms", renderStats.skyProjectionMs);
+        ImGui::SameLine();
+        if(ImGui::Button("Benchmark SH projection"))
+            runSkyProjectionBenchmark = true;
+        ImGui::Checkbox("Meshlet culling", &meshletCulling);
+        if(meshletCulling)
+            ImGui::Text("Meshlets: %u culled of %u, %u of %u triangles drawn", renderStats.meshletsCulled, renderStats.meshletsTested,
+                        renderStats.meshletTriangles, renderStats.meshletTrianglesTotal);
+        if(glExtensions.computeShaders) {
+            ImGui::Checkbox("GPU culling (compute + indirect)", &gpuCulling);
+            if(gpuCulling)
+                ImGui::Text("GPU culled instances: %u (visible count stays on the GPU)", renderStats.gpuCulledInstances);
+        } else {
+            ImGui::Text("GPU culling needs OpenGL 4.3");
+        }
+        ImGui::Checkbox("Impostors", &impostors);
+        if(impostors) {
+            ImGui::SliderFloat("Impostor fade start", &impostorFadeStart, 1.0f, 100.0f);
+            ImGui::SliderFloat("Impostor fade end", &impostorFadeEnd, impostorFadeStart, 100.0f);
+            ImGui::Text("Impostors: %u instances, %u igloo chunks replaced", renderStats.impostorInstances, renderStats.impostorChunks);
+        }
+        ImGui::Checkbox("PVS culling", &pvsCulling);
+        if(pvsCulling) {
+            if(renderStats.pvsCell >= 0)
+                ImGui::Text("PVS: cell %d, %u chunks hidden", renderStats.pvsCell, renderStats.pvsCulled);
+            else
+                ImGui::Text("PVS: camera outside the baked area");
+        }
+        ImGui::Checkbox("Deferred shading", &deferredShading);
+        ImGui::SameLine();
+        ImGui::Text("(frame %.2f ms)", deltaTime * 1000.0f);
+        ImGui::SliderInt("Lanterns", &lanternCount, 0, 500);
+        ImGui::Checkbox("Per-object light lists", &objectLightLists);
+        if(objectLightLists)
+            ImGui::Text("Object lists: %u draws, %.1f lights each, %u over %d lights (clustered)", renderStats.objectListDraws,
+                        renderStats.objectListDraws ? (float)renderStats.objectListLights / renderStats.objectListDraws : 0.0f,
+                        renderStats.objectListFallbacks, MAX_OBJECT_LIGHTS);
+        ImGui::Checkbox("Lightmaps", &lightmaps);
+        if(lightmaps && (pointShadows || deferredShading))
+            ImGui::Text("Lightmaps: not read, the lamps are lit per fragment for point shadows or deferred shading");
+        else if(lightmaps) {
+            if(renderStats.lightmapsCached)
+                ImGui::Text("Lightmaps: %u lamps on %u surfaces, %u texels, from the cache", renderStats.bakedLights,
+                            renderStats.lightmapSurfaces, renderStats.lightmapTexels);
+            else
+                ImGui::Text("Lightmaps: %u lamps baked on %u surfaces, %u texels, %.0f ms", renderStats.bakedLights,
+                            renderStats.lightmapSurfaces, renderStats.lightmapTexels, renderStats.lightmapBakeMs);
+            ImGui::Checkbox("Light probes", &lightProbes);
+            if(lightProbes && renderStats.lightProbesCached)
+                ImGui::Text("Light probes: %u, from the cache", renderStats.lightProbes);
+            else if(lightProbes)
+                ImGui::Text("Light probes: %u, baked in %.0f ms", renderStats.lightProbes, renderStats.lightProbeBakeMs);
+        }
+        ImGui::Checkbox("Physically based props", &pbrShading);
+        if(pbrShading) {
+            if(renderStats.iblCached)
+                ImGui::Text("Specular IBL: BRDF table and prefiltered sky from the cache");
+            else
+                ImGui::Text("Specular IBL: BRDF table and prefiltered sky baked in %.0f ms", renderStats.iblBakeMs);
+        }
+        ImGui::Checkbox("Ambient occlusion", &ambientOcclusion);
+        if(ambientOcclusion) {
+            ImGui::RadioButton("Half resolution", &ambientOcclusionScale, 2);
+            ImGui::SameLine();
+            ImGui::RadioButton("Quarter resolution", &ambientOcclusionScale, 4);
+            ImGui::Text("SSAO %ux%u: depth %.3f ms, occlusion %.3f ms, blur %.3f ms, upsample + composite %.3f ms", renderStats.ssaoWidth,
+                        renderStats.ssaoHeight, renderStats.ssaoDepthMs, renderStats.ssaoOcclusionMs, renderStats.ssaoBlurMs,
+                        renderStats.ssaoCompositeMs);
+        }
+        ImGui::Checkbox("Sun shadows", &shadows);
+        if(shadows)
+            ImGui::Text("Shadows: static map rendered %u times (last %.2f ms), %u penguins (last %.2f ms)", renderStats.shadowStaticRenders,
+                        renderStats.shadowStaticMs, renderStats.shadowCasters, renderStats.shadowDynamicMs);
+        ImGui::Checkbox("Point light shadows", &pointShadows);
+        if(pointShadows) {
+            ImGui::SliderInt("Shadow faces per frame", &pointShadowFaceBudget, 1, 48);
+            ImGui::Text("Point shadows: %u lights, %u faces rendered, %u waiting, atlas %.0f%% used, %.2f ms", renderStats.pointShadowLights,
+                        renderStats.pointShadowFaces, renderStats.pointShadowFacesPending, renderStats.pointShadowAtlasUsage * 100.0f,
+                        renderStats.pointShadowMs);
+        }
+        ImGui::Text("Lights: %u, %u in view, %u cluster entries (max %u), %.3f ms", renderStats.lights, renderStats.visibleLights,
+                    renderStats.lightAssignments, renderStats.maxLightsPerCluster, renderStats.lightClusteringMs);
+        ImGui::Checkbox("HLOD proxies", &hlodProxies);
+        if(hlodProxies) {
+            ImGui::SliderFloat("HLOD screen size", &hlodScreenSize, 0.05f, 1.0f);
+            ImGui::Text("HLOD: %u proxies (%u triangles) for %u chunks", renderStats.hlodProxies, renderStats.hlodTriangles,
+                        renderStats.hlodChunksReplaced);
+        }
+        ImGui::Text("Occlusion culling:");
+        ImGui::SameLine();
+        ImGui::RadioButton("Off", &occlusionMode, OCCLUSION_OFF);
+        ImGui::SameLine();
+        ImGui::RadioButton("CPU", &occlusionMode, OCCLUSION_CPU);
+        ImGui::SameLine();
+        ImGui::RadioButton("GPU queries", &occlusionMode, OCCLUSION_GPU);
+        ImGui::SameLine();
+        ImGui::RadioButton("Hi-Z", &occlusionMode, OCCLUSION_HIZ);
+        if(occlusionMode == OCCLUSION_HIZ)
+            ImGui::Text("Occluded: %u (depth %u frames old), second chance: %u", renderStats.occludedObjects,
+                        renderStats.hizAge, renderStats.secondChanceObjects);
+        else if(occlusionMode == OCCLUSION_GPU)
+            ImGui::Text("Occluded: %u, queries: %u issued, %u in flight, %u skipped", renderStats.occludedObjects,
+                        renderStats.queriesIssued, renderStats.queriesInFlight, renderStats.queriesSkipped);
+        else
+            ImGui::Text("Occluded: %u (%.3f ms)", renderStats.occludedObjects, renderStats.occlusionMs);
+        ImGui::End();
+    }
+
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
@@ -936,6 +2090,13 @@ void setSpotLight(Shader& shader) {
     shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(18.0f)));
 }
 
+// the part of the spotlight that follows the camera, the constants are set once with setSpotLight
+void updateSpotLight(Shader& shader) {
+    shader.setBool("sl", spotlight);
+    shader.setVec3("spotLight.position", programState->camera.Position);
+    shader.setVec3("spotLight.direction", programState->camera.Front);
+}
+
 unsigned int snowVAO = 0;
 unsigned int snowVBO;
 void renderSnowGround(){
@@ -1030,6 +2191,59 @@ void renderSnowGround(){
 }
 unsigned int quadVAO = 0;
 unsigned int quadVBO;
+// the igloo lamps (one at the door of each igloo, one out on its lamp post) and lanterns on a golden angle spiral
+// around the village, the same every run
+vector<ClusteredLights::Light> villageLights(const glm::vec3 *iglooPositions, const glm::vec3 &doorOffset, const glm::vec3 &lampOffset,
+                                             const glm::vec3 &diffuse, int lanterns)
+{
+    vector<ClusteredLights::Light> lights;
+    const glm::vec3 *offsets[2] = {&doorOffset, &lampOffset};
+    glm::vec3 center(0.0f);
+    for(int o = 0; o < 2; o++) {
+        for(int i = 0; i < 5; i++) {
+            ClusteredLights::Light light;
+            light.position = iglooPositions[i] + *offsets[o];
+            light.ambient = glm::vec3(0.05f);
+            light.diffuse = diffuse;
+            light.specular = glm::vec3(0.8f);
+            light.linear = 0.22f;
+            light.quadratic = 0.20f;
+            lights.push_back(light);
+        }
+    }
+    for(int i = 0; i < 5; i++)
+        center += iglooPositions[i] / 5.0f;
+    for(int i = 0; i < lanterns; i++) {
+        float angle = i * 2.39996323f;
+        float radius = 30.0f * sqrt((i + 0.5f) / lanterns);
+        ClusteredLights::Light light;
+        light.position = glm::vec3(center.x + radius * cos(angle), 0.3f, center.z + radius * sin(angle));
+        light.ambient = glm::vec3(0.0f);
+        light.diffuse = glm::vec3(1.6f, 1.0f, 0.4f);
+        light.specular = glm::vec3(0.3f);
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        lights.push_back(light);
+    }
+    return lights;
+}
+
+// the object's own light list when per-object lists are on (unless it overflowed), its clusters' lights otherwise
+void setObjectLights(Shader &shader, const ClusteredLights::ObjectLightList &list)
+{
+    if(!objectLightLists) {
+        ClusteredLights::UseClusters(shader);
+        return;
+    }
+    ClusteredLights::SetObjectLights(shader, list);
+    if(list.count < 0) {
+        renderStats.objectListFallbacks++;
+    } else {
+        renderStats.objectListDraws++;
+        renderStats.objectListLights += list.count;
+    }
+}
+
 void renderQuad()
 {
     if (quadVAO == 0)